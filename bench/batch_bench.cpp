@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "rbtree.hpp"
+
+namespace {
+
+const int tree_size = 1 << 20;
+
+// odd keys so that every batch key is missing from the even tree
+std::vector<int> random_keys(int count, bool odd)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(0, tree_size - 1);
+    std::vector<int> keys(count);
+    for (int& key: keys) key = 2 * dist(rng) + (odd ? 1 : 0);
+    return keys;
+}
+
+RBTree<int> even_tree()
+{
+    std::vector<int> keys(tree_size);
+    for (int i = 0; i < tree_size; ++i) keys[i] = 2 * i;
+    return RBTree<int>(keys.begin(), keys.end());
+}
+
+void BM_InsertLoop(benchmark::State& state)
+{
+    std::vector<int> batch = random_keys(state.range(0), true);
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        RBTree<int> tree = even_tree();
+        state.ResumeTiming();
+
+        for (int key: batch) tree.insert(key);
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_InsertBatch(benchmark::State& state)
+{
+    std::vector<int> batch = random_keys(state.range(0), true);
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        RBTree<int> tree = even_tree();
+        state.ResumeTiming();
+
+        benchmark::DoNotOptimize(tree.insert_batch(batch.begin(), batch.end()));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_EraseLoop(benchmark::State& state)
+{
+    std::vector<int> batch = random_keys(state.range(0), false);
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        RBTree<int> tree = even_tree();
+        state.ResumeTiming();
+
+        for (int key: batch) tree.remove(key);
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_EraseBatch(benchmark::State& state)
+{
+    std::vector<int> batch = random_keys(state.range(0), false);
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        RBTree<int> tree = even_tree();
+        state.ResumeTiming();
+
+        benchmark::DoNotOptimize(tree.erase_batch(batch.begin(), batch.end()));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+}
+
+BENCHMARK(BM_InsertLoop)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_InsertBatch)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EraseLoop)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EraseBatch)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,94 @@
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "rbtree.hpp"
+#include "rbtree_concurrent.hpp"
+
+namespace {
+
+const int tree_size = 1 << 20;
+
+// about one write per hundred operations, spread over the threads
+const int write_every = 100;
+
+RBConcurrentTree<int>& concurrent_tree()
+{
+    static RBConcurrentTree<int> tree;
+    static std::once_flag filled;
+    std::call_once(filled, []() {
+        for (int i = 0; i < tree_size; ++i) tree.insert(2 * i);
+    });
+    return tree;
+}
+
+struct LockedTree
+{
+    std::shared_mutex lock;
+    RBTree<int> tree;
+};
+
+LockedTree& locked_tree()
+{
+    static LockedTree locked;
+    static std::once_flag filled;
+    std::call_once(filled, []() {
+        std::vector<int> keys(tree_size);
+        for (int i = 0; i < tree_size; ++i) keys[i] = 2 * i;
+        locked.tree.build_from_sorted(keys.begin(), keys.end());
+    });
+    return locked;
+}
+
+void BM_ConcurrentReadMostly(benchmark::State& state)
+{
+    RBConcurrentTree<int>& tree = concurrent_tree();
+    std::mt19937 rng(state.thread_index());
+    int operations = 0;
+    for (auto _: state)
+    {
+        int key = 2 * int(rng() % tree_size);
+        if (++operations % write_every == 0)
+        {
+            // odd keys come and go, the tree keeps its size
+            tree.insert(key + 1);
+            tree.remove(key + 1);
+        }
+        else
+        {
+            benchmark::DoNotOptimize(tree.contains(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_SharedMutexReadMostly(benchmark::State& state)
+{
+    LockedTree& locked = locked_tree();
+    std::mt19937 rng(state.thread_index());
+    int operations = 0;
+    for (auto _: state)
+    {
+        int key = 2 * int(rng() % tree_size);
+        if (++operations % write_every == 0)
+        {
+            std::unique_lock<std::shared_mutex> guard(locked.lock);
+            locked.tree.insert(key + 1);
+            locked.tree.remove(key + 1);
+        }
+        else
+        {
+            std::shared_lock<std::shared_mutex> guard(locked.lock);
+            benchmark::DoNotOptimize(locked.tree.find(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK(BM_ConcurrentReadMostly)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_SharedMutexReadMostly)->ThreadRange(1, 16)->UseRealTime();
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "rbmap.hpp"
+#include "rbtree.hpp"
+
+// largest tree of the suite, raised up to 100M through CMake
+#ifndef RBTREE_BENCH_MAX_SIZE
+#define RBTREE_BENCH_MAX_SIZE 1000000
+#endif
+
+namespace {
+
+// the order operations visit the keys in
+enum class Keys { SEQUENTIAL, RANDOM, ZIPFIAN };
+
+typedef RBTree<int> RBSet;
+typedef std::set<int> StdSet;
+typedef RBMap<int, int> RBIntMap;
+typedef std::map<int, int> StdMap;
+
+// the containers behind one interface, maps store the key as value too
+template<typename Container>
+struct Ops
+{
+    static void insert(Container& c, int key) { c.insert(key); }
+    static bool find(Container& c, int key) { return c.contains(key); }
+    static void remove(Container& c, int key) { c.remove(key); }
+    static int key(int value) { return value; }
+};
+
+template<>
+struct Ops<RBIntMap>
+{
+    static void insert(RBIntMap& c, int key) { c.try_emplace(key, key); }
+    static bool find(RBIntMap& c, int key) { return c.contains(key); }
+    static void remove(RBIntMap& c, int key) { c.remove(key); }
+    static int key(const std::pair<const int, int>& value) { return value.first; }
+};
+
+template<>
+struct Ops<StdSet>
+{
+    static void insert(StdSet& c, int key) { c.insert(key); }
+    static bool find(StdSet& c, int key) { return c.find(key) != c.end(); }
+    static void remove(StdSet& c, int key) { c.erase(key); }
+    static int key(int value) { return value; }
+};
+
+template<>
+struct Ops<StdMap>
+{
+    static void insert(StdMap& c, int key) { c.try_emplace(key, key); }
+    static bool find(StdMap& c, int key) { return c.find(key) != c.end(); }
+    static void remove(StdMap& c, int key) { c.erase(key); }
+    static int key(const std::pair<const int, int>& value) { return value.first; }
+};
+
+/**
+ * Zipfian ranks in [0, n) with skew 0.99, in O(1) a draw once the zeta
+ * constant is summed (Gray et al., "Quickly generating billion-record
+ * synthetic databases"), so 100M keys need no table.
+ */
+class Zipfian
+{
+public:
+    explicit Zipfian(std::uint64_t n) : _n(n)
+    {
+        double zeta2 = 1 + std::pow(0.5, _theta);
+        for (std::uint64_t i = 1; i <= n; ++i) _zetan += std::pow(1.0 / i, _theta);
+        _eta = (1 - std::pow(2.0 / n, 1 - _theta)) / (1 - zeta2 / _zetan);
+    }
+
+    std::uint64_t operator()(std::mt19937_64& rng)
+    {
+        double u = std::uniform_real_distribution<double>()(rng);
+        double uz = u * _zetan;
+        if (uz < 1) return 0;
+        if (uz < 1 + std::pow(0.5, _theta)) return 1;
+        std::uint64_t rank = static_cast<std::uint64_t>(_n * std::pow(_eta * u - _eta + 1, 1 / (1 - _theta)));
+        return std::min(rank, _n - 1);
+    }
+
+private:
+    static constexpr double _theta = 0.99;
+
+    std::uint64_t _n;
+    double _zetan = 0;
+    double _eta = 0;
+};
+
+// spreads the hot ranks over the key space instead of its low end
+int scramble(std::uint64_t rank, std::uint64_t n)
+{
+    rank ^= rank >> 33;
+    rank *= 0xff51afd7ed558ccdULL;
+    rank ^= rank >> 33;
+    return static_cast<int>(rank % n);
+}
+
+// count keys of [0, universe) in the given order. RANDOM is a permutation
+// repeated as needed, ZIPFIAN repeats the hot keys.
+std::vector<int> key_stream(Keys order, std::size_t universe, std::size_t count, unsigned seed = 42)
+{
+    std::vector<int> keys(count);
+    std::mt19937_64 rng(seed);
+    if (order == Keys::SEQUENTIAL)
+    {
+        for (std::size_t i = 0; i < count; ++i) keys[i] = static_cast<int>(i % universe);
+    }
+    else if (order == Keys::RANDOM)
+    {
+        std::vector<int> permutation(universe);
+        for (std::size_t i = 0; i < universe; ++i) permutation[i] = static_cast<int>(i);
+        std::shuffle(permutation.begin(), permutation.end(), rng);
+        for (std::size_t i = 0; i < count; ++i) keys[i] = permutation[i % universe];
+    }
+    else
+    {
+        Zipfian zipfian(universe);
+        for (int& key: keys) key = scramble(zipfian(rng), universe);
+    }
+    return keys;
+}
+
+// every key of [0, n), in order for SEQUENTIAL and shuffled otherwise, so
+// that the node layout follows the insertion order of the workload
+template<typename Container>
+void fill(Container& c, Keys order, std::size_t n)
+{
+    for (int key: key_stream(order == Keys::SEQUENTIAL ? order : Keys::RANDOM, n, n)) Ops<Container>::insert(c, key);
+}
+
+template<typename Container, Keys Order>
+void BM_Insert(benchmark::State& state)
+{
+    std::size_t n = state.range(0);
+    std::vector<int> keys = key_stream(Order, n, n);
+    for (auto _: state)
+    {
+        Container c;
+        for (int key: keys) Ops<Container>::insert(c, key);
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// probes of [0, 2n), one in two misses under SEQUENTIAL and RANDOM
+template<typename Container, Keys Order>
+void BM_Find(benchmark::State& state)
+{
+    std::size_t n = state.range(0);
+    Container c;
+    fill(c, Order, n);
+
+    std::vector<int> probes = key_stream(Order, 2 * n, std::min<std::size_t>(2 * n, 1 << 22), 7);
+    std::size_t next = 0;
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(Ops<Container>::find(c, probes[next]));
+        if (++next == probes.size()) next = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Container, Keys Order>
+void BM_Remove(benchmark::State& state)
+{
+    std::size_t n = state.range(0);
+    std::vector<int> keys = key_stream(Order, n, n, 7);
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        Container c;
+        fill(c, Order, n);
+        state.ResumeTiming();
+
+        for (int key: keys) Ops<Container>::remove(c, key);
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// every key erased by iterator while walking, no lookup involved
+template<typename Container, Keys Order>
+void BM_EraseWalk(benchmark::State& state)
+{
+    std::size_t n = state.range(0);
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        Container c;
+        fill(c, Order, n);
+        state.ResumeTiming();
+
+        for (auto it = c.begin(); it != c.end();) it = c.erase(it);
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// 80% finds, 10% inserts and 10% removes of keys in [0, 2n)
+template<typename Container, Keys Order>
+void BM_Mixed(benchmark::State& state)
+{
+    std::size_t n = state.range(0);
+    Container c;
+    fill(c, Order, n);
+
+    std::size_t count = std::min<std::size_t>(2 * n, 1 << 22);
+    std::vector<int> keys = key_stream(Order, 2 * n, count, 7);
+    std::vector<unsigned char> ops(count);
+    std::mt19937 rng(11);
+    for (unsigned char& op: ops) op = rng() % 10;
+
+    std::size_t next = 0;
+    for (auto _: state)
+    {
+        if (ops[next] == 0) Ops<Container>::insert(c, keys[next]);
+        else if (ops[next] == 1) Ops<Container>::remove(c, keys[next]);
+        else benchmark::DoNotOptimize(Ops<Container>::find(c, keys[next]));
+        if (++next == count) next = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// in-order walk, over nodes laid out in the insertion order
+template<typename Container, Keys Order>
+void BM_Iterate(benchmark::State& state)
+{
+    std::size_t n = state.range(0);
+    Container c;
+    fill(c, Order, n);
+
+    for (auto _: state)
+    {
+        long sum = 0;
+        for (const auto& value: c) sum += Ops<Container>::key(value);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// 1K, 10K, ... up to RBTREE_BENCH_MAX_SIZE
+void sizes(benchmark::internal::Benchmark* b)
+{
+    for (long n = 1000; n <= RBTREE_BENCH_MAX_SIZE; n *= 10) b->Arg(n);
+}
+
+}
+
+#define CORE_BENCHMARK(op, container) \
+    BENCHMARK_TEMPLATE2(op, container, Keys::SEQUENTIAL)->Apply(sizes); \
+    BENCHMARK_TEMPLATE2(op, container, Keys::RANDOM)->Apply(sizes); \
+    BENCHMARK_TEMPLATE2(op, container, Keys::ZIPFIAN)->Apply(sizes)
+
+#define CORE_BENCHMARKS(op) \
+    CORE_BENCHMARK(op, RBSet); \
+    CORE_BENCHMARK(op, StdSet); \
+    CORE_BENCHMARK(op, RBIntMap); \
+    CORE_BENCHMARK(op, StdMap)
+
+CORE_BENCHMARKS(BM_Insert);
+CORE_BENCHMARKS(BM_Find);
+CORE_BENCHMARKS(BM_Remove);
+CORE_BENCHMARKS(BM_EraseWalk);
+CORE_BENCHMARKS(BM_Mixed);
+CORE_BENCHMARKS(BM_Iterate);
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "bplus_tree.hpp"
+#include "rbtree_frozen.hpp"
+
+namespace {
+
+std::vector<int> shuffled_keys(int count)
+{
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+    return keys;
+}
+
+// ranks random probes among the keys of one full node
+template<BPlusSearchKernel Kernel>
+void BM_NodeRank(benchmark::State& state)
+{
+    if (Kernel > BPlusSearch<int>::kernel())
+    {
+        state.SkipWithError("kernel not supported by this CPU");
+        return;
+    }
+
+    std::vector<int> keys(state.range(0));
+    for (int i = 0; i < state.range(0); ++i) keys[i] = 2 * i;
+    // too many probes for the branch predictor to learn their sequence
+    std::mt19937 rng(7);
+    std::vector<int> probes(1 << 16);
+    for (int& probe: probes) probe = rng() % (2 * state.range(0));
+
+    std::size_t next = 0;
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(BPlusSearch<int>::rank<false>(keys.data(), keys.size(), probes[next], Kernel));
+        if (++next == probes.size()) next = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<SearchTreeEngine Engine>
+void BM_EngineInsert(benchmark::State& state)
+{
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    for (auto _: state)
+    {
+        SearchTree<int, Engine> tree;
+        for (int key: keys) tree.insert(key);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<SearchTreeEngine Engine>
+void BM_EngineFind(benchmark::State& state)
+{
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    SearchTree<int, Engine> tree;
+    for (int key: keys) tree.insert(key);
+
+    // one probe in two misses
+    std::vector<int> probes = shuffled_keys(2 * state.range(0));
+    std::size_t next = 0;
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(tree.contains(probes[next]));
+        if (++next == probes.size()) next = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_FrozenFind(benchmark::State& state)
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(state.range(0))) tree.insert(key);
+    FrozenIndex<int> index = tree.freeze();
+
+    std::vector<int> probes = shuffled_keys(2 * state.range(0));
+    std::size_t next = 0;
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(index.contains(probes[next]));
+        if (++next == probes.size()) next = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<SearchTreeEngine Engine>
+void BM_EngineRemove(benchmark::State& state)
+{
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        SearchTree<int, Engine> tree;
+        for (int key: keys) tree.insert(key);
+        state.ResumeTiming();
+
+        for (int key: keys) tree.remove(key);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<SearchTreeEngine Engine>
+void BM_EngineIterate(benchmark::State& state)
+{
+    SearchTree<int, Engine> tree;
+    for (int key: shuffled_keys(state.range(0))) tree.insert(key);
+
+    for (auto _: state)
+    {
+        long sum = 0;
+        for (int key: tree) sum += key;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+}
+
+BENCHMARK_TEMPLATE(BM_NodeRank, BPlusSearchKernel::SCALAR)->Arg(64);
+BENCHMARK_TEMPLATE(BM_NodeRank, BPlusSearchKernel::SSE2)->Arg(64);
+BENCHMARK_TEMPLATE(BM_NodeRank, BPlusSearchKernel::AVX2)->Arg(64);
+BENCHMARK_TEMPLATE(BM_EngineInsert, SearchTreeEngine::RED_BLACK)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_EngineInsert, SearchTreeEngine::B_PLUS)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_EngineFind, SearchTreeEngine::RED_BLACK)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_EngineFind, SearchTreeEngine::B_PLUS)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_FrozenFind)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_EngineRemove, SearchTreeEngine::RED_BLACK)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_EngineRemove, SearchTreeEngine::B_PLUS)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_EngineIterate, SearchTreeEngine::RED_BLACK)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_EngineIterate, SearchTreeEngine::B_PLUS)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
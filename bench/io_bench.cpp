@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "rbtree_io.hpp"
+
+namespace {
+
+const char* const saved_tree = "rbtree_bench_saved.bin";
+
+std::vector<int> shuffled_keys(int count)
+{
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+    return keys;
+}
+
+// a restart without a saved tree: every key inserted again
+void BM_RestartByInsert(benchmark::State& state)
+{
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    for (auto _: state)
+    {
+        RBTree<int> tree;
+        for (int key: keys) tree.insert(key);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_RestartByLoad(benchmark::State& state)
+{
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    RBTree<int> saved;
+    saved.build_from_sorted(keys.begin(), keys.end());
+    saved.save(saved_tree);
+
+    for (auto _: state)
+    {
+        RBTree<int> tree;
+        tree.load(saved_tree);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    std::remove(saved_tree);
+}
+
+#ifdef RB_TREE_MMAP
+
+// maps the file and answers a thousand lookups
+void BM_RestartByMapping(benchmark::State& state)
+{
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    RBTree<int> saved;
+    saved.build_from_sorted(keys.begin(), keys.end());
+    saved.save(saved_tree);
+    std::vector<int> probes(keys.begin(), keys.begin() + 1000);
+
+    for (auto _: state)
+    {
+        RBMappedTree<int> tree(saved_tree);
+        for (int probe: probes) benchmark::DoNotOptimize(tree.find(probe));
+    }
+    std::remove(saved_tree);
+}
+
+BENCHMARK(BM_RestartByMapping)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+
+#endif
+
+// the text of every node handed to a callback that drops it
+void BM_DumpText(benchmark::State& state)
+{
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    RBTree<int> tree;
+    tree.build_from_sorted(keys.begin(), keys.end());
+
+    for (auto _: state)
+    {
+        std::size_t bytes = 0;
+        tree.dump([&bytes](const char*, std::size_t length) { bytes += length; });
+        benchmark::DoNotOptimize(bytes);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+}
+
+BENCHMARK(BM_RestartByInsert)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RestartByLoad)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DumpText)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,114 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "rbtree.hpp"
+
+namespace {
+
+// order statistics on, so the subtree sizes are checked too
+typedef RBTree<int, std::less<int>, std::allocator<int>, RBTreeIdentity<int>, true> Tree;
+
+void check(const Tree& tree, const std::set<int>& expected)
+{
+    std::string error;
+    if (!tree.validate(&error))
+    {
+        std::fprintf(stderr, "invalid tree: %s\n", error.c_str());
+        std::abort();
+    }
+    if (tree.size() != expected.size() || !std::equal(tree.cbegin(), tree.cend(), expected.begin(), expected.end()))
+    {
+        std::fprintf(stderr, "tree and std::set differ\n");
+        std::abort();
+    }
+}
+
+}
+
+// Every two bytes of the input are an operation and a key. The tree is
+// validated and compared with a std::set after each operation.
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+    Tree tree;
+    std::set<int> expected;
+
+    for (std::size_t i = 0; i + 1 < size; i += 2)
+    {
+        int key = data[i + 1];
+        switch (data[i] % 8)
+        {
+        case 0:
+        case 1:
+            tree.insert(key);
+            expected.insert(key);
+            break;
+        case 2:
+            tree.emplace(key);
+            expected.insert(key);
+            break;
+        case 3:
+            tree.remove(key);
+            expected.erase(key);
+            break;
+        case 4:
+        {
+            // by position: erased, or moved to another tree and back
+            auto pos = tree.lower_bound(key);
+            if (pos == tree.end()) break;
+            if (data[i] & 8)
+            {
+                Tree side;
+                int moved = *pos;
+                side.insert(tree.extract(pos));
+                check(side, std::set<int> { moved });
+                tree.insert(side.extract(moved));
+            }
+            else
+            {
+                expected.erase(*pos);
+                tree.erase(pos);
+            }
+            break;
+        }
+        case 5:
+        {
+            // every other key of a small run
+            std::vector<int> batch;
+            for (int k = key; k < key + 16; k += 2) batch.push_back(k);
+            if (data[i] & 8)
+            {
+                tree.insert_batch(batch.begin(), batch.end());
+                expected.insert(batch.begin(), batch.end());
+            }
+            else
+            {
+                tree.erase_batch(batch.begin(), batch.end());
+                for (int k: batch) expected.erase(k);
+            }
+            break;
+        }
+        case 6:
+        {
+            // the halves are checked apart, then joined back
+            Tree right = tree.split(key);
+            std::set<int> expected_right(expected.lower_bound(key), expected.end());
+            std::set<int> expected_left(expected.begin(), expected.lower_bound(key));
+            check(tree, expected_left);
+            check(right, expected_right);
+            tree.join(right);
+            break;
+        }
+        default:
+            if (tree.lower_bound(key) != tree.end() && *tree.lower_bound(key) != *expected.lower_bound(key)) std::abort();
+            if (!tree.empty() && tree.rank(key) != std::size_t(std::distance(expected.begin(), expected.lower_bound(key)))) std::abort();
+            break;
+        }
+        check(tree, expected);
+    }
+    return 0;
+}
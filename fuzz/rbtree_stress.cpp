@@ -0,0 +1,46 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "rbtree.hpp"
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size);
+
+// Feeds random inputs to the fuzz target where libFuzzer is not
+// available, then profiles a tree grown by random insertions.
+//
+// usage: rbtree_stress [inputs] [seed]
+int main(int argc, char** argv)
+{
+    long inputs = argc > 1 ? std::atol(argv[1]) : 2000;
+    unsigned seed = argc > 2 ? std::atoi(argv[2]) : 42;
+
+    std::mt19937 rng(seed);
+    std::vector<std::uint8_t> input;
+    for (long i = 0; i < inputs; ++i)
+    {
+        input.resize(rng() % 4096);
+        for (std::uint8_t& byte: input) byte = rng();
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    std::printf("%ld random inputs passed\n", inputs);
+
+    RBTree<std::uint32_t> tree;
+    for (int i = 0; i < 1000000; ++i) tree.insert(rng());
+    if (!tree.validate())
+    {
+        std::printf("random tree is invalid\n");
+        return 1;
+    }
+
+    RBTreeProfile profile = tree.profile();
+    std::printf("%zu random keys: height %zu, black height %zu, average depth %.2f, %zu red nodes\n",
+        profile.size, profile.height, profile.black_height, profile.average_depth, profile.red_nodes);
+    for (std::size_t depth = 0; depth < profile.depth_histogram.size(); ++depth)
+    {
+        std::printf("%4zu %zu\n", depth + 1, profile.depth_histogram[depth]);
+    }
+    return 0;
+}
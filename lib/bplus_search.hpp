@@ -0,0 +1,178 @@
+#ifndef SWIG
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define B_PLUS_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+#endif
+
+#ifndef B_PLUS_SEARCH
+#define B_PLUS_SEARCH
+
+/**
+ * @brief Ways of ranking a key among the sorted keys of a node, from the
+ * 		narrowest to the widest.
+ */
+enum class BPlusSearchKernel { SCALAR, SSE2, AVX2 };
+
+/**
+ * @brief Whether keys ordered by Compare are plain numbers that can be
+ * 		compared a whole vector at a time.
+ */
+template<typename Key, typename Compare>
+struct BPlusSearchVectorizable : std::integral_constant<bool,
+	((std::is_integral<Key>::value && !std::is_same<Key, bool>::value)
+		|| std::is_same<Key, float>::value || std::is_same<Key, double>::value)
+	&& (std::is_same<Compare, std::less<Key>>::value || std::is_same<Compare, std::less<>>::value)> {};
+
+/**
+ * @brief Ranks a key among the sorted keys of a B+ tree node.
+ *
+ * Within a node, a binary search mispredicts about every other branch.
+ * The vector kernels instead compare every key of the node against the
+ * probe, 16 or 32 bytes at a time, without a single data-dependent
+ * branch. As the keys are sorted, the hits of a block form a prefix and
+ * their number is the count of trailing ones of its byte mask. The AVX2
+ * kernel is compiled for AVX2 alone and only run once the CPU is known to
+ * have it, the scalar binary search is the fallback off x86.
+ *
+ * @tparam Key Arithmetic key type, see BPlusSearchVectorizable.
+ */
+template<typename Key>
+class BPlusSearch
+{
+public:
+	/**
+	 * @brief Number of the n sorted keys less than key, or not greater
+	 * 		than key if Upper is set, using the widest kernel available.
+	 */
+	template<bool Upper>
+	static std::size_t rank(const Key* keys, std::size_t n, Key key)
+	{
+		return rank<Upper>(keys, n, key, kernel());
+	}
+
+	/**
+	 * @brief Same, with a given kernel, which the CPU must support.
+	 */
+	template<bool Upper>
+	static std::size_t rank(const Key* keys, std::size_t n, Key key, BPlusSearchKernel kernel);
+
+	/**
+	 * @brief The widest kernel the CPU runs, detected once.
+	 */
+	static BPlusSearchKernel kernel();
+
+private:
+	template<bool Upper>
+	static std::size_t _scalar(const Key* keys, std::size_t n, Key key);
+
+#ifdef B_PLUS_SEARCH_X86
+	template<bool Upper>
+	static std::size_t _sse2(const Key* keys, std::size_t n, Key key);
+
+	template<bool Upper>
+	__attribute__((target("avx2"))) static std::size_t _avx2(const Key* keys, std::size_t n, Key key);
+
+	/**
+	 * @brief Bytes set in mask, a prefix of its bits.
+	 */
+	static std::size_t _prefix(std::uint32_t mask) { return __builtin_ctzll(~std::uint64_t(mask)); }
+#endif
+};
+
+template<typename Key>
+template<bool Upper>
+std::size_t BPlusSearch<Key>::rank(const Key* keys, std::size_t n, Key key, BPlusSearchKernel kernel)
+{
+#ifdef B_PLUS_SEARCH_X86
+	if (kernel == BPlusSearchKernel::AVX2) return _avx2<Upper>(keys, n, key);
+	if (kernel == BPlusSearchKernel::SSE2) return _sse2<Upper>(keys, n, key);
+#endif
+	return _scalar<Upper>(keys, n, key);
+}
+
+template<typename Key>
+BPlusSearchKernel BPlusSearch<Key>::kernel()
+{
+	static const BPlusSearchKernel widest = []() {
+#ifdef B_PLUS_SEARCH_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return BPlusSearchKernel::AVX2;
+		return BPlusSearchKernel::SSE2;
+#else
+		return BPlusSearchKernel::SCALAR;
+#endif
+	}();
+	return widest;
+}
+
+/*******************
+ * PRIVATE HELPERS *
+ *******************/
+
+template<typename Key>
+template<bool Upper>
+std::size_t BPlusSearch<Key>::_scalar(const Key* keys, std::size_t n, Key key)
+{
+	if (Upper) return std::upper_bound(keys, keys + n, key) - keys;
+	return std::lower_bound(keys, keys + n, key) - keys;
+}
+
+#ifdef B_PLUS_SEARCH_X86
+
+template<typename Key>
+template<bool Upper>
+std::size_t BPlusSearch<Key>::_sse2(const Key* keys, std::size_t n, Key key)
+{
+	// GCC vector extensions pick the compare for the key type.
+	typedef Key Vector __attribute__((vector_size(16), aligned(alignof(Key))));
+	constexpr std::size_t width = 16 / sizeof(Key);
+
+	Vector probe = Vector() + key;
+	std::size_t bytes = 0;
+	std::size_t i = 0;
+	for (; i + width <= n; i += width)
+	{
+		Vector block = *reinterpret_cast<const Vector*>(keys + i);
+		__m128i hits = reinterpret_cast<__m128i>(Upper ? block <= probe : block < probe);
+		bytes += _prefix(std::uint32_t(_mm_movemask_epi8(hits)));
+	}
+
+	std::size_t count = bytes / sizeof(Key);
+	for (; i < n; ++i) count += Upper ? !(key < keys[i]) : keys[i] < key;
+	return count;
+}
+
+template<typename Key>
+template<bool Upper>
+std::size_t BPlusSearch<Key>::_avx2(const Key* keys, std::size_t n, Key key)
+{
+	typedef Key Vector __attribute__((vector_size(32), aligned(alignof(Key))));
+	constexpr std::size_t width = 32 / sizeof(Key);
+
+	Vector probe = Vector() + key;
+	std::size_t bytes = 0;
+	std::size_t i = 0;
+	for (; i + width <= n; i += width)
+	{
+		Vector block = *reinterpret_cast<const Vector*>(keys + i);
+		__m256i hits = reinterpret_cast<__m256i>(Upper ? block <= probe : block < probe);
+		bytes += _prefix(std::uint32_t(_mm256_movemask_epi8(hits)));
+	}
+
+	std::size_t count = bytes / sizeof(Key);
+	for (; i < n; ++i) count += Upper ? !(key < keys[i]) : keys[i] < key;
+	return count;
+}
+
+#endif
+
+#endif // B_PLUS_SEARCH
@@ -0,0 +1,1028 @@
+#ifndef SWIG
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#endif
+
+#include "bplus_search.hpp"
+#include "rbtree.hpp"
+
+#ifndef B_PLUS_TREE
+#define B_PLUS_TREE
+
+/**
+ * @brief Ordered set of unique keys laid out as a B+ tree, a drop-in
+ * 		alternative to RBTree for lookup heavy workloads.
+ *
+ * A red-black tree costs a cache miss per level, about 25 of them for
+ * 30M keys. Here every node holds a block of keys starting on a cache
+ * line, searched in place before a single pointer is followed, so a
+ * lookup touches about log_64(n) nodes instead. Values are stored in the
+ * leaves only, which are linked for iteration. Inner nodes hold copies
+ * of separating keys.
+ *
+ * Unlike RBTree, values move between nodes: any insert() or remove()
+ * invalidates iterators and references. Values and keys must therefore
+ * be nothrow move constructible.
+ *
+ * @tparam T Stored value type.
+ * @tparam Compare Strict weak ordering of the keys.
+ * @tparam Allocator Allocator the nodes are obtained from.
+ * @tparam KeyOfValue Extracts the key out of a stored value, see
+ * 		RBTreeIdentity and RBTreeSelectFirst.
+ */
+template<typename T,
+	typename Compare = std::less<typename RBTreeIdentity<T>::key_type>,
+	typename Allocator = std::allocator<T>,
+	typename KeyOfValue = RBTreeIdentity<T>>
+class BPlusTree
+{
+public:
+	typedef T value_type;
+	typedef typename KeyOfValue::key_type key_type;
+
+private:
+	static_assert(std::is_nothrow_move_constructible<T>::value, "values are moved between nodes");
+	static_assert(std::is_nothrow_move_constructible<key_type>::value, "keys are moved between nodes");
+
+	// bytes of keys or values held by a node, four cache lines.
+	static constexpr std::size_t _node_bytes = 256;
+	static constexpr std::size_t _cache_line = 64;
+
+	// even, so that a split leaves two halves of at least half the size.
+	static constexpr std::size_t _leaf_capacity = std::max<std::size_t>(4, _node_bytes / sizeof(T) / 2 * 2);
+	static constexpr std::size_t _inner_capacity = std::max<std::size_t>(4, _node_bytes / sizeof(key_type) / 2 * 2);
+
+	// a node holding that many entries or less cannot give one away.
+	static constexpr std::size_t _leaf_minimum = _leaf_capacity / 2;
+	static constexpr std::size_t _inner_minimum = (_inner_capacity - 1) / 2;
+
+	// numeric keys are ranked a vector at a time, see BPlusSearch.
+	static constexpr bool _vector_keys = BPlusSearchVectorizable<key_type, Compare>::value;
+	static constexpr bool _vector_values = _vector_keys && std::is_same<KeyOfValue, RBTreeIdentity<T>>::value;
+
+	struct _Node {};
+
+	struct _Leaf : _Node
+	{
+		alignas(alignof(T) > _cache_line ? alignof(T) : _cache_line)
+		unsigned char storage[_leaf_capacity * sizeof(T)];
+		std::size_t count = 0;
+		_Leaf* prev = nullptr;
+		_Leaf* next = nullptr;
+
+		T* values() { return std::launder(reinterpret_cast<T*>(storage)); }
+		const T* values() const { return std::launder(reinterpret_cast<const T*>(storage)); }
+	};
+
+	/**
+	 * @brief Keys of children[i] are not less than keys[i - 1] and less
+	 * 		than keys[i].
+	 */
+	struct _Inner : _Node
+	{
+		alignas(alignof(key_type) > _cache_line ? alignof(key_type) : _cache_line)
+		unsigned char storage[_inner_capacity * sizeof(key_type)];
+		std::size_t count = 0;
+		_Node* children[_inner_capacity + 1];
+
+		key_type* keys() { return std::launder(reinterpret_cast<key_type*>(storage)); }
+		const key_type* keys() const { return std::launder(reinterpret_cast<const key_type*>(storage)); }
+	};
+
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<_Leaf> _LeafAllocator;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<_Inner> _InnerAllocator;
+
+	/**
+	 * @brief Position of a value in a leaf. The past-the-end position is
+	 * 		one past the last value of the last leaf.
+	 */
+	template<bool Const>
+	class _Iterator
+	{
+		typedef typename std::conditional<Const, const _Leaf*, _Leaf*>::type LeafPtr;
+
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef typename std::conditional<Const, const T*, T*>::type pointer;
+		typedef typename std::conditional<Const, const T&, T&>::type reference;
+
+		_Iterator() = default;
+
+		template<bool C = Const, typename = typename std::enable_if<C>::type>
+		_Iterator(const _Iterator<false>& other) : _leaf(other._leaf), _index(other._index) {}
+
+		reference operator*() const { return _leaf->values()[_index]; }
+		pointer operator->() const { return _leaf->values() + _index; }
+
+		_Iterator& operator++()
+		{
+			if (++_index == _leaf->count && _leaf->next != nullptr)
+			{
+				_leaf = _leaf->next;
+				_index = 0;
+			}
+			return *this;
+		}
+
+		_Iterator operator++(int)
+		{
+			_Iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		_Iterator& operator--()
+		{
+			if (_index == 0)
+			{
+				_leaf = _leaf->prev;
+				_index = _leaf->count;
+			}
+			--_index;
+			return *this;
+		}
+
+		_Iterator operator--(int)
+		{
+			_Iterator old = *this;
+			--*this;
+			return old;
+		}
+
+		friend bool operator==(const _Iterator& a, const _Iterator& b)
+		{
+			return a._leaf == b._leaf && a._index == b._index;
+		}
+
+		friend bool operator!=(const _Iterator& a, const _Iterator& b) { return !(a == b); }
+
+	private:
+		friend class BPlusTree;
+		template<bool> friend class _Iterator;
+
+		_Iterator(LeafPtr leaf, std::size_t index) : _leaf(leaf), _index(index) {}
+
+		LeafPtr _leaf = nullptr;
+		std::size_t _index = 0;
+	};
+
+public:
+	typedef _Iterator<false> iterator;
+	typedef _Iterator<true> const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+	BPlusTree() : BPlusTree(Compare()) {}
+
+	explicit BPlusTree(const Compare& compare, const Allocator& alloc = Allocator())
+		: _compare(compare), _alloc(alloc) {}
+
+	explicit BPlusTree(const Allocator& alloc) : BPlusTree(Compare(), alloc) {}
+
+	BPlusTree(const BPlusTree& other);
+
+	BPlusTree(BPlusTree&& other) : BPlusTree(other._compare, other._alloc) {
+		swap(other);
+	}
+
+	BPlusTree& operator=(BPlusTree other) {
+		swap(other);
+		return *this;
+	}
+
+	~BPlusTree() { clear(); }
+
+	/**
+	 * @return iterator The position of the value stored under key, or
+	 * 		end().
+	 */
+	iterator find(const key_type& key);
+	const_iterator find(const key_type& key) const;
+
+	bool contains(const key_type& key) const { return find(key) != end(); }
+
+	/**
+	 * @brief Insert value unless an equivalent key is already stored.
+	 *
+	 * @return std::pair<iterator, bool> The position of the value stored
+	 * 		under the key and whether the insertion took place.
+	 */
+	std::pair<iterator, bool> insert(const T& value) { return _insert(value); }
+	std::pair<iterator, bool> insert(T&& value) { return _insert(std::move(value)); }
+
+	/**
+	 * @brief Construct a value out of args and insert it, see insert().
+	 */
+	template<typename... Args>
+	std::pair<iterator, bool> emplace(Args&&... args);
+
+	/**
+	 * @brief Remove the value stored under key, if any. key may not refer
+	 * 		to a stored value, which could move meanwhile.
+	 *
+	 * @return bool Whether a value was removed.
+	 */
+	bool remove(const key_type& key);
+
+	/**
+	 * @brief Drop every value, O(n).
+	 */
+	void clear();
+
+	void swap(BPlusTree& other) noexcept;
+
+	bool empty() const { return _size == 0; }
+	std::size_t size() const { return _size; }
+
+	iterator lower_bound(const key_type& key);
+	const_iterator lower_bound(const key_type& key) const;
+	iterator upper_bound(const key_type& key);
+	const_iterator upper_bound(const key_type& key) const;
+
+	iterator begin() { return iterator(_head, 0); }
+	iterator end() { return iterator(_tail, _tail == nullptr ? 0 : _tail->count); }
+	const_iterator begin() const { return const_iterator(_head, 0); }
+	const_iterator end() const { return const_iterator(_tail, _tail == nullptr ? 0 : _tail->count); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+private:
+	const key_type& _key(const T& value) const { return KeyOfValue()(value); }
+
+	/**
+	 * @brief Index of the child of node whose keys may include key.
+	 */
+	std::size_t _child_index(const _Inner* node, const key_type& key) const;
+
+	/**
+	 * @brief Index of the first value of leaf not less than key.
+	 */
+	std::size_t _leaf_index(const _Leaf* leaf, const key_type& key) const;
+
+	/**
+	 * @brief Leaf and index of the first value not less than key, or
+	 * 		of the first greater than key if Upper is set.
+	 */
+	template<bool Upper>
+	std::pair<_Leaf*, std::size_t> _bound(const key_type& key) const;
+
+	template<typename Value>
+	std::pair<iterator, bool> _insert(Value&& value);
+
+	bool _full(const _Node* node, std::size_t level) const;
+	bool _minimal(const _Node* node, std::size_t level) const;
+
+	/**
+	 * @brief Split the full child i of parent in two halves. level is the
+	 * 		one of the child, 0 for leaves.
+	 */
+	void _split(_Inner* parent, std::size_t i, std::size_t level);
+
+	/**
+	 * @brief Grow the minimal child i of parent above the minimum, from
+	 * 		a sibling or by merging with one.
+	 *
+	 * @return std::size_t The index of the child now holding the keys of
+	 * 		child i.
+	 */
+	std::size_t _refill(_Inner* parent, std::size_t i, std::size_t level);
+
+	void _borrow_left(_Inner* parent, std::size_t i, std::size_t level);
+	void _borrow_right(_Inner* parent, std::size_t i, std::size_t level);
+
+	/**
+	 * @brief Append child i + 1 of parent to child i.
+	 */
+	void _merge(_Inner* parent, std::size_t i, std::size_t level);
+
+	/**
+	 * @brief Insert key before keys[i] of node and child right of it.
+	 */
+	template<typename Key>
+	void _insert_separator(_Inner* node, std::size_t i, Key&& key, _Node* child);
+
+	/**
+	 * @brief Move count entries to the disjoint range or the lower
+	 * 		overlapping range starting at to.
+	 */
+	template<typename V>
+	static void _relocate(V* from, V* to, std::size_t count);
+
+	/**
+	 * @brief Move count entries to the higher overlapping range starting
+	 * 		at to.
+	 */
+	template<typename V>
+	static void _relocate_backward(V* from, V* to, std::size_t count);
+
+	_Node* _clone(const _Node* node, std::size_t level, _Leaf*& last);
+
+	_Leaf* _create_leaf();
+	_Inner* _create_inner();
+	void _free(_Leaf* leaf);
+	void _free(_Inner* node);
+	void _destroy(_Node* node, std::size_t level);
+
+	Compare _compare;
+	Allocator _alloc;
+	_Node* _root = nullptr;
+	// levels of inner nodes above the leaves.
+	std::size_t _height = 0;
+	_Leaf* _head = nullptr;
+	_Leaf* _tail = nullptr;
+	std::size_t _size = 0;
+};
+
+/**
+ * @brief RBTree behind the signatures of BPlusTree: lookups return
+ * 		iterators, insert() tells whether it inserted and remove()
+ * 		whether it removed. The rest of the RBTree interface is kept.
+ */
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+class RBSearchTree : public RBTree<T, Compare, Allocator, KeyOfValue>
+{
+	typedef RBTree<T, Compare, Allocator, KeyOfValue> Base;
+
+public:
+	typedef T value_type;
+	typedef typename Base::key_type key_type;
+	typedef typename Base::iterator iterator;
+	typedef typename Base::const_iterator const_iterator;
+
+	using Base::Base;
+
+	iterator find(const key_type& key) { return this->iterator_to(Base::find(key)); }
+	const_iterator find(const key_type& key) const { return const_cast<RBSearchTree*>(this)->find(key); }
+
+	bool contains(const key_type& key) const { return find(key) != this->end(); }
+
+	std::pair<iterator, bool> insert(const T& value) { return _found(Base::try_emplace(KeyOfValue()(value), value)); }
+	std::pair<iterator, bool> insert(T&& value) { return _found(Base::try_emplace(KeyOfValue()(value), std::move(value))); }
+
+	template<typename... Args>
+	std::pair<iterator, bool> emplace(Args&&... args) { return _found(Base::emplace(std::forward<Args>(args)...)); }
+
+	bool remove(const key_type& key);
+
+	void swap(RBSearchTree& other) noexcept { Base::swap(other); }
+
+	iterator lower_bound(const key_type& key) { return Base::lower_bound(key); }
+	const_iterator lower_bound(const key_type& key) const { return const_cast<RBSearchTree*>(this)->lower_bound(key); }
+	iterator upper_bound(const key_type& key) { return Base::upper_bound(key); }
+	const_iterator upper_bound(const key_type& key) const { return const_cast<RBSearchTree*>(this)->upper_bound(key); }
+
+private:
+	std::pair<iterator, bool> _found(std::pair<typename Base::NodePtr, bool> result)
+	{
+		return { this->iterator_to(result.first), result.second };
+	}
+};
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+bool RBSearchTree<T, Compare, Allocator, KeyOfValue>::remove(const key_type& key)
+{
+	// a single lookup, the node is then taken out where it is.
+	iterator pos = find(key);
+	if (pos == this->end()) return false;
+
+	this->erase(pos);
+	return true;
+}
+
+/**
+ * @brief Search tree layouts an ordered set can be built on.
+ */
+enum class SearchTreeEngine { RED_BLACK, B_PLUS };
+
+/**
+ * @brief Ordered set on the engine of choice, so that both can be run
+ * 		through the same code. Both provide the same signatures for
+ * 		insert(), emplace(), find(), contains(), remove(), lower_bound(),
+ * 		upper_bound(), iteration, size(), swap() and clear(), the red-black
+ * 		engine through RBSearchTree.
+ */
+template<typename T,
+	SearchTreeEngine Engine,
+	typename Compare = std::less<typename RBTreeIdentity<T>::key_type>,
+	typename Allocator = std::allocator<T>,
+	typename KeyOfValue = RBTreeIdentity<T>>
+using SearchTree = typename std::conditional<Engine == SearchTreeEngine::B_PLUS,
+	BPlusTree<T, Compare, Allocator, KeyOfValue>,
+	RBSearchTree<T, Compare, Allocator, KeyOfValue>>::type;
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+BPlusTree<T, Compare, Allocator, KeyOfValue>::BPlusTree(const BPlusTree& other)
+	: BPlusTree(other._compare, other._alloc)
+{
+	if (other._root == nullptr) return;
+
+	_Leaf* last = nullptr;
+	_root = _clone(other._root, other._height, last);
+	_height = other._height;
+	_size = other._size;
+	_tail = last;
+
+	_Node* node = _root;
+	for (std::size_t level = _height; level > 0; --level) node = static_cast<_Inner*>(node)->children[0];
+	_head = static_cast<_Leaf*>(node);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::iterator BPlusTree<T, Compare, Allocator, KeyOfValue>::find(const key_type& key)
+{
+	std::pair<_Leaf*, std::size_t> bound = _bound<false>(key);
+	if (bound.first == nullptr || bound.second == bound.first->count
+		|| _compare(key, _key(bound.first->values()[bound.second]))) return end();
+
+	return iterator(bound.first, bound.second);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::const_iterator BPlusTree<T, Compare, Allocator, KeyOfValue>::find(const key_type& key) const
+{
+	return const_cast<BPlusTree*>(this)->find(key);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename... Args>
+std::pair<typename BPlusTree<T, Compare, Allocator, KeyOfValue>::iterator, bool> BPlusTree<T, Compare, Allocator, KeyOfValue>::emplace(Args&&... args)
+{
+	return _insert(T(std::forward<Args>(args)...));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+bool BPlusTree<T, Compare, Allocator, KeyOfValue>::remove(const key_type& key)
+{
+	if (_root == nullptr) return false;
+
+	// top down, a child is refilled before it is entered so that it can
+	// spare an entry when its own child or itself loses one.
+	_Node* node = _root;
+	for (std::size_t level = _height; level > 0; --level)
+	{
+		_Inner* inner = static_cast<_Inner*>(node);
+		std::size_t i = _child_index(inner, key);
+		if (_minimal(inner->children[i], level - 1)) i = _refill(inner, i, level - 1);
+		node = inner->children[i];
+
+		if (inner->count == 0)
+		{
+			// the root merged its last two children.
+			_root = node;
+			--_height;
+			_free(inner);
+		}
+	}
+
+	_Leaf* leaf = static_cast<_Leaf*>(node);
+	std::size_t i = _leaf_index(leaf, key);
+	if (i == leaf->count || _compare(key, _key(leaf->values()[i]))) return false;
+
+	leaf->values()[i].~T();
+	_relocate(leaf->values() + i + 1, leaf->values() + i, leaf->count - i - 1);
+	--leaf->count;
+	--_size;
+
+	// only the root is allowed to run empty.
+	if (leaf->count == 0)
+	{
+		_free(leaf);
+		_root = nullptr;
+		_head = _tail = nullptr;
+	}
+	return true;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::clear()
+{
+	if (_root != nullptr) _destroy(_root, _height);
+
+	_root = nullptr;
+	_height = 0;
+	_head = _tail = nullptr;
+	_size = 0;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::swap(BPlusTree& other) noexcept
+{
+	std::swap(_compare, other._compare);
+	std::swap(_alloc, other._alloc);
+	std::swap(_root, other._root);
+	std::swap(_height, other._height);
+	std::swap(_head, other._head);
+	std::swap(_tail, other._tail);
+	std::swap(_size, other._size);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::iterator BPlusTree<T, Compare, Allocator, KeyOfValue>::lower_bound(const key_type& key)
+{
+	std::pair<_Leaf*, std::size_t> bound = _bound<false>(key);
+	return iterator(bound.first, bound.second);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::const_iterator BPlusTree<T, Compare, Allocator, KeyOfValue>::lower_bound(const key_type& key) const
+{
+	std::pair<_Leaf*, std::size_t> bound = _bound<false>(key);
+	return const_iterator(bound.first, bound.second);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::iterator BPlusTree<T, Compare, Allocator, KeyOfValue>::upper_bound(const key_type& key)
+{
+	std::pair<_Leaf*, std::size_t> bound = _bound<true>(key);
+	return iterator(bound.first, bound.second);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::const_iterator BPlusTree<T, Compare, Allocator, KeyOfValue>::upper_bound(const key_type& key) const
+{
+	std::pair<_Leaf*, std::size_t> bound = _bound<true>(key);
+	return const_iterator(bound.first, bound.second);
+}
+
+/*******************
+ * PRIVATE HELPERS *
+ *******************/
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t BPlusTree<T, Compare, Allocator, KeyOfValue>::_child_index(const _Inner* node, const key_type& key) const
+{
+	const key_type* keys = node->keys();
+	if constexpr (_vector_keys) return BPlusSearch<key_type>::template rank<true>(keys, node->count, key);
+
+	return std::upper_bound(keys, keys + node->count, key, _compare) - keys;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t BPlusTree<T, Compare, Allocator, KeyOfValue>::_leaf_index(const _Leaf* leaf, const key_type& key) const
+{
+	const T* values = leaf->values();
+	if constexpr (_vector_values) return BPlusSearch<key_type>::template rank<false>(values, leaf->count, key);
+
+	return std::lower_bound(values, values + leaf->count, key,
+		[this](const T& value, const key_type& key) { return _compare(_key(value), key); }) - values;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<bool Upper>
+std::pair<typename BPlusTree<T, Compare, Allocator, KeyOfValue>::_Leaf*, std::size_t> BPlusTree<T, Compare, Allocator, KeyOfValue>::_bound(const key_type& key) const
+{
+	if (_root == nullptr) return { nullptr, 0 };
+
+	const _Node* node = _root;
+	for (std::size_t level = _height; level > 0; --level)
+	{
+		const _Inner* inner = static_cast<const _Inner*>(node);
+		node = inner->children[_child_index(inner, key)];
+	}
+
+	_Leaf* leaf = const_cast<_Leaf*>(static_cast<const _Leaf*>(node));
+	std::size_t i = _leaf_index(leaf, key);
+	if (Upper)
+	{
+		while (i < leaf->count && !_compare(key, _key(leaf->values()[i]))) ++i;
+	}
+
+	// the keys of the next leaf are not less than the separator above.
+	if (i == leaf->count && leaf->next != nullptr) return { leaf->next, 0 };
+	return { leaf, i };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Value>
+std::pair<typename BPlusTree<T, Compare, Allocator, KeyOfValue>::iterator, bool> BPlusTree<T, Compare, Allocator, KeyOfValue>::_insert(Value&& value)
+{
+	const key_type& key = _key(value);
+	if (_root == nullptr)
+	{
+		_Leaf* leaf = _create_leaf();
+		_root = _head = _tail = leaf;
+	}
+
+	if (_full(_root, _height))
+	{
+		_Inner* root = _create_inner();
+		root->children[0] = _root;
+		_root = root;
+		++_height;
+
+		try
+		{
+			_split(root, 0, _height - 1);
+		}
+		catch (...)
+		{
+			_root = root->children[0];
+			--_height;
+			_free(root);
+			throw;
+		}
+	}
+
+	// top down, a full child is split before it is entered so that it can
+	// take the key its own child may push up.
+	_Node* node = _root;
+	for (std::size_t level = _height; level > 0; --level)
+	{
+		_Inner* inner = static_cast<_Inner*>(node);
+		std::size_t i = _child_index(inner, key);
+		if (_full(inner->children[i], level - 1))
+		{
+			_split(inner, i, level - 1);
+			if (!_compare(key, inner->keys()[i])) ++i;
+		}
+		node = inner->children[i];
+	}
+
+	_Leaf* leaf = static_cast<_Leaf*>(node);
+	std::size_t i = _leaf_index(leaf, key);
+	if (i < leaf->count && !_compare(key, _key(leaf->values()[i]))) return { iterator(leaf, i), false };
+
+	T* values = leaf->values();
+	_relocate_backward(values + i, values + i + 1, leaf->count - i);
+	try
+	{
+		::new (static_cast<void*>(values + i)) T(std::forward<Value>(value));
+	}
+	catch (...)
+	{
+		_relocate(values + i + 1, values + i, leaf->count - i);
+		throw;
+	}
+
+	++leaf->count;
+	++_size;
+	return { iterator(leaf, i), true };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+bool BPlusTree<T, Compare, Allocator, KeyOfValue>::_full(const _Node* node, std::size_t level) const
+{
+	if (level == 0) return static_cast<const _Leaf*>(node)->count == _leaf_capacity;
+	return static_cast<const _Inner*>(node)->count == _inner_capacity;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+bool BPlusTree<T, Compare, Allocator, KeyOfValue>::_minimal(const _Node* node, std::size_t level) const
+{
+	if (level == 0) return static_cast<const _Leaf*>(node)->count <= _leaf_minimum;
+	return static_cast<const _Inner*>(node)->count <= _inner_minimum;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_split(_Inner* parent, std::size_t i, std::size_t level)
+{
+	if (level == 0)
+	{
+		_Leaf* left = static_cast<_Leaf*>(parent->children[i]);
+		_Leaf* right = _create_leaf();
+		std::size_t half = left->count / 2;
+		try
+		{
+			// a copy, the first key of the right half stays where it is.
+			_insert_separator(parent, i, _key(left->values()[half]), right);
+		}
+		catch (...)
+		{
+			_free(right);
+			throw;
+		}
+
+		_relocate(left->values() + half, right->values(), left->count - half);
+		right->count = left->count - half;
+		left->count = half;
+
+		right->prev = left;
+		right->next = left->next;
+		if (left->next != nullptr) left->next->prev = right;
+		else _tail = right;
+		left->next = right;
+		return;
+	}
+
+	_Inner* left = static_cast<_Inner*>(parent->children[i]);
+	_Inner* right = _create_inner();
+	std::size_t half = left->count / 2;
+
+	// the middle key moves up, the keys around it are split.
+	_insert_separator(parent, i, std::move(left->keys()[half]), right);
+	left->keys()[half].~key_type();
+
+	_relocate(left->keys() + half + 1, right->keys(), left->count - half - 1);
+	std::copy(left->children + half + 1, left->children + left->count + 1, right->children);
+	right->count = left->count - half - 1;
+	left->count = half;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t BPlusTree<T, Compare, Allocator, KeyOfValue>::_refill(_Inner* parent, std::size_t i, std::size_t level)
+{
+	if (i > 0 && !_minimal(parent->children[i - 1], level))
+	{
+		_borrow_left(parent, i, level);
+		return i;
+	}
+
+	if (i < parent->count && !_minimal(parent->children[i + 1], level))
+	{
+		_borrow_right(parent, i, level);
+		return i;
+	}
+
+	// two minimal nodes fit into one.
+	if (i > 0)
+	{
+		_merge(parent, i - 1, level);
+		return i - 1;
+	}
+
+	_merge(parent, i, level);
+	return i;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_borrow_left(_Inner* parent, std::size_t i, std::size_t level)
+{
+	key_type* separator = parent->keys() + i - 1;
+	if (level == 0)
+	{
+		_Leaf* left = static_cast<_Leaf*>(parent->children[i - 1]);
+		_Leaf* child = static_cast<_Leaf*>(parent->children[i]);
+
+		// the only step that may throw comes first.
+		key_type key(_key(left->values()[left->count - 1]));
+
+		_relocate_backward(child->values(), child->values() + 1, child->count);
+		_relocate(left->values() + left->count - 1, child->values(), 1);
+		--left->count;
+		++child->count;
+
+		separator->~key_type();
+		::new (static_cast<void*>(separator)) key_type(std::move(key));
+		return;
+	}
+
+	_Inner* left = static_cast<_Inner*>(parent->children[i - 1]);
+	_Inner* child = static_cast<_Inner*>(parent->children[i]);
+
+	// rotate through the parent.
+	_relocate_backward(child->keys(), child->keys() + 1, child->count);
+	std::copy_backward(child->children, child->children + child->count + 1, child->children + child->count + 2);
+	_relocate(separator, child->keys(), 1);
+	child->children[0] = left->children[left->count];
+	_relocate(left->keys() + left->count - 1, separator, 1);
+	--left->count;
+	++child->count;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_borrow_right(_Inner* parent, std::size_t i, std::size_t level)
+{
+	key_type* separator = parent->keys() + i;
+	if (level == 0)
+	{
+		_Leaf* child = static_cast<_Leaf*>(parent->children[i]);
+		_Leaf* right = static_cast<_Leaf*>(parent->children[i + 1]);
+
+		// the only step that may throw comes first.
+		key_type key(_key(right->values()[1]));
+
+		_relocate(right->values(), child->values() + child->count, 1);
+		_relocate(right->values() + 1, right->values(), right->count - 1);
+		--right->count;
+		++child->count;
+
+		separator->~key_type();
+		::new (static_cast<void*>(separator)) key_type(std::move(key));
+		return;
+	}
+
+	_Inner* child = static_cast<_Inner*>(parent->children[i]);
+	_Inner* right = static_cast<_Inner*>(parent->children[i + 1]);
+
+	// rotate through the parent.
+	_relocate(separator, child->keys() + child->count, 1);
+	child->children[child->count + 1] = right->children[0];
+	_relocate(right->keys(), separator, 1);
+	_relocate(right->keys() + 1, right->keys(), right->count - 1);
+	std::copy(right->children + 1, right->children + right->count + 1, right->children);
+	--right->count;
+	++child->count;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_merge(_Inner* parent, std::size_t i, std::size_t level)
+{
+	key_type* separator = parent->keys() + i;
+	if (level == 0)
+	{
+		_Leaf* left = static_cast<_Leaf*>(parent->children[i]);
+		_Leaf* right = static_cast<_Leaf*>(parent->children[i + 1]);
+
+		_relocate(right->values(), left->values() + left->count, right->count);
+		left->count += right->count;
+		right->count = 0;
+
+		left->next = right->next;
+		if (right->next != nullptr) right->next->prev = left;
+		else _tail = left;
+		_free(right);
+		separator->~key_type();
+	}
+	else
+	{
+		_Inner* left = static_cast<_Inner*>(parent->children[i]);
+		_Inner* right = static_cast<_Inner*>(parent->children[i + 1]);
+
+		// the separator moves down between both halves.
+		_relocate(separator, left->keys() + left->count, 1);
+		_relocate(right->keys(), left->keys() + left->count + 1, right->count);
+		std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+		left->count += right->count + 1;
+		right->count = 0;
+		_free(right);
+	}
+
+	_relocate(separator + 1, separator, parent->count - i - 1);
+	std::copy(parent->children + i + 2, parent->children + parent->count + 1, parent->children + i + 1);
+	--parent->count;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Key>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_insert_separator(_Inner* node, std::size_t i, Key&& key, _Node* child)
+{
+	key_type* keys = node->keys();
+	_relocate_backward(keys + i, keys + i + 1, node->count - i);
+	try
+	{
+		::new (static_cast<void*>(keys + i)) key_type(std::forward<Key>(key));
+	}
+	catch (...)
+	{
+		_relocate(keys + i + 1, keys + i, node->count - i);
+		throw;
+	}
+
+	std::copy_backward(node->children + i + 1, node->children + node->count + 1, node->children + node->count + 2);
+	node->children[i + 1] = child;
+	++node->count;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename V>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_relocate(V* from, V* to, std::size_t count)
+{
+	if constexpr (std::is_trivially_copyable<V>::value)
+	{
+		if (count > 0) std::memmove(static_cast<void*>(to), static_cast<const void*>(from), count * sizeof(V));
+		return;
+	}
+
+	for (std::size_t j = 0; j < count; ++j)
+	{
+		::new (static_cast<void*>(to + j)) V(std::move(from[j]));
+		from[j].~V();
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename V>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_relocate_backward(V* from, V* to, std::size_t count)
+{
+	if constexpr (std::is_trivially_copyable<V>::value)
+	{
+		if (count > 0) std::memmove(static_cast<void*>(to), static_cast<const void*>(from), count * sizeof(V));
+		return;
+	}
+
+	for (std::size_t j = count; j > 0; --j)
+	{
+		::new (static_cast<void*>(to + j - 1)) V(std::move(from[j - 1]));
+		from[j - 1].~V();
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::_Node* BPlusTree<T, Compare, Allocator, KeyOfValue>::_clone(const _Node* node, std::size_t level, _Leaf*& last)
+{
+	if (level == 0)
+	{
+		const _Leaf* source = static_cast<const _Leaf*>(node);
+		_Leaf* leaf = _create_leaf();
+		try
+		{
+			for (; leaf->count < source->count; ++leaf->count)
+			{
+				::new (static_cast<void*>(leaf->values() + leaf->count)) T(source->values()[leaf->count]);
+			}
+		}
+		catch (...)
+		{
+			_free(leaf);
+			throw;
+		}
+
+		leaf->prev = last;
+		if (last != nullptr) last->next = leaf;
+		last = leaf;
+		return leaf;
+	}
+
+	const _Inner* source = static_cast<const _Inner*>(node);
+	_Inner* inner = _create_inner();
+	std::size_t children = 0;
+	try
+	{
+		for (; inner->count < source->count; ++inner->count)
+		{
+			::new (static_cast<void*>(inner->keys() + inner->count)) key_type(source->keys()[inner->count]);
+		}
+		for (; children <= source->count; ++children)
+		{
+			inner->children[children] = _clone(source->children[children], level - 1, last);
+		}
+	}
+	catch (...)
+	{
+		// the leaves cloned so far are linked, but nothing follows the links.
+		for (std::size_t j = 0; j < children; ++j) _destroy(inner->children[j], level - 1);
+		_free(inner);
+		throw;
+	}
+	return inner;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::_Leaf* BPlusTree<T, Compare, Allocator, KeyOfValue>::_create_leaf()
+{
+	_LeafAllocator alloc(_alloc);
+	_Leaf* leaf = std::allocator_traits<_LeafAllocator>::allocate(alloc, 1);
+	// default initialized, the value storage is left untouched.
+	return ::new (static_cast<void*>(leaf)) _Leaf;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename BPlusTree<T, Compare, Allocator, KeyOfValue>::_Inner* BPlusTree<T, Compare, Allocator, KeyOfValue>::_create_inner()
+{
+	_InnerAllocator alloc(_alloc);
+	_Inner* inner = std::allocator_traits<_InnerAllocator>::allocate(alloc, 1);
+	return ::new (static_cast<void*>(inner)) _Inner;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_free(_Leaf* leaf)
+{
+	std::destroy(leaf->values(), leaf->values() + leaf->count);
+	leaf->~_Leaf();
+
+	_LeafAllocator alloc(_alloc);
+	std::allocator_traits<_LeafAllocator>::deallocate(alloc, leaf, 1);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_free(_Inner* inner)
+{
+	std::destroy(inner->keys(), inner->keys() + inner->count);
+	inner->~_Inner();
+
+	_InnerAllocator alloc(_alloc);
+	std::allocator_traits<_InnerAllocator>::deallocate(alloc, inner, 1);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void BPlusTree<T, Compare, Allocator, KeyOfValue>::_destroy(_Node* node, std::size_t level)
+{
+	if (level == 0)
+	{
+		_free(static_cast<_Leaf*>(node));
+		return;
+	}
+
+	// the height is logarithmic with a large base, recursing is fine.
+	_Inner* inner = static_cast<_Inner*>(node);
+	for (std::size_t j = 0; j <= inner->count; ++j) _destroy(inner->children[j], level - 1);
+	_free(inner);
+}
+
+#endif // B_PLUS_TREE
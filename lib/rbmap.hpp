@@ -0,0 +1,144 @@
+#ifndef SWIG
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#endif
+
+#include "rbtree.hpp"
+
+#ifndef RB_MAP
+#define RB_MAP
+
+/**
+ * @brief Red-black tree map. Key/value pairs live in the tree nodes and are
+ * 		rebalanced by the RBTree engine, which relinks nodes and never
+ * 		moves or copies a stored value.
+ *
+ * @tparam K Key type.
+ * @tparam V Mapped value type.
+ * @tparam Compare Strict weak ordering of the keys.
+ * @tparam Allocator Allocator the node pool gets its slabs from.
+ */
+template<typename K, typename V,
+	typename Compare = std::less<K>,
+	typename Allocator = std::allocator<std::pair<const K, V>>>
+class RBMap : public RBTree<std::pair<const K, V>, Compare, Allocator,
+	RBTreeSelectFirst<std::pair<const K, V>>>
+{
+	typedef RBTree<std::pair<const K, V>, Compare, Allocator,
+		RBTreeSelectFirst<std::pair<const K, V>>> Base;
+
+public:
+	typedef K key_type;
+	typedef V mapped_type;
+	typedef std::pair<const K, V> value_type;
+	typedef typename Base::NodePtr NodePtr;
+
+	using Base::Base;
+
+	/**
+	 * @brief Access the value mapped to key, value-initializing it first
+	 * 		if key is not stored yet.
+	 */
+	V& operator[](const K& key);
+	V& operator[](K&& key);
+
+	/**
+	 * @brief Access the value mapped to key.
+	 *
+	 * @throws std::out_of_range if key is not stored.
+	 */
+	V& at(const K& key);
+
+	/**
+	 * @brief Insert value under key, or assign it to the value already
+	 * 		mapped to key.
+	 *
+	 * @return std::pair<NodePtr, bool> The node holding key and whether
+	 * 		the insertion took place.
+	 */
+	template<typename M>
+	std::pair<NodePtr, bool> insert_or_assign(const K& key, M&& value);
+	template<typename M>
+	std::pair<NodePtr, bool> insert_or_assign(K&& key, M&& value);
+
+	/**
+	 * @brief Build the mapped value from args only if key is not stored.
+	 * 		Neither the key nor the value is touched otherwise.
+	 *
+	 * @return std::pair<NodePtr, bool> The node holding key and whether
+	 * 		the insertion took place.
+	 */
+	template<typename... Args>
+	std::pair<NodePtr, bool> try_emplace(const K& key, Args&&... args);
+	template<typename... Args>
+	std::pair<NodePtr, bool> try_emplace(K&& key, Args&&... args);
+};
+
+template<typename K, typename V, typename Compare, typename Allocator>
+V& RBMap<K, V, Compare, Allocator>::operator[](const K& key)
+{
+	return try_emplace(key).first->data.second;
+}
+
+template<typename K, typename V, typename Compare, typename Allocator>
+V& RBMap<K, V, Compare, Allocator>::operator[](K&& key)
+{
+	return try_emplace(std::move(key)).first->data.second;
+}
+
+template<typename K, typename V, typename Compare, typename Allocator>
+V& RBMap<K, V, Compare, Allocator>::at(const K& key)
+{
+	NodePtr node = this->find(key);
+	if (this->is_terminal(node)) throw std::out_of_range("RBMap::at: key not found");
+	return node->data.second;
+}
+
+template<typename K, typename V, typename Compare, typename Allocator>
+template<typename M>
+std::pair<typename RBMap<K, V, Compare, Allocator>::NodePtr, bool>
+RBMap<K, V, Compare, Allocator>::insert_or_assign(const K& key, M&& value)
+{
+	// try_emplace leaves value alone when key is already there.
+	std::pair<NodePtr, bool> result = try_emplace(key, std::forward<M>(value));
+	if (!result.second) result.first->data.second = std::forward<M>(value);
+	return result;
+}
+
+template<typename K, typename V, typename Compare, typename Allocator>
+template<typename M>
+std::pair<typename RBMap<K, V, Compare, Allocator>::NodePtr, bool>
+RBMap<K, V, Compare, Allocator>::insert_or_assign(K&& key, M&& value)
+{
+	std::pair<NodePtr, bool> result = try_emplace(std::move(key), std::forward<M>(value));
+	if (!result.second) result.first->data.second = std::forward<M>(value);
+	return result;
+}
+
+template<typename K, typename V, typename Compare, typename Allocator>
+template<typename... Args>
+std::pair<typename RBMap<K, V, Compare, Allocator>::NodePtr, bool>
+RBMap<K, V, Compare, Allocator>::try_emplace(const K& key, Args&&... args)
+{
+	return Base::try_emplace(key, std::piecewise_construct,
+		std::forward_as_tuple(key),
+		std::forward_as_tuple(std::forward<Args>(args)...));
+}
+
+template<typename K, typename V, typename Compare, typename Allocator>
+template<typename... Args>
+std::pair<typename RBMap<K, V, Compare, Allocator>::NodePtr, bool>
+RBMap<K, V, Compare, Allocator>::try_emplace(K&& key, Args&&... args)
+{
+	// the lookup is over before the key gets moved into the node.
+	return Base::try_emplace(key, std::piecewise_construct,
+		std::forward_as_tuple(std::move(key)),
+		std::forward_as_tuple(std::forward<Args>(args)...));
+}
+
+#endif // RB_MAP
@@ -1,387 +1,3195 @@
 #ifndef SWIG
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rbtree_pool.hpp"
+#include "rbtree_scheduler.hpp"
 
 #endif
 
 #ifndef RB_TREE
 #define RB_TREE
 
-template<typename T>
-struct RBTreeNode
+/**
+ * @brief Subtree size augmentation. Empty unless order statistics are
+ * 		enabled, so plain trees keep their node layout.
+ */
+template<bool OrderStatistics>
+struct RBTreeNodeSize {};
+
+template<>
+struct RBTreeNodeSize<true>
+{
+	// number of nodes in the subtree rooted here, 0 for the terminal node.
+	std::size_t size = 0;
+};
+
+template<typename T, bool OrderStatistics = false>
+struct RBTreeNode : RBTreeNodeSize<OrderStatistics>
 {
-    typedef std::shared_ptr<RBTreeNode> NodePtr;
-    // Don't use shared pointer for the parent to
-	// avoid circular dependency memory leaks.
+    // Nodes are owned by the tree's pool, so every link is a plain
+	// pointer; no reference counting on the hot paths.
+    typedef RBTreeNode* NodePtr;
     typedef RBTreeNode* ParentPtr;
+	typedef T value_type;
 
 	enum class node_color { RED, BLACK };
 
+	// data lifetime is managed by the tree, which lets the terminal
+	// node exist without ever constructing a T.
+	RBTreeNode() {}
+	~RBTreeNode() {}
+
+	// the color lives in the low bit of the parent link.
+	ParentPtr parent() const { return reinterpret_cast<ParentPtr>(_parent_color & ~_red_bit); }
+	void set_parent(ParentPtr parent)
+	{
+		_parent_color = reinterpret_cast<std::uintptr_t>(parent) | (_parent_color & _red_bit);
+	}
+
+	node_color color() const { return (_parent_color & _red_bit) ? node_color::RED : node_color::BLACK; }
+	void set_color(node_color color)
+	{
+		_parent_color = (_parent_color & ~_red_bit) | (color == node_color::RED ? _red_bit : 0);
+	}
+
+	// the key comes first, a lookup compares before following a link.
+#ifdef SWIG
     T data;
-    NodePtr left;
-    NodePtr right;
-    ParentPtr parent;
-    node_color color = node_color::BLACK;
+#else
+	union { T data; };
+#endif
+    NodePtr left = nullptr;
+    NodePtr right = nullptr;
+
+private:
+	// nodes are at least pointer aligned, the low bit of the parent
+	// address is free to hold the color. 0 is a black root.
+	static constexpr std::uintptr_t _red_bit = 1;
+
+	std::uintptr_t _parent_color = 0;
 };
 
+/**
+ * @brief KeyOfValue policy of a set: the stored value is the key.
+ */
 template<typename T>
+struct RBTreeIdentity
+{
+	typedef T key_type;
+
+	const T& operator()(const T& value) const { return value; }
+};
+
+/**
+ * @brief KeyOfValue policy of a map: the key is the pair's first member.
+ */
+template<typename Pair>
+struct RBTreeSelectFirst
+{
+	typedef typename std::remove_const<typename Pair::first_type>::type key_type;
+
+	const typename Pair::first_type& operator()(const Pair& value) const { return value.first; }
+};
+
+/**
+ * @brief In-order bidirectional iterator over an RBTree.
+ * 
+ * Steps follow the child and parent links, so a full traversal touches
+ * every edge twice and each step is amortized O(1). The past-the-end
+ * position is the tree header node, whose right link caches the
+ * rightmost node so that end() can be decremented.
+ * 
+ * @tparam Node Tree node type.
+ * @tparam Const Whether the iterator gives read-only access.
+ */
+template<typename Node, bool Const>
+class RBTreeIterator
+{
+	typedef Node* NodePtr;
+	typedef typename Node::value_type T;
+
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef T value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef typename std::conditional<Const, const T*, T*>::type pointer;
+	typedef typename std::conditional<Const, const T&, T&>::type reference;
+
+	RBTreeIterator() = default;
+	RBTreeIterator(NodePtr node, NodePtr tnull, NodePtr header)
+		: _node(node), _tnull(tnull), _header(header) {}
+
+	// a mutable iterator converts to a const one, not the other way around.
+	template<bool C = Const, typename = typename std::enable_if<C>::type>
+	RBTreeIterator(const RBTreeIterator<Node, false>& other)
+		: _node(other.node()), _tnull(other.terminal()), _header(other.header()) {}
+
+	reference operator*() const { return _node->data; }
+	pointer operator->() const { return std::addressof(_node->data); }
+
+	RBTreeIterator& operator++()
+	{
+		if (_node->right != _tnull)
+		{
+			_node = _node->right;
+			while (_node->left != _tnull) _node = _node->left;
+			return *this;
+		}
+
+		NodePtr parent = _node->parent();
+		while (parent != nullptr && parent->right == _node)
+		{
+			_node = parent;
+			parent = parent->parent();
+		}
+		_node = parent != nullptr ? parent : _header;
+		return *this;
+	}
+
+	RBTreeIterator& operator--()
+	{
+		if (_node == _header)
+		{
+			_node = _header->right;
+			return *this;
+		}
+
+		if (_node->left != _tnull)
+		{
+			_node = _node->left;
+			while (_node->right != _tnull) _node = _node->right;
+			return *this;
+		}
+
+		NodePtr parent = _node->parent();
+		while (parent != nullptr && parent->left == _node)
+		{
+			_node = parent;
+			parent = parent->parent();
+		}
+		_node = parent != nullptr ? parent : _header;
+		return *this;
+	}
+
+	RBTreeIterator operator++(int)
+	{
+		RBTreeIterator copy = *this;
+		++*this;
+		return copy;
+	}
+
+	RBTreeIterator operator--(int)
+	{
+		RBTreeIterator copy = *this;
+		--*this;
+		return copy;
+	}
+
+	bool operator==(const RBTreeIterator& other) const { return _node == other._node; }
+	bool operator!=(const RBTreeIterator& other) const { return _node != other._node; }
+
+	NodePtr node() const { return _node; }
+	NodePtr terminal() const { return _tnull; }
+	NodePtr header() const { return _header; }
+
+private:
+	NodePtr _node = nullptr;
+	NodePtr _tnull = nullptr;
+	NodePtr _header = nullptr;
+};
+
+/**
+ * @brief Tells whether a comparator accepts keys of other types than the
+ * 		stored one, i.e. declares an is_transparent member type.
+ */
+template<typename Compare, typename = void>
+struct RBTreeIsTransparent : std::false_type {};
+
+template<typename Compare>
+struct RBTreeIsTransparent<Compare, std::void_t<typename Compare::is_transparent>>
+	: std::true_type {};
+
+/**
+ * @brief Owner of a node taken out of an RBTree by extract(), until
+ * 		insert() links it into the same or another tree.
+ *
+ * The node keeps its storage and its value on the way, into any tree,
+ * nothing is allocated, copied or moved. The handle holds on to the pool
+ * the node came from and to the slabs the node may live in, so the node
+ * outlives its tree. The tree it is inserted into keeps those slabs from
+ * then on. A handle dropped unused gives the node back to its pool,
+ * which must not be in use by another thread at that time.
+ *
+ * @tparam Node Tree node type.
+ * @tparam Allocator Allocator of the node pool.
+ */
+template<typename Node, typename Allocator>
+class RBTreeNodeHandle
+{
+	typedef typename Node::value_type T;
+	typedef RBTreePool<Node, Allocator> Pool;
+
+public:
+	typedef T value_type;
+	typedef Allocator allocator_type;
+
+	RBTreeNodeHandle() = default;
+
+	RBTreeNodeHandle(RBTreeNodeHandle&& other) noexcept
+		: _node(std::exchange(other._node, nullptr)), _pool(std::move(other._pool)),
+		_storages(std::move(other._storages)) {}
+
+	RBTreeNodeHandle& operator=(RBTreeNodeHandle other) noexcept {
+		swap(other);
+		return *this;
+	}
+
+	~RBTreeNodeHandle() {
+		if (_node == nullptr) return;
+
+		_node->data.~T();
+		_node->~Node();
+		_pool->deallocate(_node);
+	}
+
+	/**
+	 * @brief The value of the node, the handle must not be empty. Unlike
+	 * 		in a tree, the key may change before the node is inserted.
+	 */
+	T& value() const { return _node->data; }
+
+	bool empty() const { return _node == nullptr; }
+	explicit operator bool() const { return _node != nullptr; }
+
+	Allocator get_allocator() const { return _pool->get_allocator(); }
+
+	void swap(RBTreeNodeHandle& other) noexcept
+	{
+		std::swap(_node, other._node);
+		_pool.swap(other._pool);
+		_storages.swap(other._storages);
+	}
+
+private:
+	template<typename, typename, typename, typename, bool>
+	friend class RBTree;
+
+	RBTreeNodeHandle(Node* node, std::shared_ptr<Pool> pool)
+		: _node(node), _pool(std::move(pool)), _storages(_pool->storages()) {}
+
+	Node* _node = nullptr;
+	std::shared_ptr<Pool> _pool;
+	std::shared_ptr<const typename Pool::Storages> _storages;
+};
+
+/**
+ * @brief Outcome of inserting a node handle: where the key is stored,
+ * 		whether the node was linked and, if it was not, the node itself.
+ */
+template<typename Iterator, typename NodeHandle>
+struct RBTreeInsertReturn
+{
+	Iterator position;
+	bool inserted;
+	NodeHandle node;
+};
+
+/**
+ * @brief Layouts RBTree::dump() writes a tree in.
+ *
+ * TEXT draws the tree sideways, one node a line. DOT is a Graphviz digraph
+ * and JSON nests every node under its parent as "left" and "right". Left
+ * out subtrees show as "...", or as "cut": true in JSON.
+ */
+enum class RBTreeDumpFormat { TEXT, DOT, JSON };
+
+/**
+ * @brief What RBTree::dump() writes. Subtrees below max_depth, the root
+ * 		being at depth 0, and nodes past the first max_nodes in preorder
+ * 		are left out and marked as such.
+ */
+struct RBTreeDumpOptions
+{
+	RBTreeDumpFormat format = RBTreeDumpFormat::TEXT;
+	std::size_t max_depth = std::numeric_limits<std::size_t>::max();
+	std::size_t max_nodes = std::numeric_limits<std::size_t>::max();
+};
+
+/**
+ * @brief Work done by an RBTree since it was built or since
+ * 		reset_stats(), counted only when RBTREE_ENABLE_STATS is defined.
+ *
+ * Otherwise the counting statements are compiled out and every counter
+ * reads 0. The macro changes the layout of RBTree, define it for the
+ * whole program, e.g. with the RBTREE_ENABLE_STATS CMake option.
+ */
+struct RBTreeStats
+{
+	// key comparisons of the single key lookups, insertions, removals
+	// and bounds.
+	std::size_t comparisons = 0;
+	std::size_t rotations = 0;
+	// colors set by the insert and remove fix-ups.
+	std::size_t recolors = 0;
+
+	// fix-up states entered, see RBTree::_insert_fix and _remove_fix.
+	std::size_t insert_fix_state00 = 0;
+	std::size_t insert_fix_state01 = 0;
+	std::size_t insert_fix_state10 = 0;
+	std::size_t insert_fix_state11 = 0;
+	std::size_t remove_fix_state000 = 0;
+	std::size_t remove_fix_state001 = 0;
+	std::size_t remove_fix_state010 = 0;
+	std::size_t remove_fix_state011 = 0;
+	std::size_t remove_fix_state100 = 0;
+	std::size_t remove_fix_state101 = 0;
+	std::size_t remove_fix_state110 = 0;
+	std::size_t remove_fix_state111 = 0;
+
+	// nodes built, by insertions and copies.
+	std::size_t allocations = 0;
+
+	// deepest level a lookup went down to or a node was inserted at, the
+	// root being at level 1.
+	std::size_t max_depth = 0;
+};
+
+/**
+ * @brief Shape of an RBTree, measured by RBTree::profile().
+ *
+ * The depth of a node is the number of nodes a lookup visits to find it,
+ * the root being at depth 1.
+ */
+struct RBTreeProfile
+{
+	std::size_t size = 0;
+	// depth of the deepest node, at most 2 log2(size + 1).
+	std::size_t height = 0;
+	// black nodes on every path from the root down to a terminal node.
+	std::size_t black_height = 0;
+	std::size_t red_nodes = 0;
+	// mean depth of the nodes, the cost of an average successful lookup.
+	double average_depth = 0;
+	// nodes at depth d + 1 in depth_histogram[d].
+	std::vector<std::size_t> depth_histogram;
+};
+
+#ifdef RBTREE_ENABLE_STATS
+#define RB_TREE_STAT(statement) statement
+#else
+#define RB_TREE_STAT(statement)
+#endif
+
+#ifndef SWIG
+
+/**
+ * @brief Stream buffer handing its content to a callback a block at a
+ * 		time, as fn(const char* text, std::size_t length).
+ */
+template<typename Function>
+class RBTreeDumpBuffer : public std::streambuf
+{
+public:
+	explicit RBTreeDumpBuffer(Function& fn) : _fn(fn) { setp(_block, _block + sizeof(_block)); }
+
+protected:
+	int_type overflow(int_type c) override
+	{
+		sync();
+		if (!traits_type::eq_int_type(c, traits_type::eof())) sputc(traits_type::to_char_type(c));
+		return traits_type::not_eof(c);
+	}
+
+	int sync() override
+	{
+		if (pptr() != pbase()) _fn(static_cast<const char*>(pbase()), static_cast<std::size_t>(pptr() - pbase()));
+		setp(_block, _block + sizeof(_block));
+		return 0;
+	}
+
+private:
+	Function& _fn;
+	char _block[4096];
+};
+
+/**
+ * @brief Stream buffer escaping what goes through it into a quoted DOT or
+ * 		JSON string.
+ */
+class RBTreeDumpEscape : public std::streambuf
+{
+public:
+	explicit RBTreeDumpEscape(std::streambuf* target) : _target(target) {}
+
+protected:
+	int_type overflow(int_type c) override
+	{
+		if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+
+		char character = traits_type::to_char_type(c);
+		if (character == '"' || character == '\\') _target->sputc('\\');
+		if (character == '\n')
+		{
+			_target->sputc('\\');
+			character = 'n';
+		}
+		return _target->sputc(character);
+	}
+
+private:
+	std::streambuf* _target;
+};
+
+#endif
+
+/**
+ * @brief Read-only copy of a tree laid out for lookups, defined in
+ * 		rbtree_frozen.hpp.
+ */
+template<typename T,
+	typename Compare = std::less<typename RBTreeIdentity<T>::key_type>,
+	typename Allocator = std::allocator<T>,
+	typename KeyOfValue = RBTreeIdentity<T>>
+class FrozenIndex;
+
+/**
+ * @brief Red-black tree of unique keys.
+ * 
+ * @tparam T Stored value type.
+ * @tparam Compare Strict weak ordering of the keys.
+ * @tparam Allocator Allocator the node pool gets its slabs from.
+ * @tparam KeyOfValue Extracts the key out of a stored value, see
+ * 		RBTreeIdentity and RBTreeSelectFirst.
+ * @tparam OrderStatistics Keep subtree sizes in the nodes to answer
+ * 		select() and rank() in O(log n).
+ * 
+ * The terminal node _TNULL never holds a value. It belongs to the node
+ * pool and is shared with the trees split() off this one, so nodes move
+ * between them without being touched. The per-tree _header caches the
+ * leftmost and rightmost nodes so that begin() and --end() are O(1), and
+ * is the past-the-end position.
+ */
+template<typename T,
+	typename Compare = std::less<typename RBTreeIdentity<T>::key_type>,
+	typename Allocator = std::allocator<T>,
+	typename KeyOfValue = RBTreeIdentity<T>,
+	bool OrderStatistics = false>
 class RBTree {
 
 // They should be prvate but swig cannot wrap the lib when typedefs are private
 public:
-    typedef RBTreeNode<T> Node;
+    typedef RBTreeNode<T, OrderStatistics> Node;
     typedef typename Node::node_color NodeColor;
-    typedef std::shared_ptr<RBTreeNode<T>> NodePtr;
-    typedef RBTreeNode<T>* ParentPtr;
-    typedef RBTreeNode<T>* RawNodePtr;
+    typedef Node* NodePtr;
+    typedef Node* ParentPtr;
+    typedef Node* RawNodePtr;
+	typedef typename KeyOfValue::key_type key_type;
+	typedef RBTreeIterator<Node, false> iterator;
+	typedef RBTreeIterator<Node, true> const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+	typedef RBTreeNodeHandle<Node, Allocator> node_type;
+	typedef RBTreeInsertReturn<iterator, node_type> insert_return_type;
+	static_assert(alignof(Node) > 1, "the node color takes the low bit of the parent link");
 	NodePtr _root;
 	NodePtr _TNULL;
 
 public:
-	RBTree() {
-		_TNULL = std::make_shared<Node>();
-		_TNULL->left = nullptr;
-		_TNULL->right = nullptr;
+	RBTree() : RBTree(Compare()) {}
+
+	explicit RBTree(const Compare& compare, const Allocator& alloc = Allocator())
+		: _compare(compare),
+		_pool(std::allocate_shared<RBTreePool<Node, Allocator>>(alloc, alloc)) {
+		_TNULL = _create_sentinel();
 		_root = _TNULL;
 	}
 
+	explicit RBTree(const Allocator& alloc) : RBTree(Compare(), alloc) {}
+
+	/**
+	 * @brief Build the tree out of a range in O(n) when it is sorted,
+	 * 		see build_from_sorted().
+	 */
+	template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+	RBTree(InputIt first, InputIt last,
+		const Compare& compare = Compare(), const Allocator& alloc = Allocator())
+		: RBTree(compare, alloc) {
+		build_from_sorted(first, last);
+	}
+
+	RBTree(const RBTree& other) : RBTree(other._compare, other._pool->get_allocator()) {
+		_set_root(_clone(other._root, other._TNULL, nullptr), other._size);
+	}
+
+	/**
+	 * @brief Take the nodes of other over in O(1), without allocating.
+	 * 		other is left empty on a terminal node shared by every
+	 * 		moved-from tree, and takes a pool of its own once keys are
+	 * 		stored in it again.
+	 */
+	RBTree(RBTree&& other) noexcept(std::is_nothrow_copy_constructible<Compare>::value)
+		: _root(_moved_from_terminal()), _TNULL(_root), _compare(other._compare), _pool(other._pool) {
+		swap(other);
+	}
+
+	RBTree& operator=(const RBTree& other) {
+		RBTree copy(other);
+		swap(copy);
+		return *this;
+	}
+
+	RBTree& operator=(RBTree&& other) noexcept(std::is_nothrow_copy_constructible<Compare>::value) {
+		RBTree moved(std::move(other));
+		swap(moved);
+		return *this;
+	}
+
+	~RBTree() {
+		if (_owns_storage())
+		{
+			_destroy(_root, false);
+			// every node lives in the pool, the slabs are dropped at once.
+			_pool->release();
+			return;
+		}
+
+		// other trees still use the pool, hand the nodes back one by one.
+		_destroy(_root);
+	}
+
 public:
-    NodePtr find(T key);
-    NodePtr insert(T key);
-    NodePtr get_root();
+    NodePtr find(const key_type& key);
 
-    void remove(T key);
-    void print_tree();
+	/**
+	 * @brief Heterogeneous lookup, only available when Compare is
+	 * 		transparent. The key is compared as is, no T is built.
+	 */
+	template<typename Key, typename C = Compare,
+		typename = typename std::enable_if<RBTreeIsTransparent<C>::value>::type>
+    NodePtr find(const Key& key);
 
-	bool is_terminal(NodePtr);
-	bool is_black(NodePtr);
-	bool is_red(NodePtr);
+	bool contains(const key_type& key) { return !is_terminal(find(key)); }
+
+    NodePtr insert(const T& key);
+    NodePtr insert(T&& key);
 
-private:
 	/**
-	 * @brief Perform a BST find operation.
+	 * @brief Construct the key in place and insert it unless an
+	 * 		equivalent key already exists, in which case the freshly
+	 * 		built key is discarded.
 	 * 
-	 * @param node subtree root.
-	 * @param key key to search for.
-	 * @return NodePtr 
+	 * @param args T constructor arguments.
+	 * @return std::pair<NodePtr, bool> The node holding the key and
+	 * 		whether the insertion took place.
 	 */
-    NodePtr _find(NodePtr root, T key);
+	template<typename... Args>
+	std::pair<NodePtr, bool> emplace(Args&&... args);
 
 	/**
-	 * @brief Perform a BST insertion operation.
+	 * @brief Insert a key constructed from args only if nothing
+	 * 		equivalent to key is stored. Unlike emplace, nothing is
+	 * 		constructed when the key already exists.
 	 * 
-	 * @param root subtree root
-	 * @param parent parent of the current subtree root.
-	 * @param key Key to be inserted
-	 * @return NodePtr The inserted node.
+	 * @param key lookup key, compared against the stored keys.
+	 * @param args T constructor arguments.
+	 * @return std::pair<NodePtr, bool> The node holding the key and
+	 * 		whether the insertion took place.
 	 */
-    NodePtr _insert(NodePtr root, ParentPtr parent, T key);
+	template<typename Key, typename... Args>
+	std::pair<NodePtr, bool> try_emplace(const Key& key, Args&&... args);
+
+    NodePtr get_root();
+
+    void remove(const key_type& key);
+
+	template<typename Key, typename C = Compare,
+		typename = typename std::enable_if<RBTreeIsTransparent<C>::value>::type>
+    void remove(const Key& key);
 
 	/**
-	 * @brief Perform a BST deletion operation.
-	 * 
-	 * @param root subtree root
-	 * @param parent parent of the current subtree root.
-	 * @param key Key to be deleted
-	 * @return NodePtr The BST Replacement.
+	 * @brief Remove the key at pos without looking it up. Its neighbours
+	 * 		are relinked, never copied, so every other iterator and node
+	 * 		pointer stays valid. Amortized O(1) plus the fix-up.
+	 *
+	 * @return iterator The position that followed pos.
 	 */
-    NodePtr _remove(NodePtr root, NodePtr parent, T key);
+	iterator erase(const_iterator pos);
+	iterator erase(iterator pos) { return erase(const_iterator(pos)); }
 
-	NodePtr _get_sibling(ParentPtr);
-	NodePtr _get_single_child(NodePtr);
+	/**
+	 * @brief Remove the keys of [first, last), one erase() each.
+	 */
+	iterator erase(const_iterator first, const_iterator last);
 
-    NodePtr _successor(NodePtr node);
-    NodePtr _rbminimum(NodePtr node);
-    NodePtr _predecessor(NodePtr node);
-    NodePtr _rbmaximum(NodePtr node);
+	/**
+	 * @brief Unlink the node at pos, the same way erase() does, and hand
+	 * 		it over instead of destroying it, see RBTreeNodeHandle.
+	 */
+	node_type extract(const_iterator pos);
 
 	/**
-	 * @brief Fix red-black tree imbalance after insertion.
-	 * 
-	 * @param node The newly inserted node.
+	 * @brief Same for the node holding key, an empty handle if there is
+	 * 		none.
 	 */
-    void _insert_fix(NodePtr node);
+	node_type extract(const key_type& key);
+
 	/**
-	 * @brief Fix the tree **AFTER** BST deletion.
-	 * 
-	 * @param u The BST Replacement node. The actual deleted node.
-	 * 		Usually, it will be one of the following two possibilities.
-	 * 			1- u := v successor/predecessor.
-	 * 			2. u := _TNULL with parent pointer set to the v->parent.
-	 * 		Anywhere in the code, if you found a node named "u", then
-	 * 		this is the BST Replacment node.
-	 * @param v The node that was required to be deleted. This node is 
-	 * 		no longer part of the red-black tree at that moment.
+	 * @brief Link the node owned by node, unless an equivalent key is
+	 * 		stored, in which case the node is left in the returned
+	 * 		handle. An empty handle inserts nothing.
+	 *
+	 * The node is linked as it is, without allocating, whichever tree it
+	 * came from. The pools stay apart: this tree keeps the slabs of the
+	 * node alive, a list it only copies the first time it takes a node
+	 * from a given pool.
+	 *
+	 * @throws std::bad_alloc if that copy fails, node then keeps it.
 	 */
-    void _remove_fix(NodePtr u, NodePtr v);
+	insert_return_type insert(node_type&& node);
 
-    void _link_parent_child(ParentPtr parent, NodePtr child);
-    void _print_tree(NodePtr root, std::string indent, bool last);
-	void _rotate_left(NodePtr);
-	void _rotate_right(NodePtr);
-	void _swap_node(NodePtr, NodePtr);
+	/**
+	 * @brief Dump the tree as TEXT to std::cout.
+	 */
+    void print_tree();
 
+	/**
+	 * @brief Write the tree to out, see RBTreeDumpOptions.
+	 *
+	 * The walk follows the parent links instead of recursing, and the
+	 * only allocation is the indentation buffer, reserved once. Lines are
+	 * not flushed, that is left to out. Keys are written with operator<<.
+	 */
+	void dump(std::ostream& out, const RBTreeDumpOptions& options = RBTreeDumpOptions()) const;
 
 	/**
-	 * @brief Node parent sibling is colored red.
-	 * 
-	 * @param node NodePtr.
+	 * @brief Same, handing the text to fn(const char* text,
+	 * 		std::size_t length) in blocks of a few kilobytes.
 	 */
-	void _insert_fix_state00(NodePtr node);
+	template<typename Function,
+		typename = typename std::enable_if<std::is_invocable<Function&, const char*, std::size_t>::value>::type>
+	void dump(Function fn, const RBTreeDumpOptions& options = RBTreeDumpOptions()) const;
+
 	/**
-	 * @brief Node parent sibling is colored black.
-	 * 
-	 * @param node NodePtr.
+	 * @brief Counters of the work done so far, all 0 unless
+	 * 		RBTREE_ENABLE_STATS is defined.
 	 */
-	void _insert_fix_state01(NodePtr node);
+	const RBTreeStats& stats() const;
+	void reset_stats();
 
 	/**
-	 * @brief Node parent sibling is colored black and
-	 * 		requires a single rotation-- i.e. the straight line case.
-	 * 
-	 * @param node NodePtr.
+	 * @brief Check the tree in O(n): keys in increasing order, a black
+	 * 		root, no red node with a red child, the same black height on
+	 * 		every path, children linked back to their parent, the cached
+	 * 		leftmost, rightmost and size, and the subtree sizes of order
+	 * 		statistics.
+	 *
+	 * @param error Set to the first violation found, if not null.
+	 * @return bool Whether every invariant holds.
 	 */
-	void _insert_fix_state10(NodePtr node);
+	bool validate(std::string* error = nullptr) const;
 
 	/**
-	 * @brief Node parent sibling is colored black and
-	 * 		requires a double rotation-- i.e. the triangle case.
-	 * 
-	 * @param node NodePtr.
+	 * @brief Measure the shape of the tree in O(n), see RBTreeProfile.
+	 * 		The tree has to be valid.
 	 */
-	void _insert_fix_state11(NodePtr node);
+	RBTreeProfile profile() const;
 
 	/**
-	 * @brief If the deleted node or the 
-	 * 		replacement node is RED.
-	 * 
+	 * @brief Remove every key. The pool storage is released in one go
+	 * 		unless it is shared with other trees.
 	 */
-	void _remove_fix_state000(NodePtr);
+	void clear();
+	void swap(RBTree& other) noexcept;
 
 	/**
-	 * @brief If both the deleted and the replacement
-	 * 		nodes are black.
-	 * 
+	 * @brief Whether this tree and other link their nodes to the same
+	 * 		terminal node, as the halves of a split() do. Only such
+	 * 		trees are join()ed.
 	 */
-	void _remove_fix_state001(NodePtr);
+	bool shares_storage(const RBTree& other) const { return _TNULL == other._TNULL; }
 
 	/**
-	 * @brief If both the deleted and the replacement
-	 * 		nodes are black and sibling node is black.
+	 * @brief Append pivot and then every key of right, which is left
+	 * 		empty, in O(|log n - log m|).
+	 *
+	 * Both trees have to share their storage, e.g. be the two halves of
+	 * a split(), unless one of them is empty. Independent trees would
+	 * need their nodes relinked first, use union_with() for them.
 	 * 
+	 * @param pivot value whose key lies between the keys of both trees.
+	 * @param right tree holding keys greater than pivot only.
+	 * @throws std::invalid_argument if the keys are not ordered so, or
+	 * 		if both trees hold keys and do not share their storage.
 	 */
-	void _remove_fix_state010(NodePtr);
+	void join(T pivot, RBTree& right);
 
 	/**
-	 * @brief If both the deleted and the replacement
-	 * 		nodes are black and sibling node is black
-	 * 		with at least a red child.
+	 * @brief Append every key of right, which is left empty. The
+	 * 		inverse of split(), O(log n), with the same restrictions as
+	 * 		join(pivot, right).
 	 * 
+	 * @throws std::invalid_argument if right holds a key not greater
+	 * 		than every key of this tree, or if both trees hold keys and
+	 * 		do not share their storage.
 	 */
-	void _remove_fix_state011(NodePtr);
+	void join(RBTree& right);
 
 	/**
-	 * @brief If both the deleted and the replacement
-	 * 		nodes are black and sibling node is black
-	 * 		with all black children. Black, Black
-	 * 		everywhere.
+	 * @brief Move the keys not less than key into a new tree, in
+	 * 		O(log n). Both trees keep sharing the node storage, so that
+	 * 		join() puts them back together in O(log n).
+	 *
+	 * Sharing storage, the trees may not be modified from different
+	 * threads at the same time. Without OrderStatistics, the keys of the
+	 * smaller half are counted to keep size() exact, O(min(k, n - k))
+	 * more for halves of k and n - k keys.
 	 * 
+	 * @return RBTree The keys not less than key.
 	 */
-	void _remove_fix_state100(NodePtr);
+	RBTree split(const key_type& key);
 
 	/**
-	 * @brief If both the deleted and the replacement
-	 * 		nodes are black and sibling node is black
-	 * 		with a red child in LL or RR states.
+	 * @brief Move every key of other into this tree, other is left
+	 * 		empty. The values of this tree win over equivalent ones.
 	 * 
+	 * Join based: costs O(m log(n/m + 1)) for sizes m <= n and relinks
+	 * the existing nodes, no value is copied or allocated. Trees that
+	 * do not share their storage are first put on the same one: the
+	 * smaller tree is relinked to the terminal node of the other, an
+	 * O(m) pass within that bound, and this tree takes over the slabs
+	 * of other. other is then given a pool of its own, so that both
+	 * trees stay independent, e.g. usable from different threads.
 	 */
-	void _remove_fix_state101(NodePtr);
+	void union_with(RBTree& other);
+	void union_with(RBTree&& other) { union_with(other); }
 
 	/**
-	 * @brief If both the deleted and the replacement
-	 * 		nodes are black and sibling node is black
-	 * 		with a red child in LR or RL states.
-	 * 
+	 * @brief Keep the keys also stored in other, other is left empty.
+	 * 		Same costs as union_with().
 	 */
-	void _remove_fix_state110(NodePtr);
+	void intersect_with(RBTree& other);
+	void intersect_with(RBTree&& other) { intersect_with(other); }
 
 	/**
-	 * @brief If both the deleted and the replacement
-	 * 		nodes are black and sibling node is red.
+	 * @brief Drop the keys stored in other, other is left empty. Same
+	 * 		costs as union_with().
+	 */
+	void difference_with(RBTree& other);
+	void difference_with(RBTree&& other) { difference_with(other); }
+
+	/**
+	 * @brief Subproblem size, in keys, below which the parallel
+	 * 		operations stop forking tasks.
+	 */
+	static constexpr std::size_t default_grain = 4096;
+
+	/**
+	 * @brief union_with() whose independent halves run as tasks on
+	 * 		scheduler, recursively down to about grain keys.
 	 * 
+	 * Every task works on its own pool, merged into this tree's once the
+	 * task is joined, so nothing is locked on the way.
 	 */
-	void _remove_fix_state111(NodePtr);
+	void parallel_union_with(RBTree& other, RBTreeScheduler& scheduler, std::size_t grain = default_grain);
+	void parallel_union_with(RBTree&& other, RBTreeScheduler& scheduler, std::size_t grain = default_grain)
+	{
+		parallel_union_with(other, scheduler, grain);
+	}
 
-	void _switch_color(RawNodePtr);
+	/**
+	 * @brief intersect_with() on scheduler, see parallel_union_with().
+	 */
+	void parallel_intersect_with(RBTree& other, RBTreeScheduler& scheduler, std::size_t grain = default_grain);
+	void parallel_intersect_with(RBTree&& other, RBTreeScheduler& scheduler, std::size_t grain = default_grain)
+	{
+		parallel_intersect_with(other, scheduler, grain);
+	}
 
-	bool _is_root(NodePtr);
-	bool _is_root(RawNodePtr);
-	bool _is_insert_fix_state10(NodePtr);
+	/**
+	 * @brief difference_with() on scheduler, see parallel_union_with().
+	 */
+	void parallel_difference_with(RBTree& other, RBTreeScheduler& scheduler, std::size_t grain = default_grain);
+	void parallel_difference_with(RBTree&& other, RBTreeScheduler& scheduler, std::size_t grain = default_grain)
+	{
+		parallel_difference_with(other, scheduler, grain);
+	}
+
+	/**
+	 * @brief Replace the content with the values of [first, last).
+	 * 
+	 * Strictly increasing input is linked into a perfectly balanced tree
+	 * in O(n) without a single rotation, all nodes coming out of one
+	 * pool slab. Any other input is ordered and deduplicated first, the
+	 * first of equivalent values is kept like insert() would.
+	 * 
+	 * @param first range start.
+	 * @param last range end.
+	 */
+	template<typename InputIt>
+	void build_from_sorted(InputIt first, InputIt last);
+
+	/**
+	 * @brief build_from_sorted() with both halves of every subtree built
+	 * 		as tasks on scheduler, down to about grain keys.
+	 */
+	template<typename RandomIt>
+	void parallel_build_from_sorted(RandomIt first, RandomIt last,
+		RBTreeScheduler& scheduler, std::size_t grain = default_grain);
+
+	/**
+	 * @brief Insert the values of [first, last) whose keys are not stored
+	 * 		yet.
+	 * 
+	 * The batch is ordered and deduplicated like build_from_sorted() does,
+	 * then the tree is split at the middle key of the batch and both
+	 * halves recurse on their half of the batch before being joined back.
+	 * k values cost O(k log(n / k + 1)) comparisons instead of the
+	 * O(k log n) of as many insert() calls, and a batch landing between
+	 * two stored keys is linked in O(k) without a rotation.
+	 * 
+	 * @param first range start.
+	 * @param last range end.
+	 * @return std::size_t The number of values inserted.
+	 */
+	template<typename InputIt>
+	std::size_t insert_batch(InputIt first, InputIt last);
+
+	/**
+	 * @brief Remove the keys of [first, last), the same way insert_batch()
+	 * 		inserts values. Keys that are not stored are skipped.
+	 * 
+	 * @param first range start.
+	 * @param last range end.
+	 * @return std::size_t The number of values removed.
+	 */
+	template<typename InputIt>
+	std::size_t erase_batch(InputIt first, InputIt last);
+
+	/**
+	 * @brief Copy the values into a FrozenIndex in O(n), for trees that
+	 * 		are only queried from now on. The tree is left as it is and
+	 * 		stays independent of the index, see rbtree_frozen.hpp.
+	 */
+	FrozenIndex<T, Compare, Allocator, KeyOfValue> freeze() const;
+
+	/**
+	 * @brief Write the values to path in key order, see RBTreeFileHeader.
+	 * 		Only for trivially copyable values, see rbtree_io.hpp.
+	 * 
+	 * @throws std::runtime_error if path cannot be written. An existing
+	 * 		file is only replaced once the new one is complete, by a
+	 * 		rename that is atomic as both live in the same directory.
+	 */
+	void save(const std::string& path) const;
+
+	/**
+	 * @brief Replace the content with the values saved to path, built in
+	 * 		O(n) like build_from_sorted(), see rbtree_io.hpp.
+	 * 
+	 * @throws std::runtime_error if path cannot be read or was not saved
+	 * 		from a tree of the same value type. The tree is left as it was.
+	 */
+	void load(const std::string& path);
+
+	bool is_terminal(NodePtr);
+	bool is_black(NodePtr);
+	bool is_red(NodePtr);
+	bool empty() const { return _root == _TNULL; }
+
+	/**
+	 * @brief Number of stored keys, O(1).
+	 */
+	std::size_t size() const { return _size; }
+
+	/**
+	 * @brief Find the k-th smallest key, counting from 0, in O(log n).
+	 * 		Only available with OrderStatistics.
+	 * 
+	 * @param k rank of the key to look for.
+	 * @return NodePtr The node holding it, _TNULL if k >= size().
+	 */
+	NodePtr select(std::size_t k);
+
+	/**
+	 * @brief Count the keys less than key in O(log n). Only available
+	 * 		with OrderStatistics.
+	 */
+	std::size_t rank(const key_type& key);
+
+	template<typename Key, typename C = Compare,
+		typename = typename std::enable_if<RBTreeIsTransparent<C>::value>::type>
+	std::size_t rank(const Key& key);
+
+	/**
+	 * @brief First key not less than key, end() if there is none.
+	 */
+	iterator lower_bound(const key_type& key);
+
+	template<typename Key, typename C = Compare,
+		typename = typename std::enable_if<RBTreeIsTransparent<C>::value>::type>
+	iterator lower_bound(const Key& key);
+
+	/**
+	 * @brief First key greater than key, end() if there is none.
+	 */
+	iterator upper_bound(const key_type& key);
+
+	template<typename Key, typename C = Compare,
+		typename = typename std::enable_if<RBTreeIsTransparent<C>::value>::type>
+	iterator upper_bound(const Key& key);
+
+	/**
+	 * @brief Range of the keys equivalent to key, empty or one key long.
+	 */
+	std::pair<iterator, iterator> equal_range(const key_type& key);
+
+	template<typename Key, typename C = Compare,
+		typename = typename std::enable_if<RBTreeIsTransparent<C>::value>::type>
+	std::pair<iterator, iterator> equal_range(const Key& key);
+
+	/**
+	 * @brief Call fn on every value whose key lies in [lo, hi), in order.
+	 * 		Costs one descent to lo plus a step per visited value,
+	 * 		O(log n + k) in total.
+	 * 
+	 * @param lo inclusive lower key.
+	 * @param hi exclusive upper key.
+	 * @param fn callable taking a T&.
+	 */
+	template<typename Key, typename Function>
+	void for_each_in_range(const Key& lo, const Key& hi, Function fn);
+
+	/**
+	 * @brief Count the keys in [lo, hi) in O(log n). Only available
+	 * 		with OrderStatistics.
+	 */
+	std::size_t count_range(const key_type& lo, const key_type& hi);
+
+	template<typename Key, typename C = Compare,
+		typename = typename std::enable_if<RBTreeIsTransparent<C>::value>::type>
+	std::size_t count_range(const Key& lo, const Key& hi);
+
+	/**
+	 * @brief In-order iteration. begin() is the cached leftmost node.
+	 */
+	iterator begin() { return empty() ? end() : iterator(_leftmost(), _TNULL, &_header); }
+	iterator end() { return iterator(&_header, _TNULL, &_header); }
+	const_iterator begin() const { return empty() ? end() : const_iterator(_header.left, _TNULL, _header_ptr()); }
+	const_iterator end() const { return const_iterator(_header_ptr(), _TNULL, _header_ptr()); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+	const_reverse_iterator crbegin() const { return rbegin(); }
+	const_reverse_iterator crend() const { return rend(); }
+
+	/**
+	 * @brief Iterator positioned at a node of this tree, e.g. one
+	 * 		returned by find() or insert(). The terminal node maps to
+	 * 		end().
+	 */
+	iterator iterator_to(NodePtr node) { return iterator(node == _TNULL ? &_header : node, _TNULL, &_header); }
+
+private:
+	struct _shared_storage_tag {};
+	struct _shared_terminal_tag {};
+
+	/**
+	 * @brief Empty tree sharing the pool and the terminal node of other,
+	 * 		so that nodes can move between both trees as they are.
+	 */
+	RBTree(const RBTree& other, _shared_storage_tag)
+		: _root(other._TNULL), _TNULL(other._TNULL), _compare(other._compare), _pool(other._pool) {}
+
+	/**
+	 * @brief Empty tree sharing the terminal node of other but with a
+	 * 		pool of its own, the workspace of a parallel task.
+	 */
+	RBTree(const RBTree& other, _shared_terminal_tag)
+		: _root(other._TNULL), _TNULL(other._TNULL), _compare(other._compare),
+		_pool(std::allocate_shared<RBTreePool<Node, Allocator>>(
+			other._pool->get_allocator(), other._pool->get_allocator())) {}
+
+	/**
+	 * @brief Where and how finely the parallel operations fork.
+	 */
+	struct _Parallel
+	{
+		RBTreeScheduler& scheduler;
+		std::size_t grain;
+	};
+
+	/**
+	 * Lookups go through the comparator with the caller's key when the
+	 * comparator is transparent and with a converted T otherwise.
+	 */
+	template<typename Key>
+	using _lookup_key = typename std::conditional<RBTreeIsTransparent<Compare>::value, Key, key_type>::type;
+
+	static const key_type& _key(NodePtr node) { return KeyOfValue()(node->data); }
+
+	template<typename Key>
+	std::size_t _rank(const Key& key);
+
+	template<typename Key>
+	std::size_t _count_range(const Key& lo, const Key& hi);
+
+	template<typename Key>
+	NodePtr _lower_bound(const Key& key);
+
+	template<typename Key>
+	NodePtr _upper_bound(const Key& key);
+
+	/**
+	 * @brief Recompute a node subtree size from its children. No-op
+	 * 		without OrderStatistics.
+	 */
+	void _update_size(NodePtr node);
+
+	/**
+	 * @brief Link count values pulled from next() in order into a
+	 * 		perfectly balanced tree replacing the current content.
+	 */
+	template<typename Next>
+	void _build_tree(std::size_t count, Next&& next);
+
+	/**
+	 * @brief Order and deduplicate [first, last) if needed and build the
+	 * 		tree out of it, in parallel when given a _Parallel.
+	 */
+	template<typename InputIt>
+	void _build_from(InputIt first, InputIt last, const _Parallel* parallel);
+
+	/**
+	 * @brief Order pointers to values by key and drop all but the first
+	 * 		of equivalent ones. values is not required to be assignable.
+	 */
+	template<typename Value, typename KeyOf>
+	std::vector<Value*> _sorted_unique(std::vector<Value>& values, KeyOf key_of);
+
+	/**
+	 * @brief Depth of the red level of a tree of count nodes built by
+	 * 		_build(), 0 for none.
+	 */
+	static std::size_t _red_depth(std::size_t count);
+
+	/**
+	 * @brief _build_tree for indexed values, both subtrees of every node
+	 * 		above the grain being built as tasks.
+	 * 
+	 * @param at produces the value of a given in-order index.
+	 */
+	template<typename At>
+	void _build_tree(std::size_t count, const At& at, const _Parallel& parallel);
+
+	template<typename At>
+	NodePtr _build(const At& at, std::size_t first, std::size_t count,
+		std::size_t depth, std::size_t red_depth, const _Parallel& parallel);
+
+	/**
+	 * @brief Build a perfectly balanced subtree. Only the nodes of the
+	 * 		deepest level of the whole tree are red, which gives every
+	 * 		path the same black height.
+	 * 
+	 * @param next produces the values in order.
+	 * @param count subtree size.
+	 * @param depth subtree root depth.
+	 * @param red_depth depth of the red level, 0 for none.
+	 * @return NodePtr The subtree root, its parent is left unset.
+	 */
+	template<typename Next>
+	NodePtr _build(Next& next, std::size_t count, std::size_t depth, std::size_t red_depth);
+
+	NodePtr& _leftmost() { return _header.left; }
+	NodePtr& _rightmost() { return _header.right; }
+	NodePtr _header_ptr() const { return const_cast<NodePtr>(&_header); }
+
+	/**
+	 * @brief Whether no other tree or pool refers to this tree storage,
+	 * 		in which case it can be released wholesale.
+	 */
+	bool _owns_storage() const { return _pool.use_count() == 1 && !_pool->is_forwarding(); }
+
+	/**
+	 * @brief Install a detached subtree as the whole tree content and
+	 * 		refresh the root color, the cached bounds and the size.
+	 * 
+	 * @param root new root, its parent link is reset.
+	 * @param size key count.
+	 */
+	void _set_root(NodePtr root, std::size_t size);
+
+	/**
+	 * @brief Key count of this tree when it and other hold total keys
+	 * 		together. Without OrderStatistics, walks both trees in step
+	 * 		until one of them ends, O(min(n, m)).
+	 */
+	std::size_t _count_against(const RBTree& other, std::size_t total) const;
+
+	/**
+	 * @brief Make this tree and other use the same pool and terminal
+	 * 		node. The smaller tree gets relinked to the other terminal.
+	 *
+	 * @return The pool other moves to through _reset_storage() once it
+	 * 		is emptied, so that it stops sharing this tree's storage.
+	 * 		nullptr if both trees shared their storage already.
+	 */
+	std::shared_ptr<RBTreePool<Node, Allocator>> _share_storage(RBTree& other);
+
+	/**
+	 * @brief Move an empty tree to pool and a terminal node of its own.
+	 */
+	void _reset_storage(std::shared_ptr<RBTreePool<Node, Allocator>> pool);
+
+	/**
+	 * @brief The terminal node of moved-from trees. Nothing is linked to
+	 * 		it, so it is never written and the trees may share it.
+	 */
+	static NodePtr _moved_from_terminal();
+
+	/**
+	 * @brief Give a moved-from tree a pool and a terminal node of its
+	 * 		own, before it links any node. No-op for other trees.
+	 */
+	void _revive();
+
+	/**
+	 * @brief Point every terminal link of a subtree at _TNULL.
+	 * 
+	 * @param root subtree root.
+	 * @param tnull the terminal node the subtree currently uses.
+	 */
+	void _retarget(NodePtr root, NodePtr tnull);
+
+	/**
+	 * @brief Detached, black rooted subtree along with its black height,
+	 * 		which the join based algorithms carry around instead of
+	 * 		walking down for it.
+	 */
+	struct _Subtree
+	{
+		NodePtr root;
+		// black nodes on any path down to the terminal, root included.
+		std::size_t height;
+	};
+
+	_Subtree _subtree(NodePtr root);
+
+	/**
+	 * @brief Unlink a subtree root from its children, which become black
+	 * 		rooted standalone subtrees.
+	 */
+	void _detach(_Subtree tree, _Subtree& left, _Subtree& right);
+
+	/**
+	 * @brief Link left, pivot and right into one tree. Walks down the
+	 * 		spine of the higher tree to the black height of the lower
+	 * 		one and rebalances from there, O(difference of heights).
+	 * 
+	 * Every key of left is less than the pivot key and every key of
+	 * right greater.
+	 */
+	_Subtree _join(_Subtree left, NodePtr pivot, _Subtree right);
+
+	/**
+	 * @brief _join without pivot, the maximum of left is taken out.
+	 */
+	_Subtree _join2(_Subtree left, _Subtree right);
+
+	/**
+	 * @brief Take the maximum node out of a subtree.
+	 * 
+	 * @param last [out] the maximum node, detached.
+	 * @return _Subtree The remaining subtree.
+	 */
+	_Subtree _split_last(_Subtree tree, NodePtr& last);
+
+	/**
+	 * @brief Split a subtree around key, O(log n).
+	 * 
+	 * @param left [out] subtree of the keys less than key.
+	 * @param match [out] detached node holding key, _TNULL if none.
+	 * @param right [out] subtree of the keys greater than key.
+	 */
+	template<typename Key>
+	void _split(_Subtree tree, const Key& key, _Subtree& left, NodePtr& match, _Subtree& right);
+
+	/**
+	 * @brief Join based set operations. Every node ends up either in the
+	 * 		returned subtree or back in the pool.
+	 * 
+	 * @param dropped [out] incremented per node left out of the result
+	 * 		that counted in a's size: the duplicates from b for _union,
+	 * 		nodes of a otherwise.
+	 */
+	_Subtree _union(_Subtree a, _Subtree b, std::size_t& dropped, const _Parallel* parallel);
+	_Subtree _intersect(_Subtree a, _Subtree b, std::size_t& dropped, const _Parallel* parallel);
+	_Subtree _difference(_Subtree a, _Subtree b, std::size_t& dropped, const _Parallel* parallel);
+
+	void _union_with(RBTree& other, const _Parallel* parallel);
+	void _intersect_with(RBTree& other, const _Parallel* parallel);
+	void _difference_with(RBTree& other, const _Parallel* parallel);
+
+	/**
+	 * @brief Union of tree with count ordered, distinct values, moved
+	 * 		into the nodes of the keys not stored yet.
+	 */
+	_Subtree _insert_sorted(_Subtree tree, T* const* values, std::size_t count, std::size_t& inserted);
+
+	/**
+	 * @brief Difference of tree and count ordered, distinct keys.
+	 */
+	_Subtree _erase_sorted(_Subtree tree, key_type* const* keys, std::size_t count, std::size_t& erased);
+
+	/**
+	 * @brief Lower bound of the key count of a subtree, exact with
+	 * 		OrderStatistics.
+	 */
+	std::size_t _estimate_size(_Subtree tree);
+
+	/**
+	 * @brief Run left and right, each handed a tree to work on. They run
+	 * 		in parallel on workspace trees when size exceeds the grain
+	 * 		and one after the other on this tree otherwise, in which case
+	 * 		they are handed no _Parallel either.
+	 * 
+	 * @param left callable taking an RBTree& and a const _Parallel*.
+	 * @param right same as left.
+	 */
+	template<typename Left, typename Right>
+	void _fork(const _Parallel* parallel, std::size_t size, Left&& left, Right&& right);
+
+	/**
+	 * @brief Perform a BST find operation. Costs a single comparator
+	 * 		call per level plus a final equivalence check.
+	 * 
+	 * @param node subtree root.
+	 * @param key key to search for.
+	 * @return NodePtr 
+	 */
+	template<typename Key>
+    NodePtr _find(NodePtr root, const Key& key);
+
+	/**
+	 * @brief Walk down from the root once, stopping either at the node
+	 * 		holding key or at the terminal slot where key belongs.
+	 * 
+	 * @param key Key to look for.
+	 * @param parent [out] parent of the terminal slot.
+	 * @param left [out] whether the slot is the parent's left child.
+	 * @return NodePtr The node holding key, _TNULL if there is none.
+	 */
+	template<typename Key>
+    NodePtr _find_slot(const Key& key, ParentPtr& parent, bool& left);
+
+	/**
+	 * @brief Perform a BST insertion operation, a single descent that
+	 * 		either finds the duplicate or attaches a new node.
+	 * 
+	 * @param value Value to be inserted
+	 * @return std::pair<NodePtr, bool> The node holding the value key
+	 * 		and whether it was inserted.
+	 */
+	template<typename Value>
+    std::pair<NodePtr, bool> _insert(Value&& value);
+
+	/**
+	 * @brief Remove the node holding key if any.
+	 */
+	template<typename Key>
+	void _remove_key(const Key& key);
+
+	/**
+	 * @brief Take node out of the tree and rebalance. The node is left
+	 * 		alive, destroying it is up to the caller.
+	 */
+	void _unlink(NodePtr node);
+
+	/**
+	 * @brief Perform a BST deletion operation. A node with two children
+	 * 		is replaced by relinking its successor into its place, keys
+	 * 		never move between nodes.
+	 * 
+	 * @param node The node to unlink. On return it carries the color of
+	 * 		the position that was actually vacated, which is what
+	 * 		_remove_fix has to compensate for.
+	 * @return NodePtr The BST Replacement, placed in the vacated position.
+	 */
+    NodePtr _remove(NodePtr node);
+
+	/**
+	 * @brief Put node in place of old in old's parent.
+	 */
+	void _transplant(NodePtr old, NodePtr node);
+
+	NodePtr _get_sibling(ParentPtr);
+	NodePtr _get_single_child(NodePtr);
+
+    NodePtr _successor(NodePtr node);
+    NodePtr _rbminimum(NodePtr node);
+    NodePtr _predecessor(NodePtr node);
+    NodePtr _rbmaximum(NodePtr node);
+
+	/**
+	 * @brief Fix red-black tree imbalance after insertion.
+	 * 
+	 * @param node The newly inserted node.
+	 */
+    void _insert_fix(NodePtr node);
+	/**
+	 * @brief Fix the tree **AFTER** BST deletion.
+	 * 
+	 * @param u The BST Replacement node. The actual deleted node.
+	 * 		Usually, it will be one of the following two possibilities.
+	 * 			1- u := v successor/predecessor.
+	 * 			2. u := _TNULL with parent pointer set to the v->parent().
+	 * 		Anywhere in the code, if you found a node named "u", then
+	 * 		this is the BST Replacment node.
+	 * @param v The node that was required to be deleted. This node is 
+	 * 		no longer part of the red-black tree at that moment.
+	 */
+    void _remove_fix(NodePtr u, NodePtr v);
+
+    void _link_parent_child(ParentPtr parent, NodePtr child, bool left);
+
+	/**
+	 * @brief Write node, at depth, as the chosen format opens it.
+	 * 
+	 * @param indent Indentation of the TEXT lines, kept at 3 characters
+	 * 		a level.
+	 */
+	void _dump_enter(std::ostream& out, std::ostream& escaped, RBTreeDumpFormat format,
+		NodePtr node, std::size_t depth, std::string& indent) const;
+
+	/**
+	 * @brief Close node, whose children were not all written if cut.
+	 */
+	void _dump_leave(std::ostream& out, RBTreeDumpFormat format,
+		NodePtr node, std::size_t depth, bool cut, std::string& indent) const;
+
+	/**
+	 * @brief Write the key of node, as is in TEXT and for numbers in JSON,
+	 * 		quoted and escaped otherwise.
+	 */
+	void _dump_key(std::ostream& out, std::ostream& escaped, RBTreeDumpFormat format, NodePtr node) const;
+
+	/**
+	 * @brief Call fn(node, depth, black) on every node in key order, black
+	 * 		being the number of black nodes from the root down to node.
+	 * 		The walk follows the parent links, each checked before use.
+	 * 
+	 * @return bool false as soon as fn does or a child is not linked back
+	 * 		to its parent, that node being passed to fn as nullptr.
+	 */
+	template<typename Function>
+	bool _walk(Function fn) const;
+	void _rotate_left(NodePtr);
+	void _rotate_right(NodePtr);
+
+	/**
+	 * @brief _compare, counted in the stats.
+	 */
+	template<typename A, typename B>
+	bool _less(const A& a, const B& b)
+	{
+		RB_TREE_STAT(++_stats.comparisons);
+		return _compare(a, b);
+	}
+
+	/**
+	 * @brief set_color() by a fix-up, counted in the stats.
+	 */
+	void _recolor(NodePtr node, NodeColor color)
+	{
+		RB_TREE_STAT(++_stats.recolors);
+		node->set_color(color);
+	}
+
+
+	/**
+	 * @brief Node parent sibling is colored red.
+	 * 
+	 * @param node NodePtr.
+	 * @return NodePtr The grandparent, red now, to fix next.
+	 */
+	NodePtr _insert_fix_state00(NodePtr node);
+	/**
+	 * @brief Node parent sibling is colored black.
+	 * 
+	 * @param node NodePtr.
+	 */
+	void _insert_fix_state01(NodePtr node);
+
+	/**
+	 * @brief Node parent sibling is colored black and
+	 * 		requires a single rotation-- i.e. the straight line case.
+	 * 
+	 * @param node NodePtr.
+	 */
+	void _insert_fix_state10(NodePtr node);
+
+	/**
+	 * @brief Node parent sibling is colored black and
+	 * 		requires a double rotation-- i.e. the triangle case.
+	 * 
+	 * @param node NodePtr.
+	 */
+	void _insert_fix_state11(NodePtr node);
+
+	/**
+	 * @brief If the deleted node or the 
+	 * 		replacement node is RED.
+	 * 
+	 */
+	void _remove_fix_state000(NodePtr);
+
+	/**
+	 * @brief If both the deleted and the replacement
+	 * 		nodes are black.
+	 * 
+	 * @return NodePtr The node left double black, to fix next, or
+	 * 		nullptr once the tree is fixed. So do the states it leads to.
+	 */
+	NodePtr _remove_fix_state001(NodePtr);
+
+	/**
+	 * @brief If both the deleted and the replacement
+	 * 		nodes are black and sibling node is black.
+	 * 
+	 */
+	NodePtr _remove_fix_state010(NodePtr);
+
+	/**
+	 * @brief If both the deleted and the replacement
+	 * 		nodes are black and sibling node is black
+	 * 		with at least a red child.
+	 * 
+	 */
+	NodePtr _remove_fix_state011(NodePtr);
+
+	/**
+	 * @brief If both the deleted and the replacement
+	 * 		nodes are black and sibling node is black
+	 * 		with all black children. Black, Black
+	 * 		everywhere.
+	 * 
+	 */
+	NodePtr _remove_fix_state100(NodePtr);
+
+	/**
+	 * @brief If both the deleted and the replacement
+	 * 		nodes are black and sibling node is black
+	 * 		with a red child in LL or RR states.
+	 * 
+	 */
+	NodePtr _remove_fix_state101(NodePtr);
+
+	/**
+	 * @brief If both the deleted and the replacement
+	 * 		nodes are black and sibling node is black
+	 * 		with a red child in LR or RL states.
+	 * 
+	 */
+	NodePtr _remove_fix_state110(NodePtr);
+
+	/**
+	 * @brief If both the deleted and the replacement
+	 * 		nodes are black and sibling node is red.
+	 * 
+	 */
+	NodePtr _remove_fix_state111(NodePtr);
+
+	void _switch_color(RawNodePtr);
+
+	bool _is_root(NodePtr);
+	bool _is_insert_fix_state10(NodePtr);
 	bool _is_remove_fix_state000(NodePtr, NodePtr);
 	bool _is_remove_fix_state101(NodePtr);
     bool _has_two_child(NodePtr node);
     bool _has_red_child(NodePtr node);
+
+	NodePtr _create_sentinel();
+	template<typename... Args>
+	NodePtr _create_node(ParentPtr parent, Args&&... args);
+	void _destroy_node(NodePtr node);
+
+	/**
+	 * @brief Deep copy a subtree of another tree into this tree's pool.
+	 * 
+	 * @param root subtree root of the source tree.
+	 * @param tnull the source tree terminal node.
+	 * @param parent parent to attach the copied subtree to.
+	 * @return NodePtr The copied subtree root.
+	 */
+	NodePtr _clone(NodePtr root, NodePtr tnull, ParentPtr parent);
+
+	/**
+	 * @brief Destroy every node of a subtree. Walks the parent links so it
+	 * 		needs neither recursion nor an auxiliary stack.
+	 * 
+	 * @param root subtree root.
+	 * @param deallocate give the storage back to the pool. When the whole
+	 * 		pool is about to be released the walk is skipped entirely for
+	 * 		trivially destructible T.
+	 * @return std::size_t The number of nodes walked.
+	 */
+	std::size_t _destroy(NodePtr root, bool deallocate = true);
+
+	Node _header;
+	Compare _compare;
+	std::size_t _size = 0;
+	std::shared_ptr<RBTreePool<Node, Allocator>> _pool;
+#ifdef RBTREE_ENABLE_STATS
+	RBTreeStats _stats;
+#endif
 };
 
-/********************
- * PUBLIC INTERFACE *
- ********************/
+/********************
+ * PUBLIC INTERFACE *
+ ********************/
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::get_root() { return _root; }
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::is_terminal(NodePtr node)
+{
+	return node == _TNULL;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::is_black(NodePtr node)
+{
+	return node->color() == NodeColor::BLACK;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::is_red(NodePtr node)
+{
+	return node->color() == NodeColor::RED;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::find(const key_type& key)
+{
+    return _find(_root, key);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename C, typename>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::find(const Key& key)
+{
+    return _find(_root, key);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::insert(const T& key) {
+	return _insert(key).first;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::insert(T&& key) {
+	return _insert(std::move(key)).first;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename... Args>
+std::pair<typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr, bool> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::emplace(Args&&... args)
+{
+	_revive();
+	// the key has to exist before it can be compared, build the node first.
+	NodePtr node = _create_node(nullptr, std::forward<Args>(args)...);
+
+	ParentPtr parent;
+	bool left;
+	NodePtr existing = _find_slot(_key(node), parent, left);
+	if (existing != _TNULL)
+	{
+		_destroy_node(node);
+		return { existing, false };
+	}
+
+	node->set_parent(parent);
+	_link_parent_child(parent, node, left);
+	_insert_fix(node);
+
+	return { node, true };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename... Args>
+std::pair<typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr, bool> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::try_emplace(const Key& key, Args&&... args)
+{
+	_revive();
+	ParentPtr parent;
+	bool left;
+	NodePtr existing = _find_slot(static_cast<const _lookup_key<Key>&>(key), parent, left);
+	if (existing != _TNULL) return { existing, false };
+
+	NodePtr node = _create_node(parent, std::forward<Args>(args)...);
+	_link_parent_child(parent, node, left);
+	_insert_fix(node);
+
+	return { node, true };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::remove(const key_type& key)
+{
+	_remove_key(key);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename C, typename>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::remove(const Key& key)
+{
+	_remove_key(key);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::erase(const_iterator pos)
+{
+	NodePtr v = pos.node();
+	// nodes are relinked, not swapped, the next one stays where it is.
+	iterator next = std::next(iterator_to(v));
+
+	_unlink(v);
+	_destroy_node(v);
+
+	return next;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::erase(const_iterator first, const_iterator last)
+{
+	while (first != last) first = erase(first);
+	return iterator_to(last.node());
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::node_type RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::extract(const_iterator pos)
+{
+	NodePtr v = pos.node();
+	_unlink(v);
+	return node_type(v, _pool);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::node_type RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::extract(const key_type& key)
+{
+	NodePtr v = _find(_root, key);
+	if (v == _TNULL) return node_type();
+
+	_unlink(v);
+	return node_type(v, _pool);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::insert_return_type RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::insert(node_type&& node)
+{
+	if (node.empty()) return { end(), false, node_type() };
+	_revive();
+
+	ParentPtr parent;
+	bool left;
+	NodePtr existing = _find_slot(_key(node._node), parent, left);
+	if (existing != _TNULL) return { iterator_to(existing), false, std::move(node) };
+
+	_pool->keep(node._storages);
+	NodePtr child = std::exchange(node._node, nullptr);
+	node = node_type();
+
+	// the links still point into the source tree, its terminal included.
+	child->left = _TNULL;
+	child->right = _TNULL;
+	child->set_parent(parent);
+	child->set_color(NodeColor::RED);
+	_link_parent_child(parent, child, left);
+	_insert_fix(child);
+
+	return { iterator_to(child), true, node_type() };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::print_tree() {
+	dump(std::cout);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::dump(std::ostream& out, const RBTreeDumpOptions& options) const
+{
+	RBTreeDumpFormat format = options.format;
+	if (format == RBTreeDumpFormat::DOT) out << "digraph rbtree {\n";
+	if (_root == _TNULL || options.max_nodes == 0)
+	{
+		if (format == RBTreeDumpFormat::DOT) out << "}\n";
+		if (format == RBTreeDumpFormat::JSON) out << "null\n";
+		return;
+	}
+
+	// keys of DOT and JSON go through the escaping buffer.
+	RBTreeDumpEscape escape(out.rdbuf());
+	std::ostream escaped(&escape);
+	escaped.flags(out.flags());
+	escaped.precision(out.precision());
+
+	// a red-black tree of 64 bit sizes is less than 128 levels deep.
+	std::string indent;
+	indent.reserve(3 * 128);
+
+	NodePtr node = _root;
+	std::size_t depth = 0;
+	std::size_t written = 1;
+	_dump_enter(out, escaped, format, node, depth, indent);
+
+	while (true)
+	{
+		// preorder: down to the left child, else to the right one.
+		bool open = depth < options.max_depth && written < options.max_nodes;
+		NodePtr child = !open ? _TNULL : node->left != _TNULL ? node->left : node->right;
+		if (child != _TNULL)
+		{
+			node = child;
+			++depth;
+			++written;
+			_dump_enter(out, escaped, format, node, depth, indent);
+			continue;
+		}
+
+		// up until a right child is left to write. The left child of a
+		// node is never skipped unless its right one is too.
+		bool cut = node->left != _TNULL || node->right != _TNULL;
+		while (true)
+		{
+			_dump_leave(out, format, node, depth, cut, indent);
+			NodePtr parent = node->parent();
+			if (parent == nullptr || depth == 0)
+			{
+				if (format == RBTreeDumpFormat::DOT) out << "}\n";
+				if (format == RBTreeDumpFormat::JSON) out << '\n';
+				return;
+			}
+
+			bool from_left = parent->left == node;
+			node = parent;
+			--depth;
+			if (from_left && node->right != _TNULL)
+			{
+				if (written < options.max_nodes) break;
+				cut = true;
+			}
+			else
+			{
+				cut = false;
+			}
+		}
+
+		node = node->right;
+		++depth;
+		++written;
+		_dump_enter(out, escaped, format, node, depth, indent);
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Function, typename>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::dump(Function fn, const RBTreeDumpOptions& options) const
+{
+	RBTreeDumpBuffer<Function> buffer(fn);
+	std::ostream out(&buffer);
+	dump(out, options);
+	out.flush();
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+const RBTreeStats& RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::stats() const
+{
+#ifdef RBTREE_ENABLE_STATS
+	return _stats;
+#else
+	static const RBTreeStats none;
+	return none;
+#endif
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::reset_stats()
+{
+	RB_TREE_STAT(_stats = RBTreeStats());
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::validate(std::string* error) const
+{
+	auto fail = [error](const char* violation) {
+		if (error != nullptr) *error = violation;
+		return false;
+	};
+
+	if (_TNULL->color() != NodeColor::BLACK) return fail("terminal node is red");
+	if (_root == _TNULL)
+	{
+		if (_size != 0) return fail("size of an empty tree is not 0");
+		return true;
+	}
+	if (_root->parent() != nullptr) return fail("root has a parent");
+	if (_root->color() != NodeColor::BLACK) return fail("root is red");
+
+	const char* violation = nullptr;
+	NodePtr previous = nullptr;
+	std::size_t count = 0;
+	std::size_t black_height = 0;
+	bool linked = _walk([&](NodePtr node, std::size_t, std::size_t black) {
+		if (node == nullptr)
+		{
+			violation = "child not linked back to its parent";
+			return false;
+		}
+		if (previous != nullptr && !_compare(_key(previous), _key(node)))
+		{
+			violation = "keys out of order";
+			return false;
+		}
+		if (node->color() == NodeColor::RED
+			&& (node->left->color() == NodeColor::RED || node->right->color() == NodeColor::RED))
+		{
+			violation = "red node with a red child";
+			return false;
+		}
+		if (node->left == _TNULL || node->right == _TNULL)
+		{
+			if (black_height == 0) black_height = black;
+			if (black != black_height)
+			{
+				violation = "black height differs between paths";
+				return false;
+			}
+		}
+		if constexpr (OrderStatistics)
+		{
+			if (node->size != node->left->size + node->right->size + 1)
+			{
+				violation = "subtree size out of date";
+				return false;
+			}
+		}
+
+		if (previous == nullptr && node != _header.left)
+		{
+			violation = "leftmost node out of date";
+			return false;
+		}
+		previous = node;
+		++count;
+		return true;
+	});
+
+	if (!linked) return fail(violation);
+	if (previous != _header.right) return fail("rightmost node out of date");
+	if (_size != count) return fail("size out of date");
+	return true;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+RBTreeProfile RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::profile() const
+{
+	RBTreeProfile profile;
+	std::size_t total_depth = 0;
+	_walk([&](NodePtr node, std::size_t depth, std::size_t black) {
+		if (node == nullptr) return false;
+
+		if (depth > profile.depth_histogram.size()) profile.depth_histogram.resize(depth);
+		++profile.depth_histogram[depth - 1];
+		if (node->color() == NodeColor::RED) ++profile.red_nodes;
+		if (node->left == _TNULL || node->right == _TNULL) profile.black_height = black;
+		++profile.size;
+		total_depth += depth;
+		return true;
+	});
+
+	profile.height = profile.depth_histogram.size();
+	if (profile.size > 0) profile.average_depth = double(total_depth) / profile.size;
+	return profile;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::clear()
+{
+	if (_owns_storage())
+	{
+		_destroy(_root, false);
+		_pool->release();
+	}
+	else
+	{
+		_destroy(_root);
+	}
+
+	_root = _TNULL;
+	_size = 0;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::swap(RBTree& other) noexcept
+{
+	std::swap(_root, other._root);
+	std::swap(_TNULL, other._TNULL);
+	std::swap(_size, other._size);
+	std::swap(_leftmost(), other._leftmost());
+	std::swap(_rightmost(), other._rightmost());
+	// the nodes are ordered by the comparator they came with.
+	std::swap(_compare, other._compare);
+	_pool.swap(other._pool);
+#ifdef RBTREE_ENABLE_STATS
+	std::swap(_stats, other._stats);
+#endif
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::join(T pivot, RBTree& right)
+{
+	if (this == &right) throw std::invalid_argument("RBTree::join: cannot join a tree with itself");
+	if ((!empty() && !_compare(_key(_rightmost()), KeyOfValue()(pivot)))
+		|| (!right.empty() && !_compare(KeyOfValue()(pivot), _key(right._leftmost()))))
+	{
+		throw std::invalid_argument("RBTree::join: pivot does not separate the trees");
+	}
+	if (!empty() && !right.empty() && !shares_storage(right))
+	{
+		throw std::invalid_argument("RBTree::join: the trees do not share their storage, see union_with()");
+	}
+
+	std::shared_ptr<RBTreePool<Node, Allocator>> fresh = _share_storage(right);
+	std::size_t size = _size + right._size + 1;
+
+	NodePtr node = _create_node(nullptr, std::move(pivot));
+	_Subtree other = right._subtree(right._root);
+	right._set_root(_TNULL, 0);
+	if (fresh) right._reset_storage(std::move(fresh));
+	_set_root(_join(_subtree(_root), node, other).root, size);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::join(RBTree& right)
+{
+	if (this == &right) throw std::invalid_argument("RBTree::join: cannot join a tree with itself");
+	if (right.empty()) return;
+	if (!empty() && !_compare(_key(_rightmost()), _key(right._leftmost())))
+	{
+		throw std::invalid_argument("RBTree::join: keys of the trees overlap");
+	}
+	if (!empty() && !shares_storage(right))
+	{
+		throw std::invalid_argument("RBTree::join: the trees do not share their storage, see union_with()");
+	}
+
+	std::shared_ptr<RBTreePool<Node, Allocator>> fresh = _share_storage(right);
+	std::size_t size = _size + right._size;
+
+	_Subtree other = right._subtree(right._root);
+	right._set_root(_TNULL, 0);
+	if (fresh) right._reset_storage(std::move(fresh));
+	_set_root(_join2(_subtree(_root), other).root, size);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::split(const key_type& key)
+{
+	RBTree result(*this, _shared_storage_tag());
+
+	_Subtree left, right;
+	NodePtr match;
+	_split(_subtree(_root), key, left, match, right);
+	if (match != _TNULL) right = _join({ _TNULL, 0 }, match, right);
+
+	std::size_t size = _size;
+	_set_root(left.root, 0);
+	result._set_root(right.root, 0);
+	_size = _count_against(result, size);
+	result._size = size - _size;
+	return result;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::union_with(RBTree& other)
+{
+	_union_with(other, nullptr);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::parallel_union_with(RBTree& other, RBTreeScheduler& scheduler, std::size_t grain)
+{
+	_Parallel parallel { scheduler, grain };
+	_union_with(other, &parallel);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_union_with(RBTree& other, const _Parallel* parallel)
+{
+	if (this == &other) return;
+
+	std::shared_ptr<RBTreePool<Node, Allocator>> fresh = _share_storage(other);
+	std::size_t size = _size + other._size;
+
+	_Subtree b = other._subtree(other._root);
+	other._set_root(_TNULL, 0);
+	if (fresh) other._reset_storage(std::move(fresh));
+
+	std::size_t dropped = 0;
+	NodePtr root = _union(_subtree(_root), b, dropped, parallel).root;
+	_set_root(root, size - dropped);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::intersect_with(RBTree& other)
+{
+	_intersect_with(other, nullptr);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::parallel_intersect_with(RBTree& other, RBTreeScheduler& scheduler, std::size_t grain)
+{
+	_Parallel parallel { scheduler, grain };
+	_intersect_with(other, &parallel);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_intersect_with(RBTree& other, const _Parallel* parallel)
+{
+	if (this == &other) return;
+
+	std::shared_ptr<RBTreePool<Node, Allocator>> fresh = _share_storage(other);
+	_Subtree b = other._subtree(other._root);
+	other._set_root(_TNULL, 0);
+	if (fresh) other._reset_storage(std::move(fresh));
+
+	std::size_t dropped = 0;
+	NodePtr root = _intersect(_subtree(_root), b, dropped, parallel).root;
+	_set_root(root, _size - dropped);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::difference_with(RBTree& other)
+{
+	_difference_with(other, nullptr);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::parallel_difference_with(RBTree& other, RBTreeScheduler& scheduler, std::size_t grain)
+{
+	_Parallel parallel { scheduler, grain };
+	_difference_with(other, &parallel);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_difference_with(RBTree& other, const _Parallel* parallel)
+{
+	if (this == &other)
+	{
+		clear();
+		return;
+	}
+
+	std::shared_ptr<RBTreePool<Node, Allocator>> fresh = _share_storage(other);
+	_Subtree b = other._subtree(other._root);
+	other._set_root(_TNULL, 0);
+	if (fresh) other._reset_storage(std::move(fresh));
+
+	std::size_t dropped = 0;
+	NodePtr root = _difference(_subtree(_root), b, dropped, parallel).root;
+	_set_root(root, _size - dropped);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::select(std::size_t k)
+{
+	static_assert(OrderStatistics, "select() requires an order statistics tree");
+
+	NodePtr node = _root;
+	while (node != _TNULL)
+	{
+		std::size_t left_size = node->left->size;
+		if (k < left_size)
+		{
+			node = node->left;
+		}
+		else if (k == left_size)
+		{
+			return node;
+		}
+		else
+		{
+			k -= left_size + 1;
+			node = node->right;
+		}
+	}
+
+	return _TNULL;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::rank(const key_type& key)
+{
+	return _rank(key);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename C, typename>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::rank(const Key& key)
+{
+	return _rank(key);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::lower_bound(const key_type& key)
+{
+	return iterator_to(_lower_bound(key));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename C, typename>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::lower_bound(const Key& key)
+{
+	return iterator_to(_lower_bound(key));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::upper_bound(const key_type& key)
+{
+	return iterator_to(_upper_bound(key));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename C, typename>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::upper_bound(const Key& key)
+{
+	return iterator_to(_upper_bound(key));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::pair<typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator, typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::equal_range(const key_type& key)
+{
+	return { iterator_to(_lower_bound(key)), iterator_to(_upper_bound(key)) };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename C, typename>
+std::pair<typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator, typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::iterator> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::equal_range(const Key& key)
+{
+	return { iterator_to(_lower_bound(key)), iterator_to(_upper_bound(key)) };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename Function>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::for_each_in_range(const Key& lo, const Key& hi, Function fn)
+{
+	const _lookup_key<Key>& upper = hi;
+	iterator itr = iterator_to(_lower_bound(static_cast<const _lookup_key<Key>&>(lo)));
+	for (iterator last = end(); itr != last && _compare(_key(itr.node()), upper); ++itr)
+	{
+		fn(*itr);
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::count_range(const key_type& lo, const key_type& hi)
+{
+	return _count_range(lo, hi);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key, typename C, typename>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::count_range(const Key& lo, const Key& hi)
+{
+	return _count_range(lo, hi);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename InputIt>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::build_from_sorted(InputIt first, InputIt last)
+{
+	_build_from(first, last, nullptr);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename RandomIt>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::parallel_build_from_sorted(RandomIt first, RandomIt last, RBTreeScheduler& scheduler, std::size_t grain)
+{
+	static_assert(std::is_base_of<std::random_access_iterator_tag,
+		typename std::iterator_traits<RandomIt>::iterator_category>::value,
+		"parallel_build_from_sorted() requires random access iterators");
+
+	_Parallel parallel { scheduler, grain };
+	_build_from(first, last, &parallel);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename InputIt>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_build_from(InputIt first, InputIt last, const _Parallel* parallel)
+{
+	auto key_less = [this](const T& lhs, const T& rhs) {
+		return _compare(KeyOfValue()(lhs), KeyOfValue()(rhs));
+	};
+
+	typedef typename std::iterator_traits<InputIt>::iterator_category category;
+	if constexpr (std::is_base_of<std::forward_iterator_tag, category>::value)
+	{
+		// strictly increasing input is consumed straight away.
+		bool sorted = std::adjacent_find(first, last, [&](const T& lhs, const T& rhs) {
+			return !key_less(lhs, rhs);
+		}) == last;
+
+		if (sorted)
+		{
+			if constexpr (std::is_base_of<std::random_access_iterator_tag, category>::value)
+			{
+				if (parallel != nullptr)
+				{
+					_build_tree(last - first, [first](std::size_t i) -> decltype(auto) { return first[i]; }, *parallel);
+					return;
+				}
+			}
+			_build_tree(std::distance(first, last), [&]() -> decltype(auto) { return *first++; });
+			return;
+		}
+	}
+
+	std::vector<T> values(first, last);
+	std::vector<T*> order = _sorted_unique(values, KeyOfValue());
+
+	if (parallel != nullptr)
+	{
+		_build_tree(order.size(), [&order](std::size_t i) -> T&& { return std::move(*order[i]); }, *parallel);
+		return;
+	}
+
+	std::size_t index = 0;
+	_build_tree(order.size(), [&]() -> T&& { return std::move(*order[index++]); });
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename InputIt>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::insert_batch(InputIt first, InputIt last)
+{
+	std::vector<T> values(first, last);
+	std::vector<T*> order = _sorted_unique(values, KeyOfValue());
+	_revive();
+	if (empty()) _pool->reserve(order.size());
+
+	std::size_t inserted = 0;
+	NodePtr root = _insert_sorted(_subtree(_root), order.data(), order.size(), inserted).root;
+	_set_root(root, _size + inserted);
+	return inserted;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename InputIt>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::erase_batch(InputIt first, InputIt last)
+{
+	std::vector<key_type> keys(first, last);
+	std::vector<key_type*> order = _sorted_unique(keys, [](const key_type& key) -> const key_type& { return key; });
+
+	std::size_t erased = 0;
+	NodePtr root = _erase_sorted(_subtree(_root), order.data(), order.size(), erased).root;
+	_set_root(root, _size - erased);
+	return erased;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Value, typename KeyOf>
+std::vector<Value*> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_sorted_unique(std::vector<Value>& values, KeyOf key_of)
+{
+	std::vector<Value*> order;
+	order.reserve(values.size());
+	for (Value& value: values) order.push_back(std::addressof(value));
+
+	auto less = [&](const Value* lhs, const Value* rhs) { return _compare(key_of(*lhs), key_of(*rhs)); };
+	if (!std::is_sorted(order.begin(), order.end(), less))
+	{
+		std::stable_sort(order.begin(), order.end(), less);
+	}
+	order.erase(std::unique(order.begin(), order.end(), [&](const Value* lhs, const Value* rhs) {
+		return !less(lhs, rhs);
+	}), order.end());
+
+	return order;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_red_depth(std::size_t count)
+{
+	std::size_t deepest = 0;
+	while ((count >> (deepest + 1)) != 0) ++deepest;
+	return deepest;
+}
+
+/*******************
+ * PRIVATE HELPERS *
+ *******************/
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_set_root(NodePtr root, std::size_t size)
+{
+	_root = root;
+	_size = size;
+	if (is_terminal(root)) return;
+
+	root->set_parent(nullptr);
+	root->set_color(NodeColor::BLACK);
+	_leftmost() = _rbminimum(root);
+	_rightmost() = _rbmaximum(root);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_count_against(const RBTree& other, std::size_t total) const
+{
+	if constexpr (OrderStatistics)
+	{
+		return _root->size;
+	}
+	else
+	{
+		const_iterator mine = begin(), theirs = other.begin();
+		std::size_t count = 0;
+		for (; mine != end() && theirs != other.end(); ++mine, ++theirs) ++count;
+		return mine == end() ? count : total - count;
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::shared_ptr<RBTreePool<typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::Node, Allocator>> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_share_storage(RBTree& other)
+{
+	_revive();
+	other._revive();
+	if (_TNULL == other._TNULL) return nullptr;
+
+	// allocated first, nothing has changed yet if it throws.
+	std::shared_ptr<RBTreePool<Node, Allocator>> fresh = std::allocate_shared<RBTreePool<Node, Allocator>>(
+		other._pool->get_allocator(), other._pool->get_allocator());
+
+	RBTree& from = _size < other._size ? *this : other;
+	RBTree& into = &from == this ? other : *this;
+
+	into._pool->adopt(*from._pool);
+	into._retarget(from._root, from._TNULL);
+	if (from.is_terminal(from._root)) from._root = into._TNULL;
+	from._TNULL = into._TNULL;
+	from._pool = into._pool;
+	return fresh;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_reset_storage(std::shared_ptr<RBTreePool<Node, Allocator>> pool)
+{
+	_pool = std::move(pool);
+	_TNULL = _create_sentinel();
+	_set_root(_TNULL, 0);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_moved_from_terminal()
+{
+	// links back to itself like any terminal node, set up once.
+	static Node terminal;
+	static NodePtr sentinel = terminal.left = terminal.right = &terminal;
+	return sentinel;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_revive()
+{
+	if (_TNULL != _moved_from_terminal()) return;
+
+	// the pool of the tree it was moved into, kept for its allocator.
+	_reset_storage(std::allocate_shared<RBTreePool<Node, Allocator>>(
+		_pool->get_allocator(), _pool->get_allocator()));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_retarget(NodePtr root, NodePtr tnull)
+{
+	if (root == tnull) return;
+
+	// in-order walk, a node is relinked once the next one is known.
+	NodePtr node = root;
+	while (node->left != tnull) node = node->left;
+	while (node != nullptr)
+	{
+		NodePtr next;
+		if (node->right != tnull)
+		{
+			next = node->right;
+			while (next->left != tnull) next = next->left;
+		}
+		else
+		{
+			NodePtr child = node;
+			next = node->parent();
+			while (next != nullptr && next->right == child)
+			{
+				child = next;
+				next = next->parent();
+			}
+		}
+
+		if (node->left == tnull) node->left = _TNULL;
+		if (node->right == tnull) node->right = _TNULL;
+		node = next;
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_subtree(NodePtr root)
+{
+	std::size_t height = 0;
+	for (NodePtr node = root; !is_terminal(node); node = node->left)
+	{
+		if (is_black(node)) ++height;
+	}
+	return { root, height };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_detach(_Subtree tree, _Subtree& left, _Subtree& right)
+{
+	NodePtr root = tree.root;
+	left = { root->left, tree.height - 1 };
+	right = { root->right, tree.height - 1 };
+	root->left = _TNULL;
+	root->right = _TNULL;
+
+	for (_Subtree* child: { &left, &right })
+	{
+		if (is_terminal(child->root)) continue;
+		child->root->set_parent(nullptr);
+		if (is_red(child->root))
+		{
+			child->root->set_color(NodeColor::BLACK);
+			++child->height;
+		}
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_join(_Subtree left, NodePtr pivot, _Subtree right)
+{
+	pivot->set_parent(nullptr);
+	if (left.height == right.height)
+	{
+		pivot->left = left.root;
+		pivot->right = right.root;
+		if (!is_terminal(left.root)) left.root->set_parent(pivot);
+		if (!is_terminal(right.root)) right.root->set_parent(pivot);
+		pivot->set_color(NodeColor::BLACK);
+		_update_size(pivot);
+		return { pivot, left.height + 1 };
+	}
+
+	// walk down the facing spine of the higher tree to the first black
+	// node as high as the lower tree, the pivot goes in its place.
+	bool higher_left = left.height > right.height;
+	_Subtree higher = higher_left ? left : right;
+	std::size_t target = higher_left ? right.height : left.height;
+	NodePtr node = higher.root;
+	std::size_t height = higher.height;
+	ParentPtr parent = nullptr;
+	while (!is_black(node) || height != target)
+	{
+		if (is_black(node)) --height;
+		parent = node;
+		node = higher_left ? node->right : node->left;
+	}
+
+	if (higher_left)
+	{
+		pivot->left = node;
+		pivot->right = right.root;
+		parent->right = pivot;
+	}
+	else
+	{
+		pivot->left = left.root;
+		pivot->right = node;
+		parent->left = pivot;
+	}
+	pivot->set_parent(parent);
+	if (!is_terminal(pivot->left)) pivot->left->set_parent(pivot);
+	if (!is_terminal(pivot->right)) pivot->right->set_parent(pivot);
+	pivot->set_color(NodeColor::RED);
+
+	// the spine just walked is the only path whose sizes changed.
+	for (NodePtr itr = pivot; itr != nullptr; itr = itr->parent()) _update_size(itr);
+
+	// the black height grows only when the fix-up recolors its way up to
+	// the root, which turns the root child off the spine from red to
+	// black; rotating at the root replaces the root instead.
+	NodePtr top = higher.root;
+	NodePtr off_spine = higher_left ? top->left : top->right;
+	bool off_spine_red = is_red(off_spine);
+
+	_root = top;
+	_insert_fix(pivot);
+
+	bool grown = _root == top && off_spine_red && is_black(off_spine);
+	return { _root, higher.height + (grown ? 1 : 0) };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_join2(_Subtree left, _Subtree right)
+{
+	if (is_terminal(left.root)) return right;
+	if (is_terminal(right.root)) return left;
+
+	NodePtr last;
+	_Subtree rest = _split_last(left, last);
+	return _join(rest, last, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_split_last(_Subtree tree, NodePtr& last)
+{
+	_Subtree left, right;
+	_detach(tree, left, right);
+	if (is_terminal(right.root))
+	{
+		last = tree.root;
+		return left;
+	}
+
+	_Subtree rest = _split_last(right, last);
+	return _join(left, tree.root, rest);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_split(_Subtree tree, const Key& key, _Subtree& left, NodePtr& match, _Subtree& right)
+{
+	if (is_terminal(tree.root))
+	{
+		left = right = tree;
+		match = _TNULL;
+		return;
+	}
+
+	NodePtr root = tree.root;
+	_Subtree root_left, root_right;
+	_detach(tree, root_left, root_right);
+	if (_compare(key, _key(root)))
+	{
+		_Subtree rest;
+		_split(root_left, key, left, match, rest);
+		right = _join(rest, root, root_right);
+	}
+	else if (_compare(_key(root), key))
+	{
+		_Subtree rest;
+		_split(root_right, key, rest, match, right);
+		left = _join(root_left, root, rest);
+	}
+	else
+	{
+		left = root_left;
+		match = root;
+		right = root_right;
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_union(_Subtree a, _Subtree b, std::size_t& dropped, const _Parallel* parallel)
+{
+	if (is_terminal(a.root)) return b;
+	if (is_terminal(b.root)) return a;
+
+	_Subtree a_left, a_right;
+	_detach(a, a_left, a_right);
+	_Subtree b_left, b_right;
+	NodePtr match;
+	_split(b, _key(a.root), b_left, match, b_right);
+
+	_Subtree left, right;
+	std::size_t right_dropped = 0;
+	_fork(parallel, _estimate_size(a) + _estimate_size(b),
+		[&](RBTree& tree, const _Parallel* fork) { left = tree._union(a_left, b_left, dropped, fork); },
+		[&](RBTree& tree, const _Parallel* fork) { right = tree._union(a_right, b_right, right_dropped, fork); });
+	dropped += right_dropped;
+
+	if (!is_terminal(match))
+	{
+		_destroy_node(match);
+		++dropped;
+	}
+
+	return _join(left, a.root, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_intersect(_Subtree a, _Subtree b, std::size_t& dropped, const _Parallel* parallel)
+{
+	if (is_terminal(a.root) || is_terminal(b.root))
+	{
+		dropped += _destroy(a.root);
+		_destroy(b.root);
+		return { _TNULL, 0 };
+	}
+
+	_Subtree a_left, a_right;
+	_detach(a, a_left, a_right);
+	_Subtree b_left, b_right;
+	NodePtr match;
+	_split(b, _key(a.root), b_left, match, b_right);
+
+	_Subtree left, right;
+	std::size_t right_dropped = 0;
+	_fork(parallel, _estimate_size(a) + _estimate_size(b),
+		[&](RBTree& tree, const _Parallel* fork) { left = tree._intersect(a_left, b_left, dropped, fork); },
+		[&](RBTree& tree, const _Parallel* fork) { right = tree._intersect(a_right, b_right, right_dropped, fork); });
+	dropped += right_dropped;
+
+	if (is_terminal(match))
+	{
+		_destroy_node(a.root);
+		++dropped;
+		return _join2(left, right);
+	}
+
+	_destroy_node(match);
+	return _join(left, a.root, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_difference(_Subtree a, _Subtree b, std::size_t& dropped, const _Parallel* parallel)
+{
+	if (is_terminal(a.root) || is_terminal(b.root))
+	{
+		_destroy(b.root);
+		return a;
+	}
+
+	_Subtree b_left, b_right;
+	_detach(b, b_left, b_right);
+	_Subtree a_left, a_right;
+	NodePtr match;
+	_split(a, _key(b.root), a_left, match, a_right);
+
+	_Subtree left, right;
+	std::size_t right_dropped = 0;
+	_fork(parallel, _estimate_size(a) + _estimate_size(b),
+		[&](RBTree& tree, const _Parallel* fork) { left = tree._difference(a_left, b_left, dropped, fork); },
+		[&](RBTree& tree, const _Parallel* fork) { right = tree._difference(a_right, b_right, right_dropped, fork); });
+	dropped += right_dropped;
+
+	_destroy_node(b.root);
+	if (!is_terminal(match))
+	{
+		_destroy_node(match);
+		++dropped;
+	}
+
+	return _join2(left, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_insert_sorted(_Subtree tree, T* const* values, std::size_t count, std::size_t& inserted)
+{
+	if (count == 0) return tree;
+
+	if (is_terminal(tree.root))
+	{
+		// nothing stored in between, the values make a subtree of their own.
+		std::size_t index = 0;
+		auto next = [&]() -> T&& { return std::move(*values[index++]); };
+		inserted += count;
+		return _subtree(_build(next, count, 0, _red_depth(count)));
+	}
+
+	std::size_t middle = count / 2;
+	_Subtree left, right;
+	NodePtr match;
+	_split(tree, KeyOfValue()(*values[middle]), left, match, right);
+
+	left = _insert_sorted(left, values, middle, inserted);
+	right = _insert_sorted(right, values + middle + 1, count - middle - 1, inserted);
+	if (is_terminal(match))
+	{
+		match = _create_node(nullptr, std::move(*values[middle]));
+		++inserted;
+	}
+	return _join(left, match, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_Subtree RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_erase_sorted(_Subtree tree, key_type* const* keys, std::size_t count, std::size_t& erased)
+{
+	if (count == 0 || is_terminal(tree.root)) return tree;
+
+	std::size_t middle = count / 2;
+	_Subtree left, right;
+	NodePtr match;
+	_split(tree, *keys[middle], left, match, right);
+
+	left = _erase_sorted(left, keys, middle, erased);
+	right = _erase_sorted(right, keys + middle + 1, count - middle - 1, erased);
+	if (!is_terminal(match))
+	{
+		_destroy_node(match);
+		++erased;
+	}
+	return _join2(left, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_estimate_size(_Subtree tree)
+{
+	if constexpr (OrderStatistics)
+	{
+		return tree.root->size;
+	}
+	else
+	{
+		// a black height of h takes 2^h - 1 nodes at least.
+		if (tree.height >= std::numeric_limits<std::size_t>::digits) return std::size_t(-1);
+		return (std::size_t(1) << tree.height) - 1;
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Left, typename Right>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_fork(const _Parallel* parallel, std::size_t size, Left&& left, Right&& right)
+{
+	if (parallel == nullptr || size <= parallel->grain)
+	{
+		left(*this, nullptr);
+		right(*this, nullptr);
+		return;
+	}
+
+	RBTree left_tree(*this, _shared_terminal_tag());
+	RBTree right_tree(*this, _shared_terminal_tag());
+	auto merge = [&]() {
+		// the roots were only scratch space, the nodes belong to the caller.
+		left_tree._root = right_tree._root = _TNULL;
+		_pool->adopt(*left_tree._pool);
+		_pool->adopt(*right_tree._pool);
+	};
+
+	try
+	{
+		parallel->scheduler.fork_join(
+			[&]() { left(left_tree, parallel); },
+			[&]() { right(right_tree, parallel); });
+	}
+	catch (...)
+	{
+		merge();
+		throw;
+	}
+	merge();
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Next>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_build_tree(std::size_t count, Next&& next)
+{
+	clear();
+	if (count == 0) return;
+	_revive();
+
+	// every node of the tree comes out of a single slab.
+	_pool->reserve(count);
+
+	_set_root(_build(next, count, 0, _red_depth(count)), count);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Next>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_build(Next& next, std::size_t count, std::size_t depth, std::size_t red_depth)
+{
+	if (count == 0) return _TNULL;
+
+	// the left half is one smaller at most, leaves end up on two levels.
+	std::size_t left_count = (count - 1) / 2;
+	NodePtr left = _build(next, left_count, depth + 1, red_depth);
+
+	NodePtr node;
+	NodePtr right;
+	try
+	{
+		node = _create_node(nullptr, next());
+	}
+	catch (...)
+	{
+		_destroy(left);
+		throw;
+	}
+
+	try
+	{
+		right = _build(next, count - left_count - 1, depth + 1, red_depth);
+	}
+	catch (...)
+	{
+		_destroy(left);
+		_destroy_node(node);
+		throw;
+	}
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::get_root() { return _root; }
+	node->left = left;
+	node->right = right;
+	if (left != _TNULL) left->set_parent(node);
+	if (right != _TNULL) right->set_parent(node);
+	node->set_color(depth == red_depth && depth != 0 ? NodeColor::RED : NodeColor::BLACK);
+	_update_size(node);
 
-template<typename T>
-bool RBTree<T>::is_terminal(NodePtr node)
-{
-	return node == _TNULL;
+	return node;
 }
 
-template<typename T>
-bool RBTree<T>::is_black(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename At>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_build_tree(std::size_t count, const At& at, const _Parallel& parallel)
 {
-	return node->color == NodeColor::BLACK;
-}
+	clear();
+	if (count == 0) return;
+	_revive();
 
-template<typename T>
-bool RBTree<T>::is_red(NodePtr node)
-{
-	return node->color == NodeColor::RED;
+	_set_root(_build(at, 0, count, 0, _red_depth(count), parallel), count);
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::find(T key)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename At>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_build(const At& at, std::size_t first, std::size_t count, std::size_t depth, std::size_t red_depth, const _Parallel& parallel)
 {
-    return _find(_root, key);
-}
+	if (count <= parallel.grain)
+	{
+		// a task builds its whole subtree out of a single slab.
+		_pool->reserve(count);
+		std::size_t index = first;
+		auto next = [&]() -> decltype(auto) { return at(index++); };
+		return _build(next, count, depth, red_depth);
+	}
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::insert(T key) {
-	// check if already exists
-	NodePtr new_rbnode = find(key);
-	if (new_rbnode != _TNULL) return new_rbnode;
+	std::size_t left_count = (count - 1) / 2;
+	NodePtr left = _TNULL;
+	NodePtr right = _TNULL;
+	NodePtr node;
+	try
+	{
+		_fork(&parallel, count,
+			[&](RBTree& tree, const _Parallel*) {
+				left = tree._build(at, first, left_count, depth + 1, red_depth, parallel);
+			},
+			[&](RBTree& tree, const _Parallel*) {
+				right = tree._build(at, first + left_count + 1, count - left_count - 1, depth + 1, red_depth, parallel);
+			});
+		node = _create_node(nullptr, at(first + left_count));
+	}
+	catch (...)
+	{
+		_destroy(left);
+		_destroy(right);
+		throw;
+	}
 
-	new_rbnode = _insert(_root, nullptr, key);
-	_insert_fix(new_rbnode);
+	node->left = left;
+	node->right = right;
+	if (left != _TNULL) left->set_parent(node);
+	if (right != _TNULL) right->set_parent(node);
+	node->set_color(depth == red_depth && depth != 0 ? NodeColor::RED : NodeColor::BLACK);
+	_update_size(node);
 
-	return new_rbnode;
+	return node;
 }
 
-template<typename T>
-void RBTree<T>::remove(T key)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_rank(const Key& key)
 {
-	// check if exists
-	NodePtr v = find(key);
-	if (v == _TNULL) return;
+	static_assert(OrderStatistics, "rank() requires an order statistics tree");
 
-	if (_has_two_child(v))
+	std::size_t rank = 0;
+	NodePtr node = _root;
+	while (node != _TNULL)
 	{
-		v = _successor(v);
+		if (_compare(_key(node), key))
+		{
+			rank += node->left->size + 1;
+			node = node->right;
+		}
+		else
+		{
+			node = node->left;
+		}
 	}
 
-	NodePtr u = _remove(_root, nullptr, key);
-	_remove_fix(u, v);
+	return rank;
 }
 
-template<typename T>
-void RBTree<T>::print_tree() {
-    if (_root) {
-		_print_tree(_root, "", true);
-	}
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_count_range(const Key& lo, const Key& hi)
+{
+	if (!_compare(lo, hi)) return 0;
+	return _rank(hi) - _rank(lo);
 }
 
-/*******************
- * PRIVATE HELPERS *
- *******************/
-
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_find(NodePtr node, T key)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_lower_bound(const Key& key)
 {
-	if (node == _TNULL || key == node->data) {
-		return node;
+	NodePtr bound = _TNULL;
+	NodePtr node = _root;
+	while (node != _TNULL)
+	{
+		if (!_less(_key(node), key))
+		{
+			bound = node;
+			node = node->left;
+		}
+		else
+		{
+			node = node->right;
+		}
 	}
 
-	if (key < node->data) {
-		return _find(node->left, key);
-	}
-	return _find(node->right, key);
+	return bound;
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_insert(NodePtr root, ParentPtr parent, T key) {
-	if (root == _TNULL) {
-		NodePtr new_node = std::make_shared<Node>();
-		new_node->data = key;
-		new_node->left = _TNULL;
-		new_node->right = _TNULL;
-		new_node->parent = parent;
-		new_node->color = NodeColor::RED;
-
-        // set as root if first node to insert
-		if (parent == nullptr) _root = new_node;
-		else _link_parent_child(parent, new_node);
-
-		return new_node;
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_upper_bound(const Key& key)
+{
+	NodePtr bound = _TNULL;
+	NodePtr node = _root;
+	while (node != _TNULL)
+	{
+		if (_less(key, _key(node)))
+		{
+			bound = node;
+			node = node->left;
+		}
+		else
+		{
+			node = node->right;
+		}
 	}
 
-	if (key < root->data) {
-		return _insert(root->left, root.get(), key);
+	return bound;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_update_size(NodePtr node)
+{
+	if constexpr (OrderStatistics)
+	{
+		node->size = node->left->size + node->right->size + 1;
 	}
-	return _insert(root->right, root.get(), key);
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_remove(NodePtr root, NodePtr parent, T key)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_find(NodePtr node, const Key& key)
 {
-	if (root->data == key && _has_two_child(root))
+	// lowest node not less than key, the only equivalence candidate.
+	NodePtr candidate = _TNULL;
+	RB_TREE_STAT(std::size_t depth = 0);
+	while (node != _TNULL)
 	{
-		NodePtr u = _successor(root);
-		_swap_node(root, u);
-		return _remove(root->right, root, u->data);
+		RB_TREE_STAT(++depth);
+		if (!_less(_key(node), key))
+		{
+			candidate = node;
+			node = node->left;
+		}
+		else
+		{
+			node = node->right;
+		}
 	}
-	if (root->data == key)
+	RB_TREE_STAT(_stats.max_depth = std::max(_stats.max_depth, depth));
+
+	if (candidate != _TNULL && _less(key, _key(candidate))) return _TNULL;
+	return candidate;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_find_slot(const Key& key, ParentPtr& parent, bool& left)
+{
+	NodePtr node = _root;
+	parent = nullptr;
+	left = false;
+
+	// highest node not greater than key, the only equivalence candidate.
+	NodePtr candidate = _TNULL;
+	RB_TREE_STAT(std::size_t depth = 0);
+	while (node != _TNULL)
 	{
-		NodePtr u = _get_single_child(root);
-		if (parent->left == root)
+		RB_TREE_STAT(++depth);
+		parent = node;
+		left = _less(key, _key(node));
+		if (left)
 		{
-			parent->left = u;
+			node = node->left;
 		}
 		else
 		{
-			parent->right = u;
+			candidate = node;
+			node = node->right;
 		}
+	}
+	RB_TREE_STAT(_stats.max_depth = std::max(_stats.max_depth, depth + 1));
+
+	if (candidate != _TNULL && !_less(_key(candidate), key)) return candidate;
+	return _TNULL;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Value>
+std::pair<typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr, bool> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_insert(Value&& value) {
+	_revive();
+	ParentPtr parent;
+	bool left;
+	NodePtr existing = _find_slot(KeyOfValue()(value), parent, left);
+	if (existing != _TNULL) return { existing, false };
+
+	NodePtr new_node = _create_node(parent, std::forward<Value>(value));
+	_link_parent_child(parent, new_node, left);
+	_insert_fix(new_node);
+
+	return { new_node, true };
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Key>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_key(const Key& key)
+{
+	// check if exists
+	NodePtr v = _find(_root, static_cast<const _lookup_key<Key>&>(key));
+	if (v == _TNULL) return;
+
+	_unlink(v);
+
+	// v is unlinked now, hand its storage back to the pool.
+	_destroy_node(v);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_unlink(NodePtr v)
+{
+	// both ends have at most one child, a step away.
+	if (v == _leftmost()) _leftmost() = _successor(v);
+	if (v == _rightmost()) _rightmost() = _predecessor(v);
+
+	NodePtr u = _remove(v);
+	_remove_fix(u, v);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove(NodePtr node)
+{
+	--_size;
 
-		u->parent = parent.get();
+	if (!_has_two_child(node))
+	{
+		if constexpr (OrderStatistics)
+		{
+			for (ParentPtr itr = node->parent(); itr != nullptr; itr = itr->parent()) --itr->size;
+		}
 
+		NodePtr u = _get_single_child(node);
+		_transplant(node, u);
 		return u;
 	}
 
-	if (key < root->data)
+	NodePtr successor = _rbminimum(node->right);
+	NodePtr u = successor->right;
+
+	if constexpr (OrderStatistics)
+	{
+		// the vacated position is the successor's, node is on its path.
+		for (ParentPtr itr = successor->parent(); itr != nullptr; itr = itr->parent()) --itr->size;
+		successor->size = node->size;
+	}
+
+	if (successor->parent() == node)
+	{
+		// u may be _TNULL, the fix-up still needs its parent.
+		u->set_parent(successor);
+	}
+	else
 	{
-		return _remove(root->left, root, key);
+		_transplant(successor, u);
+		successor->right = node->right;
+		successor->right->set_parent(successor);
 	}
 
-	return _remove(root->right, root, key);
+	_transplant(node, successor);
+	successor->left = node->left;
+	successor->left->set_parent(successor);
+
+	// the successor takes over the node color, the vacated position
+	// is the successor original one.
+	NodeColor color = successor->color();
+	successor->set_color(node->color());
+	node->set_color(color);
+
+	return u;
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_get_sibling(ParentPtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_transplant(NodePtr old, NodePtr node)
+{
+	ParentPtr parent = old->parent();
+	if (parent == nullptr)
+	{
+		_root = node;
+	}
+	else if (parent->left == old)
+	{
+		parent->left = node;
+	}
+	else
+	{
+		parent->right = node;
+	}
+
+	node->set_parent(parent);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_get_sibling(ParentPtr node)
 {
 	if (_is_root(node))
 	{
 		return nullptr;
 	}
 
-	if (node->parent->left.get() == node)
+	if (node->parent()->left == node)
 	{
-		return node->parent->right;
+		return node->parent()->right;
 	}
 
-	return node->parent->left;
+	return node->parent()->left;
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_get_single_child(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_get_single_child(NodePtr node)
 {
 	if (!is_terminal(node->left))
 	{
@@ -390,16 +3198,16 @@ std::shared_ptr<RBTreeNode<T>> RBTree<T>::_get_single_child(NodePtr node)
 	return node->right;
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_rbminimum(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_rbminimum(NodePtr node)
 {
 	NodePtr min_node = node;
 	while(!is_terminal(min_node->left)) min_node = min_node->left;
 	return min_node;
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_successor(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_successor(NodePtr node)
 {
 	if (!is_terminal(node->right))
 	{
@@ -409,28 +3217,28 @@ std::shared_ptr<RBTreeNode<T>> RBTree<T>::_successor(NodePtr node)
 	{
 		return _TNULL;
 	}
-	else if (node->parent->left == node)
+	else if (node->parent()->left == node)
 	{
-		return find(node->parent->data);
+		return node->parent();
 	}
 	else
 	{
-		RawNodePtr itr = node.get();
-		while(!_is_root(itr) && itr->parent->right.get() == itr) itr = itr->parent;
-		return _is_root(itr) ? _TNULL : find(itr->parent->data);
+		RawNodePtr itr = node;
+		while(!_is_root(itr) && itr->parent()->right == itr) itr = itr->parent();
+		return _is_root(itr) ? _TNULL : itr->parent();
 	}
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_rbmaximum(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_rbmaximum(NodePtr node)
 {
 	NodePtr max_node = node;
 	while(!is_terminal(max_node->right)) max_node = max_node->right;
 	return max_node;
 }
 
-template<typename T>
-std::shared_ptr<RBTreeNode<T>> RBTree<T>::_predecessor(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_predecessor(NodePtr node)
 {
 	if (!is_terminal(node->left))
 	{
@@ -440,93 +3248,239 @@ std::shared_ptr<RBTreeNode<T>> RBTree<T>::_predecessor(NodePtr node)
 	{
 		return _TNULL;
 	}
-	else if (node->parent->right == node)
+	else if (node->parent()->right == node)
 	{
-		return find(node->parent->data);
+		return node->parent();
 	}
 	else
 	{
-		RawNodePtr itr = node.get();
-		while(!_is_root(itr) && itr->parent->left.get() == itr) itr = itr->parent;
-		return _is_root(itr) ? _TNULL : find(itr->parent->data);
+		RawNodePtr itr = node;
+		while(!_is_root(itr) && itr->parent()->left == itr) itr = itr->parent();
+		return _is_root(itr) ? _TNULL : itr->parent();
 	}
 }
 
-template<typename T>
-void RBTree<T>::_link_parent_child(ParentPtr parent, NodePtr child) {
-	if (child->data < parent->data) {
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_link_parent_child(ParentPtr parent, NodePtr child, bool left) {
+	// set as root if first node to insert
+	if (parent == nullptr) {
+		_root = child;
+		_leftmost() = child;
+		_rightmost() = child;
+	}
+	else if (left) {
 		parent->left = child;
-		return;
+		if (parent == _leftmost()) _leftmost() = child;
+	}
+	else {
+		parent->right = child;
+		if (parent == _rightmost()) _rightmost() = child;
 	}
 
-	parent->right = child;
+	++_size;
+	if constexpr (OrderStatistics)
+	{
+		child->size = 1;
+		for (ParentPtr itr = parent; itr != nullptr; itr = itr->parent()) ++itr->size;
+	}
 }
 
-template<typename T>
-void RBTree<T>::_insert_fix(NodePtr node) {
-	if (_is_root(node)) {
-		node->color = NodeColor::BLACK;
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_insert_fix(NodePtr node) {
+	// state 00 moves the red violation two levels up, loop rather than
+	// recurse on the grandparent.
+	while (true)
+	{
+		if (_is_root(node)) {
+			_recolor(node, NodeColor::BLACK);
+			return;
+		}
+
+		if (_is_root(node->parent()) || node->parent()->color() == NodeColor::BLACK)
+		{
+			return;
+		}
+
+		// get the parent sibling node--i.e. uncle.
+		NodePtr parent_sibling = _get_sibling(node->parent());
+
+		if (parent_sibling->color() != NodeColor::RED)
+		{
+			// state 01: a parent sibling is black
+			return _insert_fix_state01(node);
+		}
+
+		// state 00: a parent sibling is red
+		node = _insert_fix_state00(node);
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix(NodePtr u, NodePtr v)
+{
+	if (_is_root(u)) {
+		_recolor(u, NodeColor::BLACK);
 		return;
 	}
 
-	if (_is_root(node->parent) || node->parent->color == NodeColor::BLACK)
+	if (_is_remove_fix_state000(u, v)) {
+		return _remove_fix_state000(u);
+	}
+
+	// state 100 passes the double black up to the parent, loop rather
+	// than recurse on it.
+	while (u != nullptr)
 	{
-		return;
+		u = _remove_fix_state001(u);
 	}
+}
 
-	// get the parent sibling node--i.e. uncle.
-	NodePtr parent_sibling = _get_sibling(node->parent);
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_dump_enter(std::ostream& out, std::ostream& escaped,
+	RBTreeDumpFormat format, NodePtr node, std::size_t depth, std::string& indent) const
+{
+	bool red = node->color() == NodeColor::RED;
+	bool right = depth == 0 || node->parent()->right == node;
 
-	if (parent_sibling->color == NodeColor::RED)
+	if (format == RBTreeDumpFormat::TEXT)
 	{
-		// state 00: a parent sibling is red
-		_insert_fix_state00(node);
+		// the indentation of the parent, then the bar of its right
+		// siblings if it is a left child itself.
+		indent.resize(3 * depth);
+		out << indent << (right ? "R----" : "L----");
+		_dump_key(out, escaped, format, node);
+		out << (red ? "(RED)\n" : "(BLACK)\n");
+		indent.append(right ? "   " : "|  ");
+	}
+	else if (format == RBTreeDumpFormat::DOT)
+	{
+		out << "  n" << static_cast<const void*>(node) << " [label=";
+		_dump_key(out, escaped, format, node);
+		out << (red ? ", color=red];\n" : ", color=black];\n");
+		if (depth > 0)
+		{
+			out << "  n" << static_cast<const void*>(node->parent())
+				<< " -> n" << static_cast<const void*>(node) << ";\n";
+		}
 	}
 	else
 	{
-		// state 01: a parent sibling is black
-		_insert_fix_state01(node);
+		if (depth > 0) out << (right ? ",\"right\":" : ",\"left\":");
+		out << "{\"key\":";
+		_dump_key(out, escaped, format, node);
+		out << (red ? ",\"color\":\"red\"" : ",\"color\":\"black\"");
 	}
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix(NodePtr u, NodePtr v)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_dump_leave(std::ostream& out,
+	RBTreeDumpFormat format, NodePtr node, std::size_t depth, bool cut, std::string& indent) const
 {
-	if (_is_remove_fix_state000(u, v)) {
-		return _remove_fix_state000(u);
+	if (format == RBTreeDumpFormat::TEXT)
+	{
+		if (cut)
+		{
+			indent.resize(3 * depth);
+			out << indent << (depth == 0 || node->parent()->right == node ? "   ..." : "|  ...") << '\n';
+		}
+	}
+	else if (format == RBTreeDumpFormat::DOT)
+	{
+		if (cut)
+		{
+			out << "  n" << static_cast<const void*>(node) << "_cut [label=\"...\", shape=plaintext];\n"
+				<< "  n" << static_cast<const void*>(node) << " -> n" << static_cast<const void*>(node) << "_cut;\n";
+		}
+	}
+	else
+	{
+		out << (cut ? ",\"cut\":true}" : "}");
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_dump_key(std::ostream& out, std::ostream& escaped,
+	RBTreeDumpFormat format, NodePtr node) const
+{
+	// characters and booleans are written as such by operator<<.
+	typedef typename std::decay<decltype(KeyOfValue()(node->data))>::type Key;
+	constexpr bool number = std::is_arithmetic<Key>::value && !std::is_same<Key, bool>::value
+		&& !std::is_same<Key, char>::value && !std::is_same<Key, signed char>::value
+		&& !std::is_same<Key, unsigned char>::value;
+	if (format == RBTreeDumpFormat::TEXT || (format == RBTreeDumpFormat::JSON && number))
+	{
+		out << KeyOfValue()(node->data);
+		return;
 	}
 
-	_remove_fix_state001(u);
+	out << '"';
+	escaped << KeyOfValue()(node->data);
+	out << '"';
 }
 
-template<typename T>
-void RBTree<T>::_print_tree(NodePtr root, std::string indent, bool last) {
-	if (root != _TNULL) {
-		std::cout << indent;
-		if (last) {
-		std::cout << "R----";
-		indent += "   ";
-		} else {
-		std::cout << "L----";
-		indent += "|  ";
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename Function>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_walk(Function fn) const
+{
+	if (_root == _TNULL) return true;
+
+	NodePtr node = _root;
+	std::size_t depth = 1;
+	std::size_t black = node->color() == NodeColor::BLACK;
+
+	// down to a child, checking its link back first.
+	auto descend = [&](NodePtr child) {
+		if (child->parent() != node) return false;
+		node = child;
+		++depth;
+		black += node->color() == NodeColor::BLACK;
+		return true;
+	};
+
+	while (true)
+	{
+		while (node->left != _TNULL)
+		{
+			if (!descend(node->left)) return fn(nullptr, depth, black);
 		}
 
-		std::string sColor = root->color == NodeColor::RED ? "RED" : "BLACK";
-		std::cout << root->data << "(" << sColor << ")" << std::endl;
-		_print_tree(root->left, indent, false);
-		_print_tree(root->right, indent, true);
+		// node is next in key order, then its right subtree if any.
+		bool next = fn(node, depth, black);
+		while (next)
+		{
+			if (node->right != _TNULL)
+			{
+				if (!descend(node->right)) return fn(nullptr, depth, black);
+				break;
+			}
+
+			// up until coming from a left child, whose parent is next.
+			NodePtr child;
+			do
+			{
+				child = node;
+				black -= node->color() == NodeColor::BLACK;
+				--depth;
+				node = node->parent();
+				if (node == nullptr) return true;
+			}
+			while (node->right == child);
+			next = fn(node, depth, black);
+		}
+		if (!next) return false;
 	}
 }
-
-template<typename T>
-void RBTree<T>::_rotate_left(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_rotate_left(NodePtr node)
 {
 	if (node->right == _TNULL) return;
+	RB_TREE_STAT(++_stats.rotations);
 
-	ParentPtr parent = node->parent;
+	ParentPtr parent = node->parent();
 	NodePtr pivot = node->right;
 
-	pivot->parent = parent;
+	pivot->set_parent(parent);
 	if (_is_root(node))
 	{
 		_root = pivot;
@@ -540,25 +3494,29 @@ void RBTree<T>::_rotate_left(NodePtr node)
 		parent->right = pivot;
 	}
 
-	node->parent = pivot.get();
+	node->set_parent(pivot);
 	node->right = pivot->left;
 	if (node->right != _TNULL)
 	{
-		node->right->parent = node.get();
+		node->right->set_parent(node);
 	}
 
 	pivot->left = node;
+
+	_update_size(node);
+	_update_size(pivot);
 }
 
-template<typename T>
-void RBTree<T>::_rotate_right(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_rotate_right(NodePtr node)
 {
 	if (node->left == _TNULL) return;
+	RB_TREE_STAT(++_stats.rotations);
 
-	ParentPtr parent = node->parent;
+	ParentPtr parent = node->parent();
 	NodePtr pivot = node->left;
 
-	pivot->parent = parent;
+	pivot->set_parent(parent);
 	if (_is_root(node))
 	{
 		_root = pivot;
@@ -572,45 +3530,38 @@ void RBTree<T>::_rotate_right(NodePtr node)
 		parent->right = pivot;
 	}
 
-	node->parent = pivot.get();
+	node->set_parent(pivot);
 	node->left = pivot->right;
 	if (node->left != _TNULL)
 	{
-		node->left->parent = node.get();
+		node->left->set_parent(node);
 	}
 
 	pivot->right = node;
-}
 
-template<typename T>
-void RBTree<T>::_swap_node(NodePtr v, NodePtr u)
-{
-	if (is_terminal(u))
-	{
-		return;
-	}
-	std::swap(v->data, u->data);
+	_update_size(node);
+	_update_size(pivot);
 }
 
-template<typename T>
-void RBTree<T>::_insert_fix_state00(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_insert_fix_state00(NodePtr node)
 {
-	NodePtr grand_parent = find(node->parent->parent->data);
-	NodePtr parent = grand_parent->left.get() == node->parent
-		? grand_parent->left
-		: grand_parent->right;
-	NodePtr parent_sibling = _get_sibling(parent.get());
+	RB_TREE_STAT(++_stats.insert_fix_state00);
+	NodePtr parent = node->parent();
+	NodePtr grand_parent = parent->parent();
+	NodePtr parent_sibling = _get_sibling(parent);
 
-	parent->color = NodeColor::BLACK;
-	parent_sibling->color = NodeColor::BLACK;
-	grand_parent->color = NodeColor::RED;
+	_recolor(parent, NodeColor::BLACK);
+	_recolor(parent_sibling, NodeColor::BLACK);
+	_recolor(grand_parent, NodeColor::RED);
 
-	_insert_fix(grand_parent);
+	return grand_parent;
 }
 
-template<typename T>
-void RBTree<T>::_insert_fix_state01(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_insert_fix_state01(NodePtr node)
 {
+	RB_TREE_STAT(++_stats.insert_fix_state01);
 	if (_is_insert_fix_state10(node))
 	{
 		// single rotation
@@ -621,12 +3572,13 @@ void RBTree<T>::_insert_fix_state01(NodePtr node)
 	_insert_fix_state11(node);
 }
 
-template<typename T>
-void RBTree<T>::_insert_fix_state10(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_insert_fix_state10(NodePtr node)
 {
-	NodePtr grand_parent = find(node->parent->parent->data);
+	RB_TREE_STAT(++_stats.insert_fix_state10);
+	NodePtr grand_parent = node->parent()->parent();
 
-	if (grand_parent->left->left == node)
+	if (grand_parent->left == node->parent())
 	{
 		_rotate_right(grand_parent);
 	}
@@ -636,17 +3588,18 @@ void RBTree<T>::_insert_fix_state10(NodePtr node)
 	}
 
 	// recolor parent and grandparent
-	_switch_color(node->parent);
-	_switch_color(grand_parent.get());
+	_switch_color(node->parent());
+	_switch_color(grand_parent);
 }
 
-template<typename T>
-void RBTree<T>::_insert_fix_state11(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_insert_fix_state11(NodePtr node)
 {
-	NodePtr grand_parent = find(node->parent->parent->data);
+	RB_TREE_STAT(++_stats.insert_fix_state11);
+	NodePtr grand_parent = node->parent()->parent();
 	NodePtr parent;
 
-	if (grand_parent->left->right == node)
+	if (grand_parent->left == node->parent())
 	{
 		parent = grand_parent->left;
 		_rotate_left(grand_parent->left);
@@ -660,42 +3613,46 @@ void RBTree<T>::_insert_fix_state11(NodePtr node)
 	_insert_fix_state10(parent);
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state000(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state000(NodePtr u)
 {
-	u->color = NodeColor::BLACK;
+	RB_TREE_STAT(++_stats.remove_fix_state000);
+	_recolor(u, NodeColor::BLACK);
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state001(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state001(NodePtr u)
 {
-	NodePtr sibling = _get_sibling(u.get());
+	RB_TREE_STAT(++_stats.remove_fix_state001);
+	NodePtr sibling = _get_sibling(u);
 
-	if (sibling->color == NodeColor::BLACK)
+	if (sibling->color() == NodeColor::BLACK)
 	{
 		return _remove_fix_state010(u);
 	}
 
-	_remove_fix_state111(u);
+	return _remove_fix_state111(u);
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state010(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state010(NodePtr u)
 {
-	NodePtr sibling = _get_sibling(u.get());
+	RB_TREE_STAT(++_stats.remove_fix_state010);
+	NodePtr sibling = _get_sibling(u);
 
 	if (_has_red_child(sibling))
 	{
 		return _remove_fix_state011(u);
 	}
 
-	_remove_fix_state100(u);
+	return _remove_fix_state100(u);
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state011(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state011(NodePtr u)
 {
-	NodePtr sibling = _get_sibling(u.get());
+	RB_TREE_STAT(++_stats.remove_fix_state011);
+	NodePtr sibling = _get_sibling(u);
 	// RR or LL case
 	if (_is_remove_fix_state101(sibling))
 	{
@@ -703,42 +3660,45 @@ void RBTree<T>::_remove_fix_state011(NodePtr u)
 	}
 
 	// LR or RL case
-	_remove_fix_state110(u);
+	return _remove_fix_state110(u);
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state100(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state100(NodePtr u)
 {
+	RB_TREE_STAT(++_stats.remove_fix_state100);
 	// base case in case the recoloring required recursive fix.
-	if (_is_root(u.get()))
+	if (_is_root(u))
 	{
-		return;
+		return nullptr;
 	}
 
-	NodePtr parent = find(u->parent->data);
-	NodePtr sibling = _get_sibling(u.get());
+	NodePtr parent = u->parent();
+	NodePtr sibling = _get_sibling(u);
 
 	// color u black and sibling red
-	u->color = NodeColor::BLACK;
-	sibling->color = NodeColor::RED;
+	_recolor(u, NodeColor::BLACK);
+	_recolor(sibling, NodeColor::RED);
 
-	if (_is_root(parent.get()) || parent->color == NodeColor::RED)
+	if (_is_root(parent) || parent->color() == NodeColor::RED)
 	{
-		parent->color = NodeColor::BLACK;
-		return;
+		_recolor(parent, NodeColor::BLACK);
+		return nullptr;
 	}
 
-	// parent becomes double black, fix it.
-	_remove_fix_state100(parent);
+	// parent becomes double black, its sibling can be in any state
+	// so the caller restarts the double black fix from the top.
+	return parent;
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state101(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state101(NodePtr u)
 {
-	NodePtr parent = find(u->parent->data);
-	NodePtr sibling = _get_sibling(u.get());
+	RB_TREE_STAT(++_stats.remove_fix_state101);
+	NodePtr parent = u->parent();
+	NodePtr sibling = _get_sibling(u);
 	NodePtr red_child;
-	if (parent->right == sibling && sibling->right->color == NodeColor::RED)
+	if (parent->right == sibling && sibling->right->color() == NodeColor::RED)
 	{
 		// RR
 		red_child = sibling->right;
@@ -752,46 +3712,48 @@ void RBTree<T>::_remove_fix_state101(NodePtr u)
 	}
 
 	// color the sibling the original parent color.
-	sibling->color = parent->color;
+	_recolor(sibling, parent->color());
 
-	parent->color = NodeColor::BLACK;
-	red_child->color = NodeColor::BLACK;
+	_recolor(parent, NodeColor::BLACK);
+	_recolor(red_child, NodeColor::BLACK);
+	return nullptr;
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state110(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state110(NodePtr u)
 {
-	NodePtr parent = find(u->parent->data);
-	NodePtr sibling = _get_sibling(u.get());
+	RB_TREE_STAT(++_stats.remove_fix_state110);
+	NodePtr sibling = _get_sibling(u);
 
-	if (sibling->left->color == NodeColor::RED)
+	if (sibling->left->color() == NodeColor::RED)
 	{
 		// RL
-		sibling->left->color = NodeColor::BLACK;
+		_recolor(sibling->left, NodeColor::BLACK);
 		_rotate_right(sibling);
 	}
 	else
 	{
 		// LR
-		sibling->right->color = NodeColor::BLACK;
+		_recolor(sibling->right, NodeColor::BLACK);
 		_rotate_left(sibling);
 	}
 
-	sibling->color = NodeColor::RED;
+	_recolor(sibling, NodeColor::RED);
 	
 	// Recurse for fixing RR or LL
-	_remove_fix_state101(u);
+	return _remove_fix_state101(u);
 }
 
-template<typename T>
-void RBTree<T>::_remove_fix_state111(NodePtr u)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_remove_fix_state111(NodePtr u)
 {
-	NodePtr parent = find(u->parent->data);
-	NodePtr sibling = _get_sibling(u.get());
+	RB_TREE_STAT(++_stats.remove_fix_state111);
+	NodePtr parent = u->parent();
+	NodePtr sibling = _get_sibling(u);
 
 	// recolor
-	sibling->color = NodeColor::BLACK;
-	parent->color = NodeColor::RED;
+	_recolor(sibling, NodeColor::BLACK);
+	_recolor(parent, NodeColor::RED);
 
 	// rotate the parent in the other direction of red sibling
 	if (parent->left == sibling)
@@ -805,66 +3767,172 @@ void RBTree<T>::_remove_fix_state111(NodePtr u)
 
 	// we endup in one of the double black situation where the sibling
 	// is black, so, we call state010.
-	_remove_fix_state010(u);
+	return _remove_fix_state010(u);
 }
 
-template<typename T>
-void RBTree<T>::_switch_color(RawNodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_switch_color(RawNodePtr node)
 {
-	if (node->color == NodeColor::RED)
+	RB_TREE_STAT(++_stats.recolors);
+	if (node->color() == NodeColor::RED)
 	{
-		node->color = NodeColor::BLACK;
+		node->set_color(NodeColor::BLACK);
 		return;
 	}
 
-	node->color = NodeColor::RED;
+	node->set_color(NodeColor::RED);
 }
 
-template<typename T>
-bool RBTree<T>::_is_root(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_is_root(NodePtr node)
 {
-	return node->parent == nullptr;
+	return node->parent() == nullptr;
 }
 
-template<typename T>
-bool RBTree<T>::_is_root(RawNodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_is_insert_fix_state10(NodePtr node)
 {
-	return node->parent == nullptr;
+	ParentPtr parent = node->parent();
+	ParentPtr grand_parent = parent->parent();
+	return (grand_parent->left == parent && parent->left == node)
+		|| (grand_parent->right == parent && parent->right == node);
 }
 
-template<typename T>
-bool RBTree<T>::_is_insert_fix_state10(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_is_remove_fix_state101(NodePtr node)
 {
-	ParentPtr grand_parent = node->parent->parent;
-	return grand_parent->left->left == node
-		|| grand_parent->right->right == node;
+	ParentPtr parent = node->parent();
+	return parent->right == node && node->right->color() == NodeColor::RED
+		|| parent->left == node && node->left->color() == NodeColor::RED;
 }
 
-template<typename T>
-bool RBTree<T>::_is_remove_fix_state101(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_is_remove_fix_state000(NodePtr u, NodePtr v)
 {
-	ParentPtr parent = node->parent;
-	return parent->right == node && node->right->color == NodeColor::RED
-		|| parent->left == node && node->left->color == NodeColor::RED;
+	return u->color() == NodeColor::RED || v->color() == NodeColor::RED;
 }
 
-template<typename T>
-bool RBTree<T>::_is_remove_fix_state000(NodePtr u, NodePtr v)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_has_two_child(NodePtr node)
 {
-	return u->color == NodeColor::RED || v->color == NodeColor::RED;
+	return !is_terminal(node->left) && !is_terminal(node->right);
 }
 
-template<typename T>
-bool RBTree<T>::_has_two_child(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+bool RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_has_red_child(NodePtr node)
 {
-	return !is_terminal(node->left) && !is_terminal(node->right);
+	return node->left->color() == NodeColor::RED ||
+		node->right->color() == NodeColor::RED;
 }
 
-template<typename T>
-bool RBTree<T>::_has_red_child(NodePtr node)
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_create_sentinel()
+{
+	// the terminal node never holds a value, its links point back to
+	// itself.
+	NodePtr sentinel = _pool->terminal();
+	sentinel->left = sentinel;
+	sentinel->right = sentinel;
+	return sentinel;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+template<typename... Args>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_create_node(ParentPtr parent, Args&&... args)
 {
-	return node->left->color == NodeColor::RED ||
-		node->right->color == NodeColor::RED;
+	NodePtr node = ::new (static_cast<void*>(_pool->allocate())) Node();
+	try
+	{
+		::new (static_cast<void*>(std::addressof(node->data))) T(std::forward<Args>(args)...);
+	}
+	catch (...)
+	{
+		node->~Node();
+		_pool->deallocate(node);
+		throw;
+	}
+
+	RB_TREE_STAT(++_stats.allocations);
+	node->left = _TNULL;
+	node->right = _TNULL;
+	node->set_parent(parent);
+	node->set_color(NodeColor::RED);
+	return node;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_destroy_node(NodePtr node)
+{
+	node->data.~T();
+	node->~Node();
+	_pool->deallocate(node);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+typename RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::NodePtr RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_clone(NodePtr root, NodePtr tnull, ParentPtr parent)
+{
+	if (root == tnull) return _TNULL;
+
+	NodePtr node = _create_node(parent, root->data);
+	node->set_color(root->color());
+	node->left = _clone(root->left, tnull, node);
+	node->right = _clone(root->right, tnull, node);
+	_update_size(node);
+	return node;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+std::size_t RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::_destroy(NodePtr root, bool deallocate)
+{
+	// the pool releases the storage, only destructors have to run.
+	if (!deallocate && std::is_trivially_destructible<T>::value) return 0;
+
+	std::size_t count = 0;
+	NodePtr node = root;
+	ParentPtr stop = is_terminal(root) ? nullptr : root->parent();
+	while (!is_terminal(node))
+	{
+		if (!is_terminal(node->left))
+		{
+			node = node->left;
+			continue;
+		}
+		if (!is_terminal(node->right))
+		{
+			node = node->right;
+			continue;
+		}
+
+		ParentPtr parent = node->parent();
+		if (parent != stop)
+		{
+			if (parent->left == node) parent->left = _TNULL;
+			else parent->right = _TNULL;
+		}
+
+		node->data.~T();
+		node->~Node();
+		if (deallocate) _pool->deallocate(node);
+		++count;
+		node = parent != stop ? parent : _TNULL;
+	}
+
+	return count;
 }
 
+/**
+ * @brief Set with order statistics: select() and rank() in O(log n).
+ */
+template<typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+using RBOrderStatTree = RBTree<T, Compare, Allocator, RBTreeIdentity<T>, true>;
+
+#ifndef SWIG
+
+// freeze(), save() and load() need the complete class, their headers come
+// last so that including this one is enough to call them.
+#include "rbtree_frozen.hpp"
+#include "rbtree_io.hpp"
+
+#endif
+
 #endif // RB_TREE
\ No newline at end of file
@@ -0,0 +1,325 @@
+#ifndef SWIG
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#endif
+
+#include "rbtree_persistent.hpp"
+
+#ifndef RB_TREE_CONCURRENT
+#define RB_TREE_CONCURRENT
+
+/**
+ * @brief Red-black tree read by any number of threads without locking
+ * 		while writers take turns.
+ *
+ * Writers serialize on a mutex and build the next version of the tree by
+ * path copying, see RBPersistentTree, then publish its root with a single
+ * atomic store. Published nodes never change, so a reader walks whichever
+ * version it loaded without synchronizing with anyone.
+ *
+ * Replaced versions are retired instead of being freed. Readers announce
+ * themselves in the counter of the current epoch parity, spread over
+ * cache-line sized stripes so that they do not share a line with readers
+ * on other cores. Once enough versions are retired, the writer moves to
+ * the next epoch, waits for the readers counted under the previous one to
+ * leave and frees the retired versions. Readers never wait.
+ *
+ * Values handed out by readers are only valid inside the visitor they are
+ * given to.
+ *
+ * @tparam T Stored value type, copied along with the nodes.
+ * @tparam Compare Strict weak ordering of the keys.
+ * @tparam Allocator Allocator the nodes are obtained from.
+ * @tparam KeyOfValue Extracts the key out of a stored value.
+ */
+template<typename T,
+	typename Compare = std::less<typename RBTreeIdentity<T>::key_type>,
+	typename Allocator = std::allocator<T>,
+	typename KeyOfValue = RBTreeIdentity<T>>
+class RBConcurrentTree
+{
+public:
+	typedef RBPersistentTree<T, Compare, Allocator, KeyOfValue> Version;
+	typedef typename Version::NodePtr NodePtr;
+	typedef typename Version::key_type key_type;
+
+	explicit RBConcurrentTree(const Compare& compare = Compare(), const Allocator& alloc = Allocator())
+		: _compare(compare), _current(compare, alloc), _stripes(_stripe_count()) {}
+
+	RBConcurrentTree(const RBConcurrentTree&) = delete;
+	RBConcurrentTree& operator=(const RBConcurrentTree&) = delete;
+
+	/**
+	 * @brief No reader or writer may be left.
+	 */
+	~RBConcurrentTree() = default;
+
+	/**
+	 * @brief Lock-free lookup.
+	 */
+	bool contains(const key_type& key) const;
+
+	/**
+	 * @brief Lock-free lookup calling visitor on the value stored under
+	 * 		key, if any.
+	 *
+	 * @return bool Whether key is stored.
+	 */
+	template<typename Visitor>
+	bool find(const key_type& key, Visitor visitor) const;
+
+	/**
+	 * @brief Lock-free in-order walk of a single version of the tree,
+	 * 		writes published meanwhile are not seen.
+	 */
+	template<typename Visitor>
+	void for_each(Visitor visitor) const;
+
+	/**
+	 * @brief Insert value unless its key is already stored. Writers are
+	 * 		serialized.
+	 *
+	 * @return bool Whether the insertion took place.
+	 */
+	bool insert(const T& value) { return _insert_value(value); }
+	bool insert(T&& value) { return _insert_value(std::move(value)); }
+
+	/**
+	 * @brief Remove key if it is stored. Writers are serialized.
+	 *
+	 * @return bool Whether a value was removed.
+	 */
+	bool remove(const key_type& key);
+
+	/**
+	 * @brief Point-in-time copy of the tree in O(1), which stays readable
+	 * 		from any thread while writes go on here.
+	 */
+	Version snapshot();
+
+	/**
+	 * @brief Make snapshot the current version, as a single write.
+	 */
+	void restore(const Version& snapshot);
+
+	/**
+	 * @brief Free every retired version, waiting for the readers that may
+	 * 		still walk one of them.
+	 */
+	void synchronize();
+
+	std::size_t size() const { return _size.load(std::memory_order_relaxed); }
+	bool empty() const { return size() == 0; }
+
+private:
+	// versions retired before the writer waits for a grace period.
+	static constexpr std::size_t _retire_batch = 64;
+
+	struct alignas(64) _Stripe
+	{
+		// readers inside, by epoch parity.
+		std::atomic<std::size_t> readers[2] = { { 0 }, { 0 } };
+	};
+
+	/**
+	 * @brief Registers a reader in its stripe for as long as it lives.
+	 */
+	class _ReadGuard
+	{
+	public:
+		explicit _ReadGuard(const RBConcurrentTree& tree);
+		~_ReadGuard();
+
+		_ReadGuard(const _ReadGuard&) = delete;
+		_ReadGuard& operator=(const _ReadGuard&) = delete;
+
+	private:
+		_Stripe& _stripe;
+		std::size_t _parity;
+	};
+
+	static std::size_t _stripe_count();
+	static std::size_t _thread_index();
+
+	template<typename Value>
+	bool _insert_value(Value&& value);
+
+	/**
+	 * @brief Publish the root of _current, retiring the version before.
+	 */
+	void _publish(Version&& retired);
+
+	/**
+	 * @brief Wait for a grace period and free the retired versions. The
+	 * 		write lock must be held.
+	 */
+	void _reclaim();
+
+	Compare _compare;
+	std::mutex _write;
+	Version _current;
+	std::vector<Version> _retired;
+	std::atomic<NodePtr> _root { nullptr };
+	std::atomic<std::size_t> _size { 0 };
+	std::atomic<std::size_t> _epoch { 0 };
+	mutable std::vector<_Stripe> _stripes;
+};
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+bool RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::contains(const key_type& key) const
+{
+	_ReadGuard guard(*this);
+	return Version::_find(_root.load(std::memory_order_acquire), key, _compare) != nullptr;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Visitor>
+bool RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::find(const key_type& key, Visitor visitor) const
+{
+	_ReadGuard guard(*this);
+	NodePtr node = Version::_find(_root.load(std::memory_order_acquire), key, _compare);
+	if (node == nullptr) return false;
+
+	visitor(static_cast<const T&>(node->data));
+	return true;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Visitor>
+void RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::for_each(Visitor visitor) const
+{
+	_ReadGuard guard(*this);
+	Version::_for_each(_root.load(std::memory_order_acquire), visitor);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+bool RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::remove(const key_type& key)
+{
+	std::lock_guard<std::mutex> lock(_write);
+	if (_retired.size() == _retired.capacity()) _retired.reserve(2 * _retired.size() + 1);
+
+	// the retired copy keeps the nodes readers may be walking alive.
+	Version retired(_current);
+	if (!_current.remove(key)) return false;
+
+	_publish(std::move(retired));
+	return true;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::Version RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::snapshot()
+{
+	// the version has to be counted before a writer may retire it.
+	std::lock_guard<std::mutex> lock(_write);
+	return _current.snapshot();
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::restore(const Version& snapshot)
+{
+	std::lock_guard<std::mutex> lock(_write);
+	if (_retired.size() == _retired.capacity()) _retired.reserve(2 * _retired.size() + 1);
+
+	Version retired(_current);
+	_current.restore(snapshot);
+	_publish(std::move(retired));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::synchronize()
+{
+	std::lock_guard<std::mutex> lock(_write);
+	_reclaim();
+}
+
+/*******************
+ * PRIVATE HELPERS *
+ *******************/
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::_ReadGuard::_ReadGuard(const RBConcurrentTree& tree)
+	: _stripe(tree._stripes[_thread_index() & (tree._stripes.size() - 1)])
+{
+	while (true)
+	{
+		std::size_t epoch = tree._epoch.load(std::memory_order_seq_cst);
+		_parity = epoch & 1;
+		_stripe.readers[_parity].fetch_add(1, std::memory_order_seq_cst);
+
+		// a writer moving on in between may not have seen the count.
+		if (tree._epoch.load(std::memory_order_seq_cst) == epoch) return;
+		_stripe.readers[_parity].fetch_sub(1, std::memory_order_release);
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::_ReadGuard::~_ReadGuard()
+{
+	_stripe.readers[_parity].fetch_sub(1, std::memory_order_release);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::_stripe_count()
+{
+	// a power of two, at least one stripe per hardware thread.
+	std::size_t count = 1;
+	while (count < std::thread::hardware_concurrency()) count *= 2;
+	return count;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::_thread_index()
+{
+	static std::atomic<std::size_t> next { 0 };
+	thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+	return index;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Value>
+bool RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::_insert_value(Value&& value)
+{
+	std::lock_guard<std::mutex> lock(_write);
+	if (_retired.size() == _retired.capacity()) _retired.reserve(2 * _retired.size() + 1);
+
+	Version retired(_current);
+	if (!_current.insert(std::forward<Value>(value))) return false;
+
+	_publish(std::move(retired));
+	return true;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::_publish(Version&& retired)
+{
+	_root.store(_current.get_root(), std::memory_order_seq_cst);
+	_size.store(_current.size(), std::memory_order_relaxed);
+
+	// capacity was reserved up front, retiring cannot throw.
+	_retired.push_back(std::move(retired));
+	if (_retired.size() >= _retire_batch) _reclaim();
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBConcurrentTree<T, Compare, Allocator, KeyOfValue>::_reclaim()
+{
+	// readers entering from now on see the epoch moved on and can only
+	// load the current root, the previous parity drains out.
+	std::size_t parity = _epoch.fetch_add(1, std::memory_order_seq_cst) & 1;
+	for (_Stripe& stripe: _stripes)
+	{
+		while (stripe.readers[parity].load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+	}
+
+	_retired.clear();
+}
+
+#endif // RB_TREE_CONCURRENT
@@ -0,0 +1,318 @@
+#ifndef SWIG
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#endif
+
+#include "rbtree.hpp"
+
+#ifndef RB_TREE_FROZEN
+#define RB_TREE_FROZEN
+
+/**
+ * @brief Read-only set of unique keys in Eytzinger order, built by
+ * 		RBTree::freeze() for trees that are only queried from then on.
+ *
+ * The values form a complete binary search tree stored level by level in
+ * one array, the children of slot k being slots 2k and 2k + 1. There are
+ * no links, a value takes sizeof(T) bytes. The top levels, which every
+ * lookup visits, share a few cache lines. A lookup moves to child
+ * 2k + (value < key) and never branches on a comparison. On its way it
+ * prefetches the line holding the descendants a line's worth of slots
+ * below, so the misses of successive levels overlap instead of queueing
+ * up.
+ *
+ * Lookups return a pointer to the value found, or nullptr.
+ *
+ * @tparam T Stored value type, copied out of the tree.
+ * @tparam Compare Strict weak ordering of the keys.
+ * @tparam Allocator Allocator the array is obtained from.
+ * @tparam KeyOfValue Extracts the key out of a stored value.
+ */
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+class FrozenIndex
+{
+public:
+	typedef T value_type;
+	typedef typename KeyOfValue::key_type key_type;
+
+	explicit FrozenIndex(const Compare& compare = Compare(), const Allocator& alloc = Allocator())
+		: _compare(compare), _alloc(alloc) {}
+
+	/**
+	 * @brief Index a sorted range of values with unique keys.
+	 */
+	template<typename ForwardIt, typename = typename std::iterator_traits<ForwardIt>::iterator_category>
+	FrozenIndex(ForwardIt first, ForwardIt last,
+		const Compare& compare = Compare(), const Allocator& alloc = Allocator())
+		: FrozenIndex(first, std::distance(first, last), compare, alloc) {}
+
+	FrozenIndex(const FrozenIndex& other);
+
+	FrozenIndex(FrozenIndex&& other) : FrozenIndex(other._compare, other._alloc) {
+		swap(other);
+	}
+
+	FrozenIndex& operator=(FrozenIndex other) {
+		swap(other);
+		return *this;
+	}
+
+	~FrozenIndex();
+
+	/**
+	 * @return const T* The value stored under key, or nullptr.
+	 */
+	const T* find(const key_type& key) const;
+
+	bool contains(const key_type& key) const { return find(key) != nullptr; }
+
+	/**
+	 * @return const T* The value of the least key not less than key, or
+	 * 		nullptr if there is none.
+	 */
+	const T* lower_bound(const key_type& key) const;
+
+	/**
+	 * @return const T* The value of the least key greater than key, or
+	 * 		nullptr if there is none.
+	 */
+	const T* upper_bound(const key_type& key) const;
+
+	void swap(FrozenIndex& other) noexcept;
+
+	bool empty() const { return _size == 0; }
+	std::size_t size() const { return _size; }
+
+private:
+	template<typename, typename, typename, typename, bool>
+	friend class RBTree;
+
+	static constexpr std::size_t _line_size = alignof(T) > 64 ? alignof(T) : 64;
+
+	struct alignas(_line_size) _Line
+	{
+		unsigned char bytes[_line_size];
+	};
+
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<_Line> _LineAllocator;
+
+	// slots one line's worth of levels down, prefetched by lookups.
+	static constexpr std::size_t _fanout = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+	/**
+	 * @brief Index size values read one by one from first, in order.
+	 */
+	template<typename InputIt>
+	FrozenIndex(InputIt first, std::size_t size, const Compare& compare, const Allocator& alloc);
+
+	/**
+	 * @brief Fill the slots in key order with values pulled from next.
+	 */
+	template<typename Next>
+	void _build(std::size_t size, Next next);
+
+	/**
+	 * @brief Slot the walk ends on: that of the least key not less than
+	 * 		key, or greater than key if Upper is set. 0 past the end.
+	 */
+	template<bool Upper>
+	std::size_t _descend(const key_type& key) const;
+
+	/**
+	 * @brief First slot in key order among size slots.
+	 */
+	static std::size_t _first_slot(std::size_t size);
+
+	/**
+	 * @brief Slot following slot in key order.
+	 */
+	static std::size_t _next_slot(std::size_t slot, std::size_t size);
+
+	static std::size_t _trailing_ones(std::size_t slot);
+
+	T* _slots() const { return std::launder(reinterpret_cast<T*>(_lines)); }
+	std::size_t _line_count() const { return ((_size + 1) * sizeof(T) + _line_size - 1) / _line_size; }
+
+	Compare _compare;
+	Allocator _alloc;
+	// slot 0 is left unused so that the children of k are 2k and 2k + 1.
+	_Line* _lines = nullptr;
+	std::size_t _size = 0;
+};
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename InputIt>
+FrozenIndex<T, Compare, Allocator, KeyOfValue>::FrozenIndex(InputIt first, std::size_t size,
+	const Compare& compare, const Allocator& alloc)
+	: FrozenIndex(compare, alloc)
+{
+	_build(size, [&first]() -> decltype(auto) {
+		decltype(auto) value = *first;
+		++first;
+		return value;
+	});
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+FrozenIndex<T, Compare, Allocator, KeyOfValue>::FrozenIndex(const FrozenIndex& other)
+	: FrozenIndex(other._compare, other._alloc)
+{
+	std::size_t slot = _first_slot(other._size);
+	_build(other._size, [&other, &slot]() -> const T& {
+		const T& value = other._slots()[slot];
+		slot = _next_slot(slot, other._size);
+		return value;
+	});
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+FrozenIndex<T, Compare, Allocator, KeyOfValue>::~FrozenIndex()
+{
+	if (_lines == nullptr) return;
+
+	std::destroy(_slots() + 1, _slots() + _size + 1);
+	_LineAllocator alloc(_alloc);
+	std::allocator_traits<_LineAllocator>::deallocate(alloc, _lines, _line_count());
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+const T* FrozenIndex<T, Compare, Allocator, KeyOfValue>::find(const key_type& key) const
+{
+	std::size_t slot = _descend<false>(key);
+	if (slot == 0 || _compare(key, KeyOfValue()(_slots()[slot]))) return nullptr;
+	return _slots() + slot;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+const T* FrozenIndex<T, Compare, Allocator, KeyOfValue>::lower_bound(const key_type& key) const
+{
+	std::size_t slot = _descend<false>(key);
+	return slot == 0 ? nullptr : _slots() + slot;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+const T* FrozenIndex<T, Compare, Allocator, KeyOfValue>::upper_bound(const key_type& key) const
+{
+	std::size_t slot = _descend<true>(key);
+	return slot == 0 ? nullptr : _slots() + slot;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void FrozenIndex<T, Compare, Allocator, KeyOfValue>::swap(FrozenIndex& other) noexcept
+{
+	std::swap(_compare, other._compare);
+	std::swap(_alloc, other._alloc);
+	std::swap(_lines, other._lines);
+	std::swap(_size, other._size);
+}
+
+/*******************
+ * PRIVATE HELPERS *
+ *******************/
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Next>
+void FrozenIndex<T, Compare, Allocator, KeyOfValue>::_build(std::size_t size, Next next)
+{
+	if (size == 0) return;
+
+	_size = size;
+	_LineAllocator alloc(_alloc);
+	_lines = std::allocator_traits<_LineAllocator>::allocate(alloc, _line_count());
+
+	std::size_t built = 0;
+	try
+	{
+		for (std::size_t slot = _first_slot(size); built < size; slot = _next_slot(slot, size), ++built)
+		{
+			::new (static_cast<void*>(_slots() + slot)) T(next());
+		}
+	}
+	catch (...)
+	{
+		// the values built so far took the first slots in key order.
+		for (std::size_t slot = _first_slot(size); built > 0; slot = _next_slot(slot, size), --built)
+		{
+			_slots()[slot].~T();
+		}
+		std::allocator_traits<_LineAllocator>::deallocate(alloc, _lines, _line_count());
+		_lines = nullptr;
+		_size = 0;
+		throw;
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<bool Upper>
+std::size_t FrozenIndex<T, Compare, Allocator, KeyOfValue>::_descend(const key_type& key) const
+{
+	const T* slots = _slots();
+	std::size_t slot = 1;
+	while (slot <= _size)
+	{
+#ifdef __GNUC__
+		if constexpr (_fanout > 1)
+		{
+			// the descendants _fanout slots wide share a line, computed
+			// as an address since it may lie past the array.
+			__builtin_prefetch(reinterpret_cast<const void*>(
+				reinterpret_cast<std::uintptr_t>(slots) + slot * _fanout * sizeof(T)));
+		}
+#endif
+		const key_type& probe = KeyOfValue()(slots[slot]);
+		slot = 2 * slot + (Upper ? !_compare(key, probe) : _compare(probe, key));
+	}
+
+	// cancel the right turns below the last left one, then that one.
+	return slot >> (_trailing_ones(slot) + 1);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t FrozenIndex<T, Compare, Allocator, KeyOfValue>::_first_slot(std::size_t size)
+{
+	std::size_t slot = 1;
+	while (2 * slot <= size) slot *= 2;
+	return slot;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t FrozenIndex<T, Compare, Allocator, KeyOfValue>::_next_slot(std::size_t slot, std::size_t size)
+{
+	if (2 * slot + 1 <= size)
+	{
+		// leftmost slot of the right subtree.
+		slot = 2 * slot + 1;
+		while (2 * slot <= size) slot *= 2;
+		return slot;
+	}
+
+	// up to the first ancestor reached from its left subtree.
+	return slot >> (_trailing_ones(slot) + 1);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+std::size_t FrozenIndex<T, Compare, Allocator, KeyOfValue>::_trailing_ones(std::size_t slot)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(~static_cast<unsigned long long>(slot));
+#else
+	std::size_t ones = 0;
+	for (; slot & 1; slot >>= 1) ++ones;
+	return ones;
+#endif
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+FrozenIndex<T, Compare, Allocator, KeyOfValue> RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::freeze() const
+{
+	return FrozenIndex<T, Compare, Allocator, KeyOfValue>(cbegin(), size(), _compare, _pool->get_allocator());
+}
+
+#endif // RB_TREE_FROZEN
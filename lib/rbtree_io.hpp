@@ -0,0 +1,370 @@
+#ifndef SWIG
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RB_TREE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#endif
+
+#include "rbtree.hpp"
+
+#ifndef RB_TREE_IO
+#define RB_TREE_IO
+
+/**
+ * @brief Leading block of a file written by RBTree::save(), followed by
+ * 		the count values in increasing key order, as raw bytes.
+ *
+ * It is 64 bytes long so that the values of a mapped file are aligned.
+ * Files are only read back by builds of the same byte order and value
+ * size, and the version is bumped whenever the layout changes.
+ */
+struct RBTreeFileHeader
+{
+	static constexpr char signature[8] = { 'R', 'B', 'T', 'R', 'E', 'E', '\0', '\0' };
+	static constexpr std::uint32_t current_version = 1;
+	static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byte_order;
+	std::uint32_t value_size;
+	std::uint32_t value_alignment;
+	std::uint64_t count;
+	unsigned char reserved[32];
+
+	template<typename T>
+	static RBTreeFileHeader describe(std::uint64_t count)
+	{
+		RBTreeFileHeader header = {};
+		std::memcpy(header.magic, signature, sizeof(signature));
+		header.version = current_version;
+		header.byte_order = byte_order_mark;
+		header.value_size = sizeof(T);
+		header.value_alignment = alignof(T);
+		header.count = count;
+		return header;
+	}
+
+	/**
+	 * @brief Make sure a file of file_size bytes starting with this header
+	 * 		holds values of type T.
+	 *
+	 * @throws std::runtime_error naming path and what is wrong.
+	 */
+	template<typename T>
+	void check(std::uint64_t file_size, const std::string& path) const
+	{
+		if (file_size < sizeof(RBTreeFileHeader) || std::memcmp(magic, signature, sizeof(signature)) != 0)
+		{
+			throw std::runtime_error(path + ": not a tree file");
+		}
+		if (version != current_version)
+		{
+			throw std::runtime_error(path + ": unsupported version " + std::to_string(version));
+		}
+		if (byte_order != byte_order_mark)
+		{
+			throw std::runtime_error(path + ": written with another byte order");
+		}
+		if (value_size != sizeof(T) || value_alignment != alignof(T))
+		{
+			throw std::runtime_error(path + ": written for another value type");
+		}
+		if ((file_size - sizeof(RBTreeFileHeader)) / sizeof(T) != count
+			|| (file_size - sizeof(RBTreeFileHeader)) % sizeof(T) != 0)
+		{
+			throw std::runtime_error(path + ": truncated");
+		}
+	}
+};
+
+static_assert(sizeof(RBTreeFileHeader) == 64, "the values of a mapped file start on a cache line");
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::save(const std::string& path) const
+{
+	static_assert(std::is_trivially_copyable<T>::value, "values are saved as raw bytes");
+	static_assert(alignof(T) <= sizeof(RBTreeFileHeader), "values of a mapped file are aligned to the header");
+
+	// written aside and renamed, so that path is never left half written.
+	// The temporary file sits next to path, a rename is only atomic
+	// within one filesystem, and has a name of its own so that
+	// concurrent saves do not write to the same one.
+	std::string temporary = path + ".XXXXXX";
+#ifdef RB_TREE_MMAP
+	int fd = ::mkstemp(&temporary[0]);
+	if (fd < 0) throw std::runtime_error(path + ": cannot create a temporary file");
+	// mkstemp() makes it private, saved files are readable as before.
+	::fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	::close(fd);
+#else
+	temporary.replace(temporary.size() - 6, 6, "tmp");
+#endif
+	std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error(temporary + ": cannot open");
+	}
+
+	RBTreeFileHeader header = RBTreeFileHeader::describe<T>(size());
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// a block of values per write call instead of one.
+	std::vector<char> block;
+	block.reserve(1 << 16);
+	for (const T& value: *this)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		block.insert(block.end(), bytes, bytes + sizeof(T));
+		if (block.size() + sizeof(T) > block.capacity())
+		{
+			out.write(block.data(), block.size());
+			block.clear();
+		}
+	}
+	out.write(block.data(), block.size());
+	out.close();
+
+	if (!out || std::rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error(path + ": cannot write");
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue, bool OrderStatistics>
+void RBTree<T, Compare, Allocator, KeyOfValue, OrderStatistics>::load(const std::string& path)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "values are loaded as raw bytes");
+
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in) throw std::runtime_error(path + ": cannot open");
+
+	std::uint64_t file_size = static_cast<std::uint64_t>(in.tellg());
+	RBTreeFileHeader header = {};
+	in.seekg(0);
+	in.read(reinterpret_cast<char*>(&header), sizeof(header));
+	header.check<T>(in ? file_size : 0, path);
+
+	std::allocator<T> storage;
+	T* values = storage.allocate(header.count);
+	try
+	{
+		in.read(reinterpret_cast<char*>(values), header.count * sizeof(T));
+		if (!in) throw std::runtime_error(path + ": cannot read");
+
+		// built aside, the tree is left as it was if anything fails.
+		RBTree loaded(_compare, _pool->get_allocator());
+		loaded.build_from_sorted(values, values + header.count);
+		swap(loaded);
+	}
+	catch (...)
+	{
+		storage.deallocate(values, header.count);
+		throw;
+	}
+	storage.deallocate(values, header.count);
+}
+
+#ifdef RB_TREE_MMAP
+
+/**
+ * @brief Read-only view of a file written by RBTree::save(), served from
+ * 		the mapped pages without building a tree.
+ *
+ * Opening costs a system call whatever the size. The values are sorted,
+ * lookups are binary searches faulting in the pages they touch, so a cold
+ * start turns into a warm-up instead of a full rebuild. The file may not
+ * change while it is mapped.
+ *
+ * Lookups return a pointer to the value found, or end().
+ *
+ * @tparam T Stored value type, trivially copyable.
+ * @tparam Compare Strict weak ordering of the keys.
+ * @tparam KeyOfValue Extracts the key out of a stored value.
+ */
+template<typename T,
+	typename Compare = std::less<typename RBTreeIdentity<T>::key_type>,
+	typename KeyOfValue = RBTreeIdentity<T>>
+class RBMappedTree
+{
+	static_assert(std::is_trivially_copyable<T>::value, "values are mapped as raw bytes");
+
+public:
+	typedef T value_type;
+	typedef typename KeyOfValue::key_type key_type;
+	typedef const T* const_iterator;
+
+	/**
+	 * @throws std::runtime_error if path cannot be mapped or does not
+	 * 		hold values of type T.
+	 */
+	explicit RBMappedTree(const std::string& path, const Compare& compare = Compare());
+
+	RBMappedTree(const RBMappedTree&) = delete;
+	RBMappedTree& operator=(const RBMappedTree&) = delete;
+
+	RBMappedTree(RBMappedTree&& other) noexcept : _compare(other._compare) {
+		swap(other);
+	}
+
+	RBMappedTree& operator=(RBMappedTree&& other) noexcept {
+		swap(other);
+		return *this;
+	}
+
+	~RBMappedTree();
+
+	const T* find(const key_type& key) const;
+	bool contains(const key_type& key) const { return find(key) != end(); }
+
+	const T* lower_bound(const key_type& key) const;
+	const T* upper_bound(const key_type& key) const;
+
+	/**
+	 * @brief Call fn on every value with a key in [lo, hi), in order.
+	 */
+	template<typename Function>
+	void for_each_in_range(const key_type& lo, const key_type& hi, Function fn) const;
+
+	/**
+	 * @brief Count the keys in [lo, hi) in O(log n).
+	 */
+	std::size_t count_range(const key_type& lo, const key_type& hi) const;
+
+	const T* begin() const { return _values; }
+	const T* end() const { return _values + _size; }
+
+	bool empty() const { return _size == 0; }
+	std::size_t size() const { return _size; }
+
+	void swap(RBMappedTree& other) noexcept;
+
+private:
+	Compare _compare;
+	void* _mapping = nullptr;
+	std::size_t _length = 0;
+	const T* _values = nullptr;
+	std::size_t _size = 0;
+};
+
+template<typename T, typename Compare, typename KeyOfValue>
+RBMappedTree<T, Compare, KeyOfValue>::RBMappedTree(const std::string& path, const Compare& compare)
+	: _compare(compare)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) throw std::runtime_error(path + ": cannot open");
+
+	struct stat status;
+	if (::fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(RBTreeFileHeader)))
+	{
+		::close(fd);
+		throw std::runtime_error(path + ": not a tree file");
+	}
+
+	// the mapping outlives the descriptor.
+	_length = static_cast<std::size_t>(status.st_size);
+	_mapping = ::mmap(nullptr, _length, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (_mapping == MAP_FAILED)
+	{
+		_mapping = nullptr;
+		throw std::runtime_error(path + ": cannot map");
+	}
+
+	const RBTreeFileHeader* header = static_cast<const RBTreeFileHeader*>(_mapping);
+	try
+	{
+		header->check<T>(_length, path);
+	}
+	catch (...)
+	{
+		::munmap(_mapping, _length);
+		throw;
+	}
+
+	_values = reinterpret_cast<const T*>(header + 1);
+	_size = static_cast<std::size_t>(header->count);
+}
+
+template<typename T, typename Compare, typename KeyOfValue>
+RBMappedTree<T, Compare, KeyOfValue>::~RBMappedTree()
+{
+	if (_mapping != nullptr) ::munmap(_mapping, _length);
+}
+
+template<typename T, typename Compare, typename KeyOfValue>
+const T* RBMappedTree<T, Compare, KeyOfValue>::find(const key_type& key) const
+{
+	const T* value = lower_bound(key);
+	if (value == end() || _compare(key, KeyOfValue()(*value))) return end();
+	return value;
+}
+
+template<typename T, typename Compare, typename KeyOfValue>
+const T* RBMappedTree<T, Compare, KeyOfValue>::lower_bound(const key_type& key) const
+{
+	return std::lower_bound(begin(), end(), key, [this](const T& value, const key_type& key) {
+		return _compare(KeyOfValue()(value), key);
+	});
+}
+
+template<typename T, typename Compare, typename KeyOfValue>
+const T* RBMappedTree<T, Compare, KeyOfValue>::upper_bound(const key_type& key) const
+{
+	return std::upper_bound(begin(), end(), key, [this](const key_type& key, const T& value) {
+		return _compare(key, KeyOfValue()(value));
+	});
+}
+
+template<typename T, typename Compare, typename KeyOfValue>
+template<typename Function>
+void RBMappedTree<T, Compare, KeyOfValue>::for_each_in_range(const key_type& lo, const key_type& hi, Function fn) const
+{
+	for (const T* value = lower_bound(lo); value != end() && _compare(KeyOfValue()(*value), hi); ++value)
+	{
+		fn(*value);
+	}
+}
+
+template<typename T, typename Compare, typename KeyOfValue>
+std::size_t RBMappedTree<T, Compare, KeyOfValue>::count_range(const key_type& lo, const key_type& hi) const
+{
+	const T* first = lower_bound(lo);
+	const T* last = lower_bound(hi);
+	return last > first ? last - first : 0;
+}
+
+template<typename T, typename Compare, typename KeyOfValue>
+void RBMappedTree<T, Compare, KeyOfValue>::swap(RBMappedTree& other) noexcept
+{
+	std::swap(_compare, other._compare);
+	std::swap(_mapping, other._mapping);
+	std::swap(_length, other._length);
+	std::swap(_values, other._values);
+	std::swap(_size, other._size);
+}
+
+#endif // RB_TREE_MMAP
+
+#endif // RB_TREE_IO
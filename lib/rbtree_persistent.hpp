@@ -0,0 +1,638 @@
+#ifndef SWIG
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#endif
+
+#include "rbtree.hpp"
+
+#ifndef RB_TREE_PERSISTENT
+#define RB_TREE_PERSISTENT
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+class RBConcurrentTree;
+
+template<typename T>
+struct RBPersistentNode
+{
+	typedef RBPersistentNode* NodePtr;
+	typedef T value_type;
+
+	enum class node_color : unsigned char { RED, BLACK };
+
+	template<typename... Args>
+	explicit RBPersistentNode(Args&&... args) : data(std::forward<Args>(args)...) {}
+
+	T data;
+	NodePtr left = nullptr;
+	NodePtr right = nullptr;
+	// parents and versions holding the node, counted once it is committed.
+	std::atomic<std::size_t> refs { 0 };
+	node_color color = node_color::RED;
+	// made by the operation under way, the only nodes it may still change.
+	bool fresh = true;
+};
+
+/**
+ * @brief Red-black tree whose nodes are never changed once an operation
+ * 		is over, so that versions of the tree can share them.
+ *
+ * insert() and remove() copy the nodes on the search path and the few
+ * siblings the rebalancing recolors, O(log n) nodes, and link the copies
+ * to the untouched subtrees. Nodes count the parents and versions holding
+ * them; copying the tree only takes a reference on the root, and a node
+ * is freed with the last version reaching it.
+ *
+ * The balancing follows Kahrs' functional insertion and deletion, nodes
+ * made by the operation under way being reused in place instead of being
+ * copied once more. Reference counts are only taken once the new root is
+ * committed, so an exception leaves the tree as it was.
+ *
+ * A version is not safe to modify from several threads, different
+ * versions sharing nodes are.
+ *
+ * @tparam T Stored value type, copied along with the nodes.
+ * @tparam Compare Strict weak ordering of the keys.
+ * @tparam Allocator Allocator the nodes are obtained from.
+ * @tparam KeyOfValue Extracts the key out of a stored value.
+ */
+template<typename T,
+	typename Compare = std::less<typename RBTreeIdentity<T>::key_type>,
+	typename Allocator = std::allocator<T>,
+	typename KeyOfValue = RBTreeIdentity<T>>
+class RBPersistentTree
+{
+	template<typename, typename, typename, typename>
+	friend class RBConcurrentTree;
+
+public:
+	typedef RBPersistentNode<T> Node;
+	typedef typename Node::node_color NodeColor;
+	typedef Node* NodePtr;
+	typedef typename KeyOfValue::key_type key_type;
+
+	explicit RBPersistentTree(const Compare& compare = Compare(), const Allocator& alloc = Allocator())
+		: _compare(compare), _alloc(alloc) {}
+
+	/**
+	 * @brief O(1), both trees share every node.
+	 */
+	RBPersistentTree(const RBPersistentTree& other)
+		: _root(other._root), _size(other._size), _compare(other._compare), _alloc(other._alloc)
+	{
+		_acquire(_root);
+	}
+
+	RBPersistentTree(RBPersistentTree&& other) noexcept
+		: _root(other._root), _size(other._size), _compare(other._compare), _alloc(other._alloc)
+	{
+		other._root = nullptr;
+		other._size = 0;
+	}
+
+	RBPersistentTree& operator=(RBPersistentTree other) noexcept
+	{
+		swap(other);
+		return *this;
+	}
+
+	~RBPersistentTree() { _release(_root); }
+
+	/**
+	 * @brief Point-in-time copy of the tree in O(1). Later writes to
+	 * 		either tree copy their paths and leave the other as it is.
+	 */
+	RBPersistentTree snapshot() const { return *this; }
+
+	/**
+	 * @brief Roll the tree back to snapshot in O(1), the nodes written
+	 * 		since then are freed unless another version holds them.
+	 */
+	void restore(const RBPersistentTree& snapshot) { *this = snapshot; }
+
+	/**
+	 * @brief Find the node holding key.
+	 *
+	 * @return NodePtr The node, nullptr if key is not stored.
+	 */
+	NodePtr find(const key_type& key) const { return _find(_root, key, _compare); }
+	bool contains(const key_type& key) const { return find(key) != nullptr; }
+
+	/**
+	 * @brief Insert value unless its key is already stored.
+	 *
+	 * @return bool Whether the insertion took place.
+	 */
+	bool insert(const T& value) { return _insert_value(value); }
+	bool insert(T&& value) { return _insert_value(std::move(value)); }
+
+	/**
+	 * @brief Remove key if it is stored.
+	 *
+	 * @return bool Whether a value was removed.
+	 */
+	bool remove(const key_type& key);
+
+	void clear();
+
+	/**
+	 * @brief Call visitor on every value, in order. The walk keeps its
+	 * 		path on the stack, nodes have no parent link.
+	 */
+	template<typename Visitor>
+	void for_each(Visitor visitor) const { _for_each(_root, visitor); }
+
+	std::size_t size() const { return _size; }
+	bool empty() const { return _root == nullptr; }
+	NodePtr get_root() const { return _root; }
+
+	bool is_red(NodePtr node) const { return node != nullptr && node->color == NodeColor::RED; }
+	bool is_black(NodePtr node) const { return node != nullptr && node->color == NodeColor::BLACK; }
+
+	void swap(RBPersistentTree& other) noexcept
+	{
+		using std::swap;
+		swap(_root, other._root);
+		swap(_size, other._size);
+		swap(_compare, other._compare);
+		swap(_alloc, other._alloc);
+		swap(_fresh, other._fresh);
+	}
+
+private:
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Node> NodeAllocator;
+	typedef std::allocator_traits<NodeAllocator> NodeTraits;
+
+	// red-black height is at most 2 log2(n + 1), n fits in a size_t.
+	static constexpr std::size_t _max_height = 2 * std::numeric_limits<std::size_t>::digits;
+
+	static const key_type& _key(NodePtr node) { return KeyOfValue()(node->data); }
+
+	template<typename Key>
+	static NodePtr _find(NodePtr root, const Key& key, const Compare& compare);
+
+	template<typename Visitor>
+	static void _for_each(NodePtr root, Visitor& visitor);
+
+	template<typename... Args>
+	NodePtr _create(Args&&... args);
+
+	/**
+	 * @brief The node itself if made by this operation, a fresh copy of it
+	 * 		otherwise. Old nodes may be read by other versions, they are
+	 * 		never changed.
+	 */
+	NodePtr _unshare(NodePtr node)
+	{
+		if (node->fresh) return node;
+
+		NodePtr copy = _create(static_cast<const T&>(node->data));
+		return _make(copy, node->color, node->left, node->right);
+	}
+
+	/**
+	 * @brief Relink and recolor a fresh node.
+	 */
+	static NodePtr _make(NodePtr node, NodeColor color, NodePtr left, NodePtr right)
+	{
+		node->color = color;
+		node->left = left;
+		node->right = right;
+		return node;
+	}
+
+	template<typename Value>
+	bool _insert_value(Value&& value);
+
+	NodePtr _insert(NodePtr node, NodePtr fresh);
+	NodePtr _remove(NodePtr node, const key_type& key);
+	NodePtr _balance(NodePtr left, NodePtr node, NodePtr right);
+	NodePtr _balance_left(NodePtr left, NodePtr node, NodePtr right);
+	NodePtr _balance_right(NodePtr left, NodePtr node, NodePtr right);
+	NodePtr _append(NodePtr left, NodePtr right);
+
+	/**
+	 * @brief Make root the root of the tree. The fresh nodes reachable
+	 * 		from it take their references and freeze, the others are
+	 * 		dropped.
+	 *
+	 * @return NodePtr The previous root, whose reference passes on to
+	 * 		the caller.
+	 */
+	NodePtr _commit(NodePtr root);
+
+	/**
+	 * @brief Drop every node made by the failed operation under way.
+	 */
+	void _rollback();
+
+	void _freeze(NodePtr node);
+	void _destroy_node(NodePtr node);
+
+	static void _acquire(NodePtr node)
+	{
+		if (node != nullptr) node->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void _release(NodePtr node);
+
+	NodePtr _root = nullptr;
+	std::size_t _size = 0;
+	Compare _compare;
+	NodeAllocator _alloc;
+	// nodes made by the operation under way.
+	std::vector<NodePtr> _fresh;
+};
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+bool RBPersistentTree<T, Compare, Allocator, KeyOfValue>::remove(const key_type& key)
+{
+	// nothing gets copied for a key that is not there.
+	if (!contains(key)) return false;
+
+	NodePtr root;
+	try
+	{
+		root = _remove(_root, key);
+		if (is_red(root))
+		{
+			root = _unshare(root);
+			root->color = NodeColor::BLACK;
+		}
+	}
+	catch (...)
+	{
+		_rollback();
+		throw;
+	}
+
+	_release(_commit(root));
+	--_size;
+	return true;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBPersistentTree<T, Compare, Allocator, KeyOfValue>::clear()
+{
+	_release(_root);
+	_root = nullptr;
+	_size = 0;
+}
+
+/*******************
+ * PRIVATE HELPERS *
+ *******************/
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Key>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_find(NodePtr root, const Key& key, const Compare& compare)
+{
+	NodePtr node = root;
+	while (node != nullptr)
+	{
+		if (compare(key, _key(node))) node = node->left;
+		else if (compare(_key(node), key)) node = node->right;
+		else return node;
+	}
+	return nullptr;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Visitor>
+void RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_for_each(NodePtr root, Visitor& visitor)
+{
+	NodePtr path[_max_height];
+	std::size_t depth = 0;
+	NodePtr node = root;
+	while (node != nullptr || depth != 0)
+	{
+		while (node != nullptr)
+		{
+			path[depth++] = node;
+			node = node->left;
+		}
+
+		node = path[--depth];
+		visitor(static_cast<const T&>(node->data));
+		node = node->right;
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename... Args>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_create(Args&&... args)
+{
+	NodePtr node = NodeTraits::allocate(_alloc, 1);
+	try
+	{
+		_fresh.push_back(node);
+	}
+	catch (...)
+	{
+		NodeTraits::deallocate(_alloc, node, 1);
+		throw;
+	}
+
+	try
+	{
+		NodeTraits::construct(_alloc, node, std::forward<Args>(args)...);
+	}
+	catch (...)
+	{
+		_fresh.pop_back();
+		NodeTraits::deallocate(_alloc, node, 1);
+		throw;
+	}
+	return node;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+template<typename Value>
+bool RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_insert_value(Value&& value)
+{
+	if (contains(KeyOfValue()(value))) return false;
+
+	NodePtr root;
+	try
+	{
+		root = _insert(_root, _create(std::forward<Value>(value)));
+		root->color = NodeColor::BLACK;
+	}
+	catch (...)
+	{
+		_rollback();
+		throw;
+	}
+
+	_release(_commit(root));
+	++_size;
+	return true;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_insert(NodePtr node, NodePtr fresh)
+{
+	if (node == nullptr) return fresh;
+
+	node = _unshare(node);
+	if (_compare(_key(fresh), _key(node)))
+	{
+		NodePtr left = _insert(node->left, fresh);
+		return is_black(node) ? _balance(left, node, node->right) : _make(node, NodeColor::RED, left, node->right);
+	}
+
+	NodePtr right = _insert(node->right, fresh);
+	return is_black(node) ? _balance(node->left, node, right) : _make(node, NodeColor::RED, node->left, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_remove(NodePtr node, const key_type& key)
+{
+	// removing below a black node shortens its subtree by one black node,
+	// which the balancing on the way back makes up for.
+	if (_compare(key, _key(node)))
+	{
+		bool shorter = is_black(node->left);
+		node = _unshare(node);
+		NodePtr left = _remove(node->left, key);
+		return shorter ? _balance_left(left, node, node->right) : _make(node, NodeColor::RED, left, node->right);
+	}
+	if (_compare(_key(node), key))
+	{
+		bool shorter = is_black(node->right);
+		node = _unshare(node);
+		NodePtr right = _remove(node->right, key);
+		return shorter ? _balance_right(node->left, node, right) : _make(node, NodeColor::RED, node->left, right);
+	}
+
+	// the node itself is left to the versions still holding it.
+	return _append(node->left, node->right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_balance(NodePtr left, NodePtr node, NodePtr right)
+{
+	if (is_red(left) && is_red(right))
+	{
+		left = _unshare(left);
+		right = _unshare(right);
+		left->color = NodeColor::BLACK;
+		right->color = NodeColor::BLACK;
+		return _make(node, NodeColor::RED, left, right);
+	}
+
+	if (is_red(left) && is_red(left->left))
+	{
+		left = _unshare(left);
+		NodePtr outer = _unshare(left->left);
+		outer->color = NodeColor::BLACK;
+		return _make(left, NodeColor::RED, outer, _make(node, NodeColor::BLACK, left->right, right));
+	}
+	if (is_red(left) && is_red(left->right))
+	{
+		left = _unshare(left);
+		NodePtr inner = _unshare(left->right);
+		NodePtr inner_left = inner->left;
+		NodePtr inner_right = inner->right;
+		return _make(inner, NodeColor::RED,
+			_make(left, NodeColor::BLACK, left->left, inner_left),
+			_make(node, NodeColor::BLACK, inner_right, right));
+	}
+
+	if (is_red(right) && is_red(right->right))
+	{
+		right = _unshare(right);
+		NodePtr outer = _unshare(right->right);
+		outer->color = NodeColor::BLACK;
+		return _make(right, NodeColor::RED, _make(node, NodeColor::BLACK, left, right->left), outer);
+	}
+	if (is_red(right) && is_red(right->left))
+	{
+		right = _unshare(right);
+		NodePtr inner = _unshare(right->left);
+		NodePtr inner_left = inner->left;
+		NodePtr inner_right = inner->right;
+		return _make(inner, NodeColor::RED,
+			_make(node, NodeColor::BLACK, left, inner_left),
+			_make(right, NodeColor::BLACK, inner_right, right->right));
+	}
+
+	return _make(node, NodeColor::BLACK, left, right);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_balance_left(NodePtr left, NodePtr node, NodePtr right)
+{
+	// left is one black node short of right.
+	if (is_red(left))
+	{
+		left = _unshare(left);
+		left->color = NodeColor::BLACK;
+		return _make(node, NodeColor::RED, left, right);
+	}
+	if (is_black(right))
+	{
+		right = _unshare(right);
+		right->color = NodeColor::RED;
+		return _balance(left, node, right);
+	}
+
+	// right is red, its children are black and not empty.
+	right = _unshare(right);
+	NodePtr inner = _unshare(right->left);
+	NodePtr outer = _unshare(right->right);
+	NodePtr inner_left = inner->left;
+	NodePtr inner_right = inner->right;
+	outer->color = NodeColor::RED;
+	return _make(inner, NodeColor::RED,
+		_make(node, NodeColor::BLACK, left, inner_left),
+		_balance(inner_right, right, outer));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_balance_right(NodePtr left, NodePtr node, NodePtr right)
+{
+	// right is one black node short of left.
+	if (is_red(right))
+	{
+		right = _unshare(right);
+		right->color = NodeColor::BLACK;
+		return _make(node, NodeColor::RED, left, right);
+	}
+	if (is_black(left))
+	{
+		left = _unshare(left);
+		left->color = NodeColor::RED;
+		return _balance(left, node, right);
+	}
+
+	left = _unshare(left);
+	NodePtr inner = _unshare(left->right);
+	NodePtr outer = _unshare(left->left);
+	NodePtr inner_left = inner->left;
+	NodePtr inner_right = inner->right;
+	outer->color = NodeColor::RED;
+	return _make(inner, NodeColor::RED,
+		_balance(outer, left, inner_left),
+		_make(node, NodeColor::BLACK, inner_right, right));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_append(NodePtr left, NodePtr right)
+{
+	// left and right are the children of a removed node, same black height.
+	if (left == nullptr) return right;
+	if (right == nullptr) return left;
+
+	if (is_red(left) && is_red(right))
+	{
+		left = _unshare(left);
+		right = _unshare(right);
+		NodePtr middle = _append(left->right, right->left);
+		if (is_red(middle))
+		{
+			middle = _unshare(middle);
+			NodePtr middle_left = middle->left;
+			NodePtr middle_right = middle->right;
+			return _make(middle, NodeColor::RED,
+				_make(left, NodeColor::RED, left->left, middle_left),
+				_make(right, NodeColor::RED, middle_right, right->right));
+		}
+		return _make(left, NodeColor::RED, left->left, _make(right, NodeColor::RED, middle, right->right));
+	}
+
+	if (is_black(left) && is_black(right))
+	{
+		left = _unshare(left);
+		right = _unshare(right);
+		NodePtr middle = _append(left->right, right->left);
+		if (is_red(middle))
+		{
+			middle = _unshare(middle);
+			NodePtr middle_left = middle->left;
+			NodePtr middle_right = middle->right;
+			return _make(middle, NodeColor::RED,
+				_make(left, NodeColor::BLACK, left->left, middle_left),
+				_make(right, NodeColor::BLACK, middle_right, right->right));
+		}
+		NodePtr left_left = left->left;
+		return _balance_left(left_left, left, _make(right, NodeColor::BLACK, middle, right->right));
+	}
+
+	if (is_red(right))
+	{
+		right = _unshare(right);
+		return _make(right, NodeColor::RED, _append(left, right->left), right->right);
+	}
+
+	left = _unshare(left);
+	return _make(left, NodeColor::RED, left->left, _append(left->right, right));
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+typename RBPersistentTree<T, Compare, Allocator, KeyOfValue>::NodePtr RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_commit(NodePtr root)
+{
+	if (root != nullptr)
+	{
+		_freeze(root);
+		_acquire(root);
+	}
+	for (NodePtr node: _fresh)
+	{
+		if (node->fresh) _destroy_node(node);
+	}
+	_fresh.clear();
+
+	NodePtr previous = _root;
+	_root = root;
+	return previous;
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_rollback()
+{
+	for (NodePtr node: _fresh) _destroy_node(node);
+	_fresh.clear();
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_freeze(NodePtr node)
+{
+	if (!node->fresh) return;
+
+	node->fresh = false;
+	for (NodePtr child: { node->left, node->right })
+	{
+		if (child == nullptr) continue;
+		_freeze(child);
+		_acquire(child);
+	}
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_destroy_node(NodePtr node)
+{
+	NodeTraits::destroy(_alloc, node);
+	NodeTraits::deallocate(_alloc, node, 1);
+}
+
+template<typename T, typename Compare, typename Allocator, typename KeyOfValue>
+void RBPersistentTree<T, Compare, Allocator, KeyOfValue>::_release(NodePtr node)
+{
+	// the last version to let go of a node frees it.
+	while (node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		_release(node->left);
+		NodePtr right = node->right;
+		_destroy_node(node);
+		node = right;
+	}
+}
+
+#endif // RB_TREE_PERSISTENT
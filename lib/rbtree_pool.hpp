@@ -0,0 +1,299 @@
+#ifndef SWIG
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#endif
+
+#ifndef RB_TREE_POOL
+#define RB_TREE_POOL
+
+/**
+ * @brief Slab arena handing out fixed-size node blocks.
+ *
+ * Node storage is carved out of slabs obtained from the user supplied
+ * allocator and recycled through an intrusive free list, so steady-state
+ * insert/remove churn never reaches the system heap. release() drops
+ * every slab at once.
+ *
+ * The pool only manages raw storage; constructing and destroying the
+ * nodes is left to the owner. The one exception is the terminal node,
+ * which lives in the pool object itself so that every tree sharing the
+ * pool shares it too, for as long as any of them is alive.
+ *
+ * Pools are held through std::shared_ptr so that trees exchanging nodes
+ * can share one. adopt() merges two pools: the adopted one hands its
+ * slabs over and forwards every later request to the adopter. A pool can
+ * also keep() the slabs of another one alive without merging, for nodes
+ * that moved over on their own: slabs go back to the allocator once no
+ * pool refers to them anymore.
+ *
+ * @tparam Node The node type to allocate.
+ * @tparam Allocator Any standard allocator, rebound to the slot type.
+ */
+template<typename Node, typename Allocator = std::allocator<Node>>
+class RBTreePool : public std::enable_shared_from_this<RBTreePool<Node, Allocator>>
+{
+	union Slot
+	{
+		Slot* next;
+		alignas(Node) unsigned char storage[sizeof(Node)];
+	};
+
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Slot> SlotAllocator;
+	typedef std::allocator_traits<SlotAllocator> SlotTraits;
+
+	struct Slab
+	{
+		Slot* slots;
+		std::size_t count;
+	};
+
+	// The slabs one pool has grown, shared by every pool holding nodes
+	// carved out of them.
+	struct Storage
+	{
+		explicit Storage(const SlotAllocator& alloc) : alloc(alloc) {}
+		Storage(const Storage&) = delete;
+		Storage& operator=(const Storage&) = delete;
+
+		~Storage()
+		{
+			for (const Slab& slab: slabs) SlotTraits::deallocate(alloc, slab.slots, slab.count);
+		}
+
+		SlotAllocator alloc;
+		std::vector<Slab> slabs;
+	};
+
+	static constexpr std::size_t _min_slab_size = 32;
+	static constexpr std::size_t _max_slab_size = 4096;
+
+public:
+	/**
+	 * @brief Every storage the nodes of a pool may live in, see
+	 * 		storages() and keep().
+	 */
+	typedef std::vector<std::shared_ptr<Storage>> Storages;
+
+	explicit RBTreePool(const Allocator& alloc = Allocator())
+		: _alloc(alloc)
+	{}
+
+	RBTreePool(const RBTreePool&) = delete;
+	RBTreePool& operator=(const RBTreePool&) = delete;
+
+	RBTreePool(RBTreePool&& other) noexcept
+		: _alloc(std::move(other._alloc)),
+		_own(std::move(other._own)),
+		_storages(std::move(other._storages)),
+		_free(other._free),
+		_free_tail(other._free_tail),
+		_cursor(other._cursor),
+		_end(other._end),
+		_next_slab_size(other._next_slab_size),
+		_forward(std::move(other._forward))
+	{
+		other._free = other._free_tail = other._cursor = other._end = nullptr;
+		other._next_slab_size = _min_slab_size;
+	}
+
+	~RBTreePool() { release(); }
+
+	/**
+	 * @brief Get uninitialized storage for a single node.
+	 */
+	Node* allocate()
+	{
+		if (_forward != nullptr) return _target().allocate();
+
+		if (_free != nullptr)
+		{
+			Slot* slot = _free;
+			_free = slot->next;
+			if (_free == nullptr) _free_tail = nullptr;
+			return reinterpret_cast<Node*>(slot->storage);
+		}
+
+		if (_cursor == _end) _grow(_next_slab_size);
+
+		return reinterpret_cast<Node*>((_cursor++)->storage);
+	}
+
+	/**
+	 * @brief Make sure the next count allocations that miss the free
+	 * 		list are served from a single contiguous slab.
+	 */
+	void reserve(std::size_t count)
+	{
+		if (_forward != nullptr) return _target().reserve(count);
+		if (std::size_t(_end - _cursor) >= count) return;
+		_grow(count);
+	}
+
+	/**
+	 * @brief Return node storage to the free list. The node must have
+	 * 		been destroyed already.
+	 */
+	void deallocate(Node* node)
+	{
+		if (_forward != nullptr) return _target().deallocate(node);
+
+		Slot* slot = reinterpret_cast<Slot*>(node);
+		if (_free == nullptr) _free_tail = slot;
+		slot->next = _free;
+		_free = slot;
+	}
+
+	/**
+	 * @brief Take over the slabs and the free list of another pool. Both
+	 * 		pools serve the same storage afterwards and every node handed
+	 * 		out by either of them stays valid. The unused tail of the
+	 * 		adopted pool's last slab is given up.
+	 */
+	void adopt(RBTreePool& other)
+	{
+		RBTreePool& into = _target();
+		RBTreePool& from = other._target();
+		if (&into == &from) return;
+
+		into._keep(from._storages);
+		if (from._free != nullptr)
+		{
+			from._free_tail->next = into._free;
+			if (into._free == nullptr) into._free_tail = from._free_tail;
+			into._free = from._free;
+		}
+
+		from._own.reset();
+		from._storages.reset();
+		from._free = from._free_tail = from._cursor = from._end = nullptr;
+		from._forward = into.shared_from_this();
+	}
+
+	/**
+	 * @brief The storages the nodes handed out so far live in. Taken
+	 * 		along with a node, they let another pool keep() its slabs.
+	 */
+	std::shared_ptr<const Storages> storages() { return _target()._storages; }
+
+	/**
+	 * @brief Keep the given storages alive for as long as this pool
+	 * 		lives, so that nodes carved out of them can be given to it.
+	 * 		Costs a scan of both lists; the list of this pool is only
+	 * 		copied, once, when some storage is new to it.
+	 */
+	void keep(const std::shared_ptr<const Storages>& storages) { _target()._keep(storages); }
+
+	/**
+	 * @brief The terminal node of the trees using this pool object. It
+	 * 		is not handed over by adopt().
+	 */
+	Node* terminal() { return &_terminal; }
+
+	/**
+	 * @brief Whether the pool was adopted and forwards to another one.
+	 */
+	bool is_forwarding() const { return _forward != nullptr; }
+
+	/**
+	 * @brief Give every slab back to the allocator, unless another pool
+	 * 		keeps it. Any node handed out by this pool is invalidated. A
+	 * 		forwarding pool owns no slab.
+	 */
+	void release()
+	{
+		_own.reset();
+		_storages.reset();
+		_free = _free_tail = _cursor = _end = nullptr;
+		_next_slab_size = _min_slab_size;
+	}
+
+	void swap(RBTreePool& other) noexcept
+	{
+		using std::swap;
+		swap(_alloc, other._alloc);
+		swap(_own, other._own);
+		swap(_storages, other._storages);
+		swap(_free, other._free);
+		swap(_free_tail, other._free_tail);
+		swap(_cursor, other._cursor);
+		swap(_end, other._end);
+		swap(_next_slab_size, other._next_slab_size);
+		swap(_forward, other._forward);
+	}
+
+	Allocator get_allocator() const { return Allocator(_alloc); }
+
+private:
+	RBTreePool& _target()
+	{
+		RBTreePool* pool = this;
+		while (pool->_forward != nullptr) pool = pool->_forward.get();
+		return *pool;
+	}
+
+	void _keep(const std::shared_ptr<const Storages>& storages)
+	{
+		if (storages == nullptr || storages == _storages) return;
+
+		auto known = [this](const std::shared_ptr<Storage>& storage) {
+			return _storages != nullptr && std::find(_storages->begin(), _storages->end(), storage) != _storages->end();
+		};
+		if (std::all_of(storages->begin(), storages->end(), known)) return;
+
+		Storages merged;
+		if (_storages != nullptr) merged = *_storages;
+		for (const std::shared_ptr<Storage>& storage: *storages)
+		{
+			if (!known(storage)) merged.push_back(storage);
+		}
+		_storages = std::make_shared<const Storages>(std::move(merged));
+	}
+
+	void _grow(std::size_t count)
+	{
+		if (_own == nullptr)
+		{
+			std::shared_ptr<Storage> own = std::make_shared<Storage>(_alloc);
+			Storages storages { own };
+			if (_storages != nullptr) storages.insert(storages.end(), _storages->begin(), _storages->end());
+			_storages = std::make_shared<const Storages>(std::move(storages));
+			_own = std::move(own);
+		}
+
+		Slot* slots = SlotTraits::allocate(_alloc, count);
+		try
+		{
+			_own->slabs.push_back(Slab { slots, count });
+		}
+		catch (...)
+		{
+			SlotTraits::deallocate(_alloc, slots, count);
+			throw;
+		}
+
+		_cursor = slots;
+		_end = slots + count;
+		if (_next_slab_size < _max_slab_size) _next_slab_size *= 2;
+	}
+
+	SlotAllocator _alloc;
+	Node _terminal;
+	// _own is the storage this pool grows, _storages every one its nodes
+	// may live in, _own included. The list is never changed in place, a
+	// node handle may hold on to it.
+	std::shared_ptr<Storage> _own;
+	std::shared_ptr<const Storages> _storages;
+	Slot* _free = nullptr;
+	Slot* _free_tail = nullptr;
+	Slot* _cursor = nullptr;
+	Slot* _end = nullptr;
+	std::size_t _next_slab_size = _min_slab_size;
+	std::shared_ptr<RBTreePool> _forward;
+};
+
+#endif // RB_TREE_POOL
@@ -0,0 +1,274 @@
+#ifndef SWIG
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#endif
+
+#ifndef RB_TREE_SCHEDULER
+#define RB_TREE_SCHEDULER
+
+/**
+ * @brief Work-stealing fork-join thread pool driving the parallel tree
+ * 		algorithms.
+ *
+ * Every participating thread owns a deque of pending tasks. It pushes and
+ * pops at the back, idle threads steal from the front of the others,
+ * which hands them the largest pieces of work. fork_join() pushes its
+ * second branch, runs the first one inline and then either takes the
+ * second one back or keeps executing other tasks until the thief is done
+ * with it, so a joining thread never sits idle while work is left.
+ *
+ * A thread outside the pool calling fork_join() takes part in the
+ * computation until it returns. Such calls are serialized.
+ */
+class RBTreeScheduler
+{
+	struct Task
+	{
+		void (*invoke)(void*);
+		void* callable;
+		std::exception_ptr error;
+		std::atomic<bool> done { false };
+
+		void run()
+		{
+			try
+			{
+				invoke(callable);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+			done.store(true, std::memory_order_release);
+		}
+	};
+
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Task*> tasks;
+	};
+
+	struct Context
+	{
+		RBTreeScheduler* scheduler;
+		std::size_t index;
+	};
+
+public:
+	/**
+	 * @param concurrency Number of threads working on a fork_join() call,
+	 * 		the calling thread included. 0 or 1 runs everything inline.
+	 */
+	explicit RBTreeScheduler(std::size_t concurrency = std::thread::hardware_concurrency())
+	{
+		if (concurrency == 0) concurrency = 1;
+
+		// slot 0 belongs to the thread entering from outside.
+		for (std::size_t i = 0; i < concurrency; ++i)
+		{
+			_workers.push_back(std::make_unique<Worker>());
+		}
+
+		try
+		{
+			for (std::size_t i = 1; i < concurrency; ++i)
+			{
+				_threads.emplace_back(&RBTreeScheduler::_work, this, i);
+			}
+		}
+		catch (...)
+		{
+			_shutdown();
+			throw;
+		}
+	}
+
+	RBTreeScheduler(const RBTreeScheduler&) = delete;
+	RBTreeScheduler& operator=(const RBTreeScheduler&) = delete;
+
+	~RBTreeScheduler() { _shutdown(); }
+
+	std::size_t concurrency() const { return _workers.size(); }
+
+	/**
+	 * @brief Run left and right, possibly in parallel, and return once
+	 * 		both are done. Calls nest freely.
+	 *
+	 * @throws Whatever left or right threw, left first. Both branches
+	 * 		always run to completion.
+	 */
+	template<typename Left, typename Right>
+	void fork_join(Left&& left, Right&& right)
+	{
+		if (_workers.size() == 1)
+		{
+			left();
+			right();
+			return;
+		}
+
+		if (_context.scheduler != this)
+		{
+			std::lock_guard<std::mutex> guard(_external);
+			Context saved = _context;
+			_context = { this, 0 };
+			try
+			{
+				fork_join(left, right);
+			}
+			catch (...)
+			{
+				_context = saved;
+				throw;
+			}
+			_context = saved;
+			return;
+		}
+
+		typedef typename std::remove_reference<Right>::type Callable;
+		Task task;
+		task.invoke = [](void* callable) { (*static_cast<Callable*>(callable))(); };
+		task.callable = const_cast<void*>(static_cast<const void*>(std::addressof(right)));
+
+		Worker& self = *_workers[_context.index];
+		_push(self, &task);
+
+		std::exception_ptr error;
+		try
+		{
+			left();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		if (_reclaim(self, &task))
+		{
+			task.run();
+		}
+		else
+		{
+			// stolen, lend a hand elsewhere until the thief is done.
+			while (!task.done.load(std::memory_order_acquire))
+			{
+				if (!_run_one(_context.index)) std::this_thread::yield();
+			}
+		}
+
+		if (error) std::rethrow_exception(error);
+		if (task.error) std::rethrow_exception(task.error);
+	}
+
+private:
+	void _push(Worker& worker, Task* task)
+	{
+		{
+			std::lock_guard<std::mutex> guard(worker.lock);
+			worker.tasks.push_back(task);
+		}
+
+		// taking the sleep lock orders the increment before any sleeper
+		// checks for work, no wake-up gets lost.
+		{
+			std::lock_guard<std::mutex> guard(_sleep);
+			++_pending;
+		}
+		_wake.notify_one();
+	}
+
+	/**
+	 * @brief Take task back unless it was stolen. Tasks pushed after it
+	 * 		are joined before, so it can only be at the back.
+	 */
+	bool _reclaim(Worker& worker, Task* task)
+	{
+		std::lock_guard<std::mutex> guard(worker.lock);
+		if (worker.tasks.empty() || worker.tasks.back() != task) return false;
+
+		worker.tasks.pop_back();
+		--_pending;
+		return true;
+	}
+
+	/**
+	 * @brief Run a single task, the newest of the own deque or else the
+	 * 		oldest of another one.
+	 *
+	 * @return bool Whether there was a task to run.
+	 */
+	bool _run_one(std::size_t index)
+	{
+		Task* task = nullptr;
+		for (std::size_t i = 0; i < _workers.size() && task == nullptr; ++i)
+		{
+			Worker& victim = *_workers[(index + i) % _workers.size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (victim.tasks.empty()) continue;
+
+			if (i == 0)
+			{
+				task = victim.tasks.back();
+				victim.tasks.pop_back();
+			}
+			else
+			{
+				task = victim.tasks.front();
+				victim.tasks.pop_front();
+			}
+			--_pending;
+		}
+
+		if (task == nullptr) return false;
+		task->run();
+		return true;
+	}
+
+	void _work(std::size_t index)
+	{
+		_context = { this, index };
+		while (true)
+		{
+			if (_run_one(index)) continue;
+
+			std::unique_lock<std::mutex> guard(_sleep);
+			_wake.wait(guard, [this]() { return _stop || _pending > 0; });
+			if (_stop) return;
+		}
+	}
+
+	void _shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> guard(_sleep);
+			_stop = true;
+		}
+		_wake.notify_all();
+
+		for (std::thread& thread: _threads) thread.join();
+		_threads.clear();
+	}
+
+	static inline thread_local Context _context { nullptr, 0 };
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+	std::vector<std::thread> _threads;
+	std::mutex _external;
+	std::mutex _sleep;
+	std::condition_variable _wake;
+	std::atomic<std::size_t> _pending { 0 };
+	bool _stop = false;
+};
+
+#endif // RB_TREE_SCHEDULER
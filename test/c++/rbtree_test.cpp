@@ -9,6 +9,11 @@ void run() {
     test_insert_root();
     test_insert_three_balanced_nodes();
     test_insert_three_unbalanced_nodes_single_rotation();
+    test_insert_three_unbalanced_nodes_double_rotation();
+    test_insert_duplicate();
+    test_insert_rvalue();
+    test_emplace();
+    test_try_emplace();
 
     printf("Starting tree find tests...\n");
 
@@ -16,6 +21,8 @@ void run() {
     test_find_root();
     test_find_existing_node();
     test_find_non_existing_node();
+    test_find_custom_compare();
+    test_find_heterogeneous();
 
     printf("Starting tree remove tests...\n");
     
@@ -24,6 +31,137 @@ void run() {
     test_remove_when_black_sibling_red_children_lr_ll();
     test_remove_when_black_sibling_black_children_black_parent();
     test_remove_when_red_sibling();
+    test_remove_root();
+
+    printf("Starting tree complexity tests...\n");
+
+    test_insert_comparisons_logarithmic();
+    test_remove_comparisons_logarithmic();
+
+    printf("Starting tree memory tests...\n");
+
+    test_clear_tree();
+    test_copy_tree();
+    test_move_tree();
+    test_assign_stateful_compare();
+    test_custom_allocator();
+    test_compact_node_layout();
+
+    printf("Starting tree iteration tests...\n");
+
+    test_iterate_empty_tree();
+    test_iterate_in_order();
+    test_iterate_reverse();
+    test_iterate_after_remove();
+    test_iterate_map();
+
+    printf("Starting order statistics tests...\n");
+
+    test_size();
+    test_select();
+    test_rank();
+    test_order_statistics_after_removals();
+
+    printf("Starting range query tests...\n");
+
+    test_lower_upper_bound();
+    test_equal_range();
+    test_for_each_in_range();
+    test_count_range();
+
+    printf("Starting bulk build tests...\n");
+
+    test_build_from_sorted();
+    test_build_from_unsorted();
+    test_build_from_input_iterator();
+    test_build_single_slab();
+    test_build_then_modify();
+
+    printf("Starting map tests...\n");
+
+    test_map_subscript();
+    test_map_insert_or_assign();
+    test_map_try_emplace();
+    test_map_values_stay_in_place();
+
+    printf("Starting set operation tests...\n");
+
+    test_split();
+    test_split_comparisons_logarithmic();
+    test_join();
+    test_union_independent_comparisons();
+    test_union_with();
+    test_intersect_with();
+    test_difference_with();
+    test_set_operations_reuse_nodes();
+    test_split_outlives_source();
+    test_set_operations_leave_other_independent();
+    test_split_keeps_size();
+    test_insert_batch();
+    test_erase_batch();
+    test_batch_comparisons();
+
+    printf("Starting parallel tests...\n");
+
+    test_scheduler_fork_join();
+    test_scheduler_exceptions();
+    test_parallel_set_operations();
+    test_parallel_build_from_sorted();
+
+    printf("Starting concurrent tree tests...\n");
+
+    test_persistent_insert_remove();
+    test_persistent_versions_share_nodes();
+    test_persistent_frees_nodes();
+    test_concurrent_readers_and_writers();
+    test_concurrent_reclamation();
+    test_persistent_snapshot_restore();
+    test_concurrent_snapshots();
+
+    printf("Starting B+ tree tests...\n");
+
+    test_bplus_tree_against_set();
+    test_bplus_tree_bounds();
+    test_bplus_tree_copy_and_move();
+    test_search_tree_engines();
+    test_bplus_search_kernels();
+    test_bplus_tree_numeric_keys();
+
+    printf("Starting frozen index tests...\n");
+
+    test_freeze_lookups();
+    test_freeze_outlives_tree();
+    test_freeze_failed_copy();
+
+    printf("Starting serialization tests...\n");
+
+    test_save_load();
+    test_load_rejects_bad_files();
+    test_mapped_tree();
+
+    printf("Starting dump tests...\n");
+
+    test_dump_formats();
+    test_dump_limits();
+    test_dump_callback();
+
+    printf("Starting stats tests...\n");
+
+    test_stats_counts();
+    test_stats_fix_states();
+
+    printf("Starting validation tests...\n");
+
+    test_validate_detects_corruption();
+    test_profile_shapes();
+    test_random_workload_invariants();
+
+    printf("Starting node handle tests...\n");
+
+    test_erase_by_iterator();
+    test_extract_insert_between_trees();
+    test_extract_insert_separate_pools();
+    test_node_handle_outlives_tree();
 
     printf("All unit tests PASSED\n");
 }
@@ -89,6 +227,67 @@ void test_insert_three_unbalanced_nodes_double_rotation()
     );
 }
 
+void test_insert_duplicate()
+{
+    RBTree<int> tree;
+    RBTree<int>::NodePtr first = tree.insert(20);
+    tree.insert(10);
+
+    assert(tree.insert(20) == first);
+    assert(tree.get_root() == first && tree.get_root()->left->data == 10);
+}
+
+void test_insert_rvalue()
+{
+    RBTree<std::string> tree;
+    std::string key(64, 'k');
+    tree.insert(std::move(key));
+
+    assert(tree.get_root()->data == std::string(64, 'k'));
+}
+
+namespace {
+
+struct Tracked
+{
+    static int constructed;
+
+    int key;
+
+    Tracked() : key(0) {}
+    Tracked(int k, int) : key(k) { ++constructed; }
+
+    bool operator<(const Tracked& other) const { return key < other.key; }
+};
+
+int Tracked::constructed = 0;
+
+bool operator<(const Tracked& lhs, int rhs) { return lhs.key < rhs; }
+bool operator<(int lhs, const Tracked& rhs) { return lhs < rhs.key; }
+
+}
+
+void test_emplace()
+{
+    RBTree<std::pair<int, int>> tree;
+    auto inserted = tree.emplace(1, 2);
+    auto duplicate = tree.emplace(1, 2);
+
+    assert(inserted.second && inserted.first->data.second == 2);
+    assert(!duplicate.second && duplicate.first == inserted.first);
+}
+
+void test_try_emplace()
+{
+    RBTree<Tracked, std::less<>> tree;
+    Tracked::constructed = 0;
+
+    auto inserted = tree.try_emplace(5, 5, 0);
+    auto duplicate = tree.try_emplace(5, 5, 0);
+
+    assert(inserted.second && !duplicate.second);
+    assert(duplicate.first == inserted.first && Tracked::constructed == 1);
+}
 
 void test_find_empty_tree()
 {
@@ -121,6 +320,37 @@ void test_find_non_existing_node()
     assert(tree.is_terminal(tree.find(50)));
 }
 
+void test_find_custom_compare()
+{
+    RBTree<int, std::greater<int>> tree;
+    tree.insert(10);
+    tree.insert(20);
+    tree.insert(30);
+
+    assert(
+        tree.get_root()->data == 20
+        && tree.get_root()->left->data == 30
+        && tree.get_root()->right->data == 10
+        && tree.find(10)->data == 10
+        && tree.is_terminal(tree.find(15))
+    );
+}
+
+void test_find_heterogeneous()
+{
+    RBTree<std::string, std::less<>> tree;
+    tree.insert("apple");
+    tree.insert("banana");
+    tree.insert("cherry");
+
+    assert(tree.find(std::string_view("banana"))->data == "banana");
+    assert(tree.find("cherry")->data == "cherry");
+    assert(tree.is_terminal(tree.find(std::string_view("durian"))));
+
+    tree.remove(std::string_view("apple"));
+    assert(tree.is_terminal(tree.find("apple")));
+}
+
 void test_remove_when_internal_node()
 {
     RBTree<int> tree;
@@ -218,3 +448,2398 @@ void test_remove_when_red_sibling()
     );
 }
 
+void test_remove_root()
+{
+    RBTree<int> tree;
+    tree.insert(10);
+    tree.insert(20);
+
+	tree.remove(10);
+    assert(tree.get_root()->data == 20 && tree.is_black(tree.get_root()));
+
+	tree.remove(20);
+    assert(tree.is_terminal(tree.get_root()));
+}
+
+namespace {
+
+struct CountedKey
+{
+    static std::size_t comparisons;
+
+    int key;
+
+    CountedKey(int k = 0) : key(k) {}
+
+    bool operator<(const CountedKey& other) const
+    {
+        ++comparisons;
+        return key < other.key;
+    }
+
+};
+
+std::size_t CountedKey::comparisons = 0;
+
+// Red-black height never exceeds 2 * log2(n + 1), a single descent must
+// stay within per_level comparisons per level of that bound.
+std::size_t comparisons_bound(std::size_t n, std::size_t per_level)
+{
+    std::size_t log2n = 0;
+    while ((std::size_t(1) << log2n) < n + 1) ++log2n;
+    return per_level * 2 * log2n + per_level;
+}
+
+std::vector<int> shuffled_keys(int n)
+{
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; ++i) keys[i] = i;
+    std::mt19937 rng(42);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    return keys;
+}
+
+}
+
+void test_insert_comparisons_logarithmic()
+{
+    const int n = 1 << 14;
+
+    // ascending keys keep triggering the recoloring cascade
+    RBTree<CountedKey> ascending;
+    for (int i = 0; i < n; ++i)
+    {
+        CountedKey::comparisons = 0;
+        ascending.insert(CountedKey(i));
+        assert(CountedKey::comparisons <= comparisons_bound(i + 1, 1));
+    }
+
+    RBTree<CountedKey> random;
+    int inserted = 0;
+    for (int key: shuffled_keys(n))
+    {
+        CountedKey::comparisons = 0;
+        random.insert(CountedKey(key));
+        assert(CountedKey::comparisons <= comparisons_bound(++inserted, 1));
+    }
+}
+
+void test_remove_comparisons_logarithmic()
+{
+    const int n = 1 << 14;
+
+    RBTree<CountedKey> tree;
+    for (int i = 0; i < n; ++i)
+    {
+        tree.insert(CountedKey(i));
+    }
+
+    for (int key: shuffled_keys(n))
+    {
+        CountedKey::comparisons = 0;
+        tree.remove(CountedKey(key));
+        assert(CountedKey::comparisons <= comparisons_bound(n, 1));
+    }
+
+    assert(tree.is_terminal(tree.get_root()));
+}
+
+void test_clear_tree()
+{
+    RBTree<std::string> tree;
+    for(int i = 0; i < 100; ++i)
+    {
+        tree.insert(std::to_string(i));
+    }
+
+    tree.clear();
+    assert(tree.is_terminal(tree.get_root()));
+
+    tree.insert("a");
+    assert(tree.find("a")->data == "a");
+}
+
+void test_copy_tree()
+{
+    RBTree<int> tree;
+    std::vector<int> to_be_inserted { 15, 10, 20, 5, 13, 18, 25 };
+    for(const auto& v: to_be_inserted)
+    {
+        tree.insert(v);
+    }
+
+    RBTree<int> copy(tree);
+    tree.remove(15);
+
+    assert(
+        copy.get_root()->data == 15 && copy.is_black(copy.get_root())
+        && copy.get_root()->left->data == 10
+        && copy.get_root()->right->data == 20
+        && copy.get_root()->left->parent() == copy.get_root()
+        && tree.is_terminal(tree.find(15)) && !copy.is_terminal(copy.find(15))
+    );
+}
+
+void test_move_tree()
+{
+    RBTree<int> tree;
+    tree.insert(20);
+    tree.insert(30);
+    tree.insert(10);
+
+    RBTree<int> moved(std::move(tree));
+    assert(moved.get_root()->data == 20);
+    assert(tree.is_terminal(tree.get_root()));
+
+    // moves only swap pointers, containers move trees without copying
+    static_assert(std::is_nothrow_move_constructible<RBTree<int>>::value, "tree moves may throw");
+    static_assert(std::is_nothrow_move_assignable<RBTree<int>>::value, "tree moves may throw");
+    std::vector<RBTree<int>> trees;
+    std::vector<RBTree<int>::NodePtr> roots;
+    for (int i = 0; i < 100; ++i)
+    {
+        trees.emplace_back();
+        for (int key = 0; key < 10; ++key) trees.back().insert(i * 10 + key);
+        roots.push_back(trees.back().get_root());
+    }
+    for (int i = 0; i < 100; ++i) assert(trees[i].get_root() == roots[i] && trees[i].size() == 10);
+
+    // the moved-from tree is empty, then takes storage of its own
+    assert(tree.empty() && tree.size() == 0 && tree.begin() == tree.end() && !tree.contains(20));
+    assert(tree.validate());
+    tree.insert(1);
+    assert(!tree.shares_storage(moved) && tree.validate());
+    moved = std::move(tree);
+    assert(moved.size() == 1 && *moved.begin() == 1 && tree.empty());
+    moved = std::move(moved);
+    assert(moved.size() == 1 && *moved.begin() == 1);
+    tree = moved;
+    tree.union_with(trees[50]);
+    assert(tree.size() == 11 && trees[50].empty() && tree.validate());
+}
+
+namespace {
+
+// orders either way, chosen at run time
+struct FlaggedLess
+{
+    bool reversed = false;
+    bool operator()(int a, int b) const { return reversed ? b < a : a < b; }
+};
+
+}
+
+void test_assign_stateful_compare()
+{
+    RBTree<int, FlaggedLess> descending(FlaggedLess { true });
+    for (int key = 0; key < 100; ++key) descending.insert(key);
+
+    // the comparator travels with the nodes it ordered
+    RBTree<int, FlaggedLess> tree;
+    tree = descending;
+    for (int key = 100; key < 200; ++key) tree.insert(key);
+    assert(tree.validate() && tree.size() == 200 && *tree.begin() == 199);
+
+    RBTree<int, FlaggedLess> moved;
+    moved = std::move(tree);
+    moved.remove(150);
+    assert(moved.validate() && moved.size() == 199 && !moved.contains(150) && *moved.rbegin() == 0);
+    assert(tree.validate() && tree.empty());
+}
+
+namespace {
+
+// atomic, the parallel tests allocate from several threads
+std::atomic<std::size_t> live_allocations { 0 };
+
+template<typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
+
+    CountingAllocator() = default;
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(std::size_t n)
+    {
+        ++live_allocations;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        --live_allocations;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template<typename U>
+    bool operator==(const CountingAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+}
+
+void test_custom_allocator()
+{
+    {
+        RBTree<int, std::less<int>, CountingAllocator<int>> tree;
+        for(int i = 0; i < 1000; ++i)
+        {
+            tree.insert(i);
+        }
+        for(int i = 0; i < 1000; i += 2)
+        {
+            tree.remove(i);
+        }
+
+        // nodes come from slabs, not one allocation per key
+        assert(live_allocations > 0 && live_allocations < 16);
+        assert(tree.find(501)->data == 501 && tree.is_terminal(tree.find(500)));
+    }
+
+    assert(live_allocations == 0);
+}
+
+void test_compact_node_layout()
+{
+    // value, two children and the parent link, which carries the color
+    typedef RBTree<int>::Node Node;
+    assert(sizeof(Node) == 4 * sizeof(void*));
+
+    Node node;
+    assert(static_cast<void*>(&node.data) == static_cast<void*>(&node));
+    assert(node.color() == Node::node_color::BLACK && node.parent() == nullptr);
+
+    node.set_color(Node::node_color::RED);
+    node.set_parent(&node);
+    assert(node.color() == Node::node_color::RED && node.parent() == &node);
+    node.set_parent(nullptr);
+    assert(node.color() == Node::node_color::RED && node.parent() == nullptr);
+}
+
+void test_iterate_empty_tree()
+{
+    RBTree<int> tree;
+    assert(tree.begin() == tree.end() && tree.rbegin() == tree.rend());
+
+    tree.insert(1);
+    tree.remove(1);
+    assert(tree.empty() && tree.begin() == tree.end());
+}
+
+void test_iterate_in_order()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(1000))
+    {
+        tree.insert(key);
+    }
+
+    int expected = 0;
+    for (int key: tree)
+    {
+        assert(key == expected++);
+    }
+    assert(expected == 1000);
+
+    const RBTree<int>& const_tree = tree;
+    RBTree<int>::const_iterator itr = const_tree.begin();
+    assert(*itr == 0 && *++itr == 1 && *--itr == 0);
+}
+
+void test_iterate_reverse()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(1000))
+    {
+        tree.insert(key);
+    }
+
+    assert(*--tree.end() == 999);
+
+    int expected = 999;
+    for (auto itr = tree.rbegin(); itr != tree.rend(); ++itr)
+    {
+        assert(*itr == expected--);
+    }
+    assert(expected == -1);
+}
+
+void test_iterate_after_remove()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(1000))
+    {
+        tree.insert(key);
+    }
+
+    // keep an iterator while its neighbours and both ends go away
+    RBTree<int>::iterator kept = tree.iterator_to(tree.find(500));
+    for (int key = 0; key < 1000; ++key)
+    {
+        if (key != 500 && key % 2 == 0) tree.remove(key);
+    }
+    tree.remove(999);
+    tree.remove(1);
+
+    assert(*tree.begin() == 3 && *tree.rbegin() == 997);
+    assert(*std::prev(kept) == 499 && *std::next(kept) == 501);
+    assert(std::distance(tree.begin(), tree.end()) == 499);
+}
+
+void test_iterate_map()
+{
+    RBMap<std::string, int> map;
+    map["b"] = 2;
+    map["c"] = 3;
+    map["a"] = 1;
+
+    std::string keys;
+    for (auto& entry: map)
+    {
+        keys += entry.first;
+        entry.second *= 10;
+    }
+
+    assert(keys == "abc" && map["a"] == 10 && map["c"] == 30);
+}
+
+// Plain trees must not pay for the subtree size field.
+static_assert(sizeof(RBTreeNode<int>) < sizeof(RBTreeNode<int, true>), "");
+
+void test_size()
+{
+    RBTree<int> tree;
+    assert(tree.size() == 0);
+
+    for (int key: shuffled_keys(100))
+    {
+        tree.insert(key);
+    }
+    tree.insert(5);
+    assert(tree.size() == 100);
+
+    tree.remove(5);
+    tree.remove(1000);
+    assert(tree.size() == 99);
+
+    RBTree<int> copy(tree);
+    tree.clear();
+    assert(tree.size() == 0 && copy.size() == 99);
+}
+
+void test_select()
+{
+    RBOrderStatTree<int> tree;
+    for (int key: shuffled_keys(1000))
+    {
+        tree.insert(key * 2);
+    }
+
+    for (std::size_t k = 0; k < 1000; ++k)
+    {
+        assert(tree.select(k)->data == int(k * 2));
+    }
+    assert(tree.is_terminal(tree.select(1000)));
+    assert(tree.get_root()->size == tree.size());
+}
+
+void test_rank()
+{
+    RBOrderStatTree<int> tree;
+    for (int key: shuffled_keys(1000))
+    {
+        tree.insert(key * 2);
+    }
+
+    assert(tree.rank(-1) == 0 && tree.rank(0) == 0);
+    assert(tree.rank(1) == 1 && tree.rank(2) == 1 && tree.rank(3) == 2);
+    assert(tree.rank(1998) == 999 && tree.rank(5000) == 1000);
+}
+
+void test_order_statistics_after_removals()
+{
+    RBOrderStatTree<int> tree;
+    std::vector<int> keys = shuffled_keys(2000);
+    for (int key: keys)
+    {
+        tree.insert(key);
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 2)
+    {
+        tree.remove(keys[i]);
+    }
+
+    std::size_t k = 0;
+    for (int key: tree)
+    {
+        assert(tree.select(k)->data == key && tree.rank(key) == k);
+        ++k;
+    }
+    assert(k == 1000 && tree.size() == 1000 && tree.get_root()->size == 1000);
+
+    RBOrderStatTree<int> copy(tree);
+    assert(copy.select(500)->data == tree.select(500)->data);
+}
+
+void test_lower_upper_bound()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(100))
+    {
+        tree.insert(key * 2);
+    }
+
+    assert(*tree.lower_bound(10) == 10 && *tree.upper_bound(10) == 12);
+    assert(*tree.lower_bound(11) == 12 && *tree.upper_bound(11) == 12);
+    assert(*tree.lower_bound(-5) == 0);
+    assert(tree.lower_bound(199) == tree.end() && tree.upper_bound(198) == tree.end());
+}
+
+void test_equal_range()
+{
+    RBTree<std::string, std::less<>> tree;
+    tree.insert("a");
+    tree.insert("c");
+
+    auto found = tree.equal_range(std::string_view("a"));
+    auto missing = tree.equal_range(std::string_view("b"));
+
+    assert(*found.first == "a" && *found.second == "c");
+    assert(missing.first == missing.second && *missing.first == "c");
+}
+
+void test_for_each_in_range()
+{
+    RBTree<CountedKey> tree;
+    for (int key: shuffled_keys(1 << 14))
+    {
+        tree.insert(CountedKey(key));
+    }
+
+    std::vector<int> visited;
+    CountedKey::comparisons = 0;
+    tree.for_each_in_range(CountedKey(100), CountedKey(110), [&](const CountedKey& key) {
+        visited.push_back(key.key);
+    });
+
+    // one descent to the lower key and a bound check per visited key
+    assert(CountedKey::comparisons <= comparisons_bound(1 << 14, 1) + 11);
+    assert(visited.size() == 10 && visited.front() == 100 && visited.back() == 109);
+
+    visited.clear();
+    tree.for_each_in_range(CountedKey(50), CountedKey(50), [&](const CountedKey& key) {
+        visited.push_back(key.key);
+    });
+    assert(visited.empty());
+}
+
+void test_count_range()
+{
+    RBOrderStatTree<int> tree;
+    for (int key: shuffled_keys(1000))
+    {
+        tree.insert(key);
+    }
+
+    assert(tree.count_range(100, 200) == 100);
+    assert(tree.count_range(-50, 50) == 50);
+    assert(tree.count_range(990, 5000) == 10);
+    assert(tree.count_range(200, 100) == 0);
+}
+
+namespace {
+
+template<typename Tree>
+bool is_valid_rbtree(Tree& tree)
+{
+    return tree.validate();
+}
+
+}
+
+void test_build_from_sorted()
+{
+    for (int n: { 0, 1, 2, 3, 4, 7, 8, 100, 1023, 1024, 1025 })
+    {
+        std::vector<int> keys(n);
+        for (int i = 0; i < n; ++i) keys[i] = i;
+
+        RBOrderStatTree<int> tree(keys.begin(), keys.end());
+        assert(tree.size() == std::size_t(n) && is_valid_rbtree(tree));
+        assert(std::equal(tree.begin(), tree.end(), keys.begin(), keys.end()));
+        if (n > 0)
+        {
+            assert(tree.get_root()->size == std::size_t(n));
+            assert(tree.select(n / 3)->data == n / 3);
+        }
+    }
+}
+
+void test_build_from_unsorted()
+{
+    RBMap<int, std::string> map;
+    std::vector<std::pair<int, std::string>> entries {
+        { 3, "c" }, { 1, "a" }, { 2, "b" }, { 1, "dup" }, { 3, "dup" }
+    };
+    map.build_from_sorted(entries.begin(), entries.end());
+
+    assert(map.size() == 3 && is_valid_rbtree(map));
+    assert(map[1] == "a" && map[2] == "b" && map[3] == "c");
+}
+
+void test_build_from_input_iterator()
+{
+    std::istringstream input("1 2 2 3 5 8");
+    RBTree<int> tree((std::istream_iterator<int>(input)), std::istream_iterator<int>());
+
+    std::vector<int> expected { 1, 2, 3, 5, 8 };
+    assert(tree.size() == 5 && is_valid_rbtree(tree));
+    assert(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+}
+
+void test_build_single_slab()
+{
+    std::vector<int> keys(10000);
+    for (int i = 0; i < 10000; ++i) keys[i] = i;
+
+    live_allocations = 0;
+    {
+        RBTree<int, std::less<int>, CountingAllocator<int>> tree;
+        tree.build_from_sorted(keys.begin(), keys.end());
+
+        // the pool itself and a single slab for the keys
+        assert(live_allocations == 2 && tree.size() == 10000);
+    }
+    assert(live_allocations == 0);
+}
+
+void test_build_then_modify()
+{
+    std::vector<int> keys;
+    for (int i = 0; i < 1000; i += 2) keys.push_back(i);
+
+    RBTree<int> tree(keys.begin(), keys.end());
+    for (int i = 1; i < 1000; i += 4) tree.insert(i);
+    for (int i = 0; i < 1000; i += 8) tree.remove(i);
+
+    assert(tree.size() == 500 - 125 + 250 && is_valid_rbtree(tree));
+    assert(*tree.begin() == 1 && *tree.rbegin() == 998);
+}
+
+void test_map_subscript()
+{
+    RBMap<std::string, int> map;
+    map["b"] = 2;
+    map["a"] = 1;
+    map["c"] += 3;
+
+    assert(map.get_root()->data.first == "b" && map.get_root()->data.second == 2);
+    assert(map["a"] == 1 && map["c"] == 3 && map.at("c") == 3);
+
+    bool thrown = false;
+    try
+    {
+        map.at("d");
+    }
+    catch (const std::out_of_range&)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_map_insert_or_assign()
+{
+    RBMap<int, std::string> map;
+    auto inserted = map.insert_or_assign(1, "one");
+    auto assigned = map.insert_or_assign(1, "uno");
+
+    assert(inserted.second && !assigned.second);
+    assert(assigned.first == inserted.first && map.find(1)->data.second == "uno");
+}
+
+namespace {
+
+// Neither default constructible nor copyable, and loud when moved.
+struct Payload
+{
+    static int moves;
+
+    int value;
+
+    explicit Payload(int v) : value(v) {}
+    Payload(const Payload&) = delete;
+    Payload(Payload&& other) : value(other.value) { ++moves; }
+    Payload& operator=(const Payload&) = delete;
+    Payload& operator=(Payload&& other)
+    {
+        value = other.value;
+        ++moves;
+        return *this;
+    }
+};
+
+int Payload::moves = 0;
+
+}
+
+void test_map_try_emplace()
+{
+    RBMap<int, Payload> map;
+    Payload::moves = 0;
+
+    auto inserted = map.try_emplace(1, 10);
+    auto duplicate = map.try_emplace(1, 20);
+
+    assert(inserted.second && !duplicate.second);
+    assert(map.find(1)->data.second.value == 10 && Payload::moves == 0);
+}
+
+void test_map_values_stay_in_place()
+{
+    RBMap<int, Payload> map;
+    std::vector<const Payload*> addresses;
+    const int n = 512;
+    for (int i = 0; i < n; ++i)
+    {
+        addresses.push_back(&map.try_emplace(i, i).first->data.second);
+    }
+
+    Payload::moves = 0;
+    for (int i = 0; i < n; i += 3)
+    {
+        map.remove(i);
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (i % 3 == 0)
+        {
+            assert(map.is_terminal(map.find(i)));
+            continue;
+        }
+        assert(&map.find(i)->data.second == addresses[i]);
+        assert(map.find(i)->data.second.value == i);
+    }
+    assert(Payload::moves == 0);
+}
+
+namespace {
+
+template<typename Tree>
+std::vector<int> contents(const Tree& tree)
+{
+    return std::vector<int>(tree.begin(), tree.end());
+}
+
+std::vector<int> every_nth(int n, int step, int offset = 0)
+{
+    std::vector<int> keys;
+    for (int i = offset; i < n; i += step) keys.push_back(i);
+    return keys;
+}
+
+}
+
+void test_split()
+{
+    const int n = 1000;
+    for (int key: { -1, 0, 1, 500, 501, 999, 1000 })
+    {
+        std::vector<int> keys = every_nth(n, 1);
+        RBOrderStatTree<int> tree(keys.begin(), keys.end());
+        RBOrderStatTree<int> upper = tree.split(key);
+
+        int pivot = std::clamp(key, 0, n);
+        assert(is_valid_rbtree(tree) && is_valid_rbtree(upper));
+        assert(tree.size() == std::size_t(pivot) && upper.size() == std::size_t(n - pivot));
+        assert(contents(tree) == std::vector<int>(keys.begin(), keys.begin() + pivot));
+        assert(contents(upper) == std::vector<int>(keys.begin() + pivot, keys.end()));
+        if (pivot < n) assert(upper.select(0)->data == pivot && upper.rank(pivot + 1) == 1);
+    }
+
+    // without order statistics the halves get counted on demand
+    std::vector<int> keys = shuffled_keys(n);
+    RBTree<int> tree(keys.begin(), keys.end());
+    RBTree<int> upper = tree.split(300);
+    assert(tree.size() == 300 && upper.size() == 700);
+    upper.insert(-1);
+    assert(upper.size() == 701 && tree.find(-1) == tree._TNULL);
+}
+
+void test_split_comparisons_logarithmic()
+{
+    const int n = 1 << 14;
+    std::vector<CountedKey> keys;
+    for (int i = 0; i < n; ++i) keys.push_back(CountedKey(i));
+
+    for (int key: { 0, n / 3, n / 2, n - 1 })
+    {
+        RBTree<CountedKey> tree(keys.begin(), keys.end());
+        CountedKey::comparisons = 0;
+        RBTree<CountedKey> upper = tree.split(CountedKey(key));
+        assert(CountedKey::comparisons <= comparisons_bound(n, 2));
+        assert(is_valid_rbtree(tree) && is_valid_rbtree(upper));
+    }
+}
+
+void test_join()
+{
+    // trees of very different heights, both ways round
+    for (int split: { 0, 1, 7, 500, 993, 999 })
+    {
+        std::vector<int> keys = every_nth(1000, 1);
+        keys.erase(keys.begin() + split);
+        RBOrderStatTree<int> tree(keys.begin(), keys.end());
+        RBOrderStatTree<int> right = tree.split(split);
+
+        tree.join(split, right);
+        assert(right.empty() && is_valid_rbtree(tree));
+        assert(tree.size() == 1000 && contents(tree) == every_nth(1000, 1));
+        assert(tree.select(split)->data == split);
+
+        RBOrderStatTree<int> upper = tree.split(split);
+        tree.join(upper);
+        assert(upper.empty() && is_valid_rbtree(tree) && tree.size() == 1000);
+    }
+
+    RBTree<int> tree;
+    RBTree<int> right;
+    tree.insert(1);
+    right.insert(5);
+    bool thrown = false;
+    try
+    {
+        tree.join(7, right);
+    }
+    catch (const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    assert(thrown && tree.size() == 1 && right.size() == 1);
+
+    // independent trees are not joined, union_with() merges them
+    RBTree<int> lower;
+    thrown = false;
+    try
+    {
+        tree.join(3, right);
+    }
+    catch (const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    assert(thrown && !tree.shares_storage(right) && tree.size() == 1 && right.size() == 1);
+    // unless one of them is empty
+    lower.join(0, tree);
+    tree.join(right);
+    assert(contents(lower) == std::vector<int>({ 0, 1 }) && contents(tree) == std::vector<int>({ 5 }));
+    tree.join(8, right);
+    assert(right.empty() && contents(tree) == std::vector<int>({ 5, 8 }) && is_valid_rbtree(tree));
+}
+
+void test_union_independent_comparisons()
+{
+    // the smaller of two independent trees is relinked to the other,
+    // the merge stays within O(m log(n/m + 1)) comparisons
+    const int n = 1 << 14;
+    std::vector<CountedKey> keys;
+    for (int i = 0; i < n; ++i) keys.push_back(CountedKey(2 * i));
+
+    for (int m: { 1, 8, 64 })
+    {
+        RBTree<CountedKey> big(keys.begin(), keys.end());
+        RBTree<CountedKey> small;
+        for (int i = 0; i < m; ++i) small.insert(CountedKey(2 * n / m * i + 1));
+        for (RBTree<CountedKey>* tree: { &big, &small })
+        {
+            RBTree<CountedKey> other;
+            if (tree == &big) other = RBTree<CountedKey>(small);
+            else other = RBTree<CountedKey>(big);
+
+            CountedKey::comparisons = 0;
+            tree->union_with(other);
+            assert(CountedKey::comparisons <= comparisons_bound(n / m, 4 * m));
+            assert(tree->size() == std::size_t(n + m) && other.empty() && is_valid_rbtree(*tree));
+        }
+    }
+}
+
+void test_union_with()
+{
+    std::vector<int> evens = every_nth(2000, 2);
+    std::vector<int> thirds = every_nth(3000, 3);
+    std::vector<int> expected;
+    std::set_union(evens.begin(), evens.end(), thirds.begin(), thirds.end(), std::back_inserter(expected));
+
+    // independent trees first get to share their storage
+    RBOrderStatTree<int> tree(evens.begin(), evens.end());
+    RBOrderStatTree<int> other(thirds.begin(), thirds.end());
+    tree.union_with(other);
+    assert(other.empty() && is_valid_rbtree(tree));
+    assert(tree.size() == expected.size() && contents(tree) == expected);
+    assert(tree.select(expected.size() / 2)->data == expected[expected.size() / 2]);
+
+    RBTree<int> small;
+    small.insert(5);
+    RBTree<int> large(evens.begin(), evens.end());
+    small.union_with(std::move(large));
+    assert(small.size() == evens.size() + 1 && is_valid_rbtree(small));
+}
+
+void test_intersect_with()
+{
+    std::vector<int> evens = every_nth(2000, 2);
+    std::vector<int> thirds = every_nth(3000, 3);
+    std::vector<int> expected;
+    std::set_intersection(evens.begin(), evens.end(), thirds.begin(), thirds.end(), std::back_inserter(expected));
+
+    RBTree<int> tree(evens.begin(), evens.end());
+    tree.intersect_with(RBTree<int>(thirds.begin(), thirds.end()));
+    assert(is_valid_rbtree(tree) && tree.size() == expected.size() && contents(tree) == expected);
+
+    tree.intersect_with(RBTree<int>());
+    assert(tree.empty() && tree.size() == 0);
+}
+
+void test_difference_with()
+{
+    std::vector<int> evens = every_nth(2000, 2);
+    std::vector<int> thirds = every_nth(3000, 3);
+    std::vector<int> expected;
+    std::set_difference(evens.begin(), evens.end(), thirds.begin(), thirds.end(), std::back_inserter(expected));
+
+    RBOrderStatTree<int> tree(evens.begin(), evens.end());
+    tree.difference_with(RBOrderStatTree<int>(thirds.begin(), thirds.end()));
+    assert(is_valid_rbtree(tree) && tree.size() == expected.size() && contents(tree) == expected);
+    assert(tree.rank(1000) == std::size_t(std::lower_bound(expected.begin(), expected.end(), 1000) - expected.begin()));
+}
+
+void test_set_operations_reuse_nodes()
+{
+    RBMap<int, Payload> map;
+    RBMap<int, Payload> other;
+    for (int i = 0; i < 300; ++i) map.try_emplace(i, i);
+    for (int i = 200; i < 600; ++i) other.try_emplace(i, -i);
+
+    std::vector<const Payload*> addresses;
+    for (int i = 0; i < 600; ++i)
+    {
+        addresses.push_back(&(i < 300 ? map : other).find(i)->data.second);
+    }
+
+    Payload::moves = 0;
+    map.union_with(other);
+    assert(map.validate() && map.size() == 600 && Payload::moves == 0);
+    for (int i = 0; i < 600; ++i)
+    {
+        // the values of the tree united into lose the ties
+        assert(&map.find(i)->data.second == addresses[i]);
+        assert(map.at(i).value == (i < 300 ? i : -i));
+    }
+
+    // nodes keep moving back and forth between split halves
+    live_allocations = 0;
+    {
+        std::vector<int> keys = shuffled_keys(4000);
+        RBTree<int, std::less<int>, CountingAllocator<int>> tree(keys.begin(), keys.end());
+        std::size_t allocations = live_allocations;
+        for (int key: shuffled_keys(200))
+        {
+            auto upper = tree.split(key * 20);
+            auto middle = upper.split(key * 20 + 10);
+            tree.union_with(middle);
+            tree.union_with(upper);
+        }
+        assert(live_allocations == allocations && is_valid_rbtree(tree) && tree.size() == 4000);
+    }
+    assert(live_allocations == 0);
+}
+
+void test_split_outlives_source()
+{
+    RBTree<std::string> upper;
+    {
+        RBTree<std::string> tree;
+        for (int i = 0; i < 100; ++i) tree.insert(std::to_string(1000 + i));
+        upper = tree.split("1050");
+        tree.insert("0");
+    }
+
+    upper.insert("2000");
+    upper.remove("1050");
+    assert(upper.size() == 50 && is_valid_rbtree(upper));
+    assert(*upper.begin() == "1051" && *upper.rbegin() == "2000");
+}
+
+void test_set_operations_leave_other_independent()
+{
+    typedef RBTree<int, std::less<int>, CountingAllocator<int>> Tree;
+    for (int op = 0; op < 4; ++op)
+    {
+        {
+            Tree tree;
+            Tree other;
+            for (int key = 0; key < 2000; ++key)
+            {
+                if (key % 3) tree.insert(key);
+                else other.insert(op == 3 ? key + 4000 : key);
+            }
+
+            if (op == 0) tree.union_with(other);
+            else if (op == 1) tree.intersect_with(other);
+            else if (op == 2) tree.difference_with(other);
+            else tree.union_with(std::move(other));
+            assert(other.empty() && is_valid_rbtree(tree) && is_valid_rbtree(other));
+
+            // other lives on its own storage, both trees change in parallel
+            auto churn = [](Tree& changed, int first) {
+                for (int key = first; key < first + 3000; ++key) changed.insert(key);
+                for (int key = first; key < first + 3000; key += 2) changed.remove(key);
+            };
+            std::thread tree_thread(churn, std::ref(tree), 10000);
+            std::thread other_thread(churn, std::ref(other), 20000);
+            tree_thread.join();
+            other_thread.join();
+            assert(is_valid_rbtree(tree) && is_valid_rbtree(other) && other.size() == 1500);
+
+            // and releases its slabs in one go
+            std::size_t before = live_allocations;
+            other.clear();
+            assert(live_allocations < before);
+            other.insert(1);
+            assert(is_valid_rbtree(other));
+        }
+        assert(live_allocations == 0);
+    }
+}
+
+void test_split_keeps_size()
+{
+    // plain trees keep an exact count through split, join and updates
+    for (int at: { -1, 0, 1, 777, 2999, 3000, 5000 })
+    {
+        RBTree<int> tree;
+        for (int key = 0; key < 3000; ++key) tree.insert(key);
+        RBTree<int> upper = tree.split(at);
+
+        std::size_t below = std::min(std::max(at, 0), 3000);
+        assert(tree.size() == below && upper.size() == 3000 - below);
+        assert(is_valid_rbtree(tree) && is_valid_rbtree(upper));
+
+        upper.insert(9000);
+        tree.insert(-9000);
+        assert(upper.size() == std::size_t(std::distance(upper.begin(), upper.end())));
+        assert(tree.size() == std::size_t(std::distance(tree.begin(), tree.end())));
+        upper.remove(9000);
+        tree.remove(-9000);
+
+        tree.join(upper);
+        assert(tree.size() == 3000 && upper.empty() && is_valid_rbtree(tree));
+        RBTree<int> rest = tree.split(1500);
+        tree.union_with(rest);
+        assert(tree.size() == 3000 && rest.size() == 0 && is_valid_rbtree(tree));
+    }
+}
+
+void test_insert_batch()
+{
+    std::vector<int> evens = every_nth(2000, 2);
+    std::vector<int> batch = shuffled_keys(3000);
+    batch.insert(batch.end(), evens.begin(), evens.end());
+
+    RBOrderStatTree<int> tree(evens.begin(), evens.end());
+    assert(tree.insert_batch(batch.begin(), batch.end()) == 2000);
+    assert(is_valid_rbtree(tree) && tree.size() == 3000 && contents(tree) == every_nth(3000, 1));
+    assert(tree.select(1500)->data == 1500);
+    assert(tree.insert_batch(evens.begin(), evens.end()) == 0 && tree.size() == 3000);
+
+    // batches landing beyond, between and before the stored keys
+    RBTree<int> plain;
+    std::vector<int> empty;
+    assert(plain.insert_batch(empty.begin(), empty.end()) == 0 && plain.empty());
+    for (int offset: { 1000, 0, 500 })
+    {
+        std::vector<int> keys = every_nth(offset + 100, 1, offset);
+        assert(plain.insert_batch(keys.rbegin(), keys.rend()) == 100);
+        assert(is_valid_rbtree(plain));
+    }
+    assert(plain.size() == 300 && *plain.begin() == 0 && *plain.rbegin() == 1099);
+
+    // the first of equivalent values wins, stored values are kept
+    RBMap<int, std::string> map;
+    map.try_emplace(1, "stored");
+    std::vector<std::pair<const int, std::string>> values {
+        { 2, "first" }, { 1, "ignored" }, { 2, "second" }, { 0, "zero" } };
+    assert(map.insert_batch(values.begin(), values.end()) == 2);
+    assert(map.at(0) == "zero" && map.at(1) == "stored" && map.at(2) == "first");
+}
+
+void test_erase_batch()
+{
+    std::vector<int> keys = every_nth(3000, 1);
+    std::vector<int> batch = shuffled_keys(4000);
+    batch.erase(std::remove_if(batch.begin(), batch.end(), [](int key) { return key % 3 == 0; }), batch.end());
+    batch.insert(batch.end(), batch.begin(), batch.begin() + 100);
+
+    RBOrderStatTree<int> tree(keys.begin(), keys.end());
+    assert(tree.erase_batch(batch.begin(), batch.end()) == 2000);
+    assert(is_valid_rbtree(tree) && tree.size() == 1000 && contents(tree) == every_nth(3000, 3));
+    assert(tree.rank(1500) == 500);
+
+    RBTree<int> plain(keys.begin(), keys.end());
+    assert(plain.erase_batch(keys.begin(), keys.end()) == 3000 && plain.empty() && plain.size() == 0);
+    assert(plain.erase_batch(keys.begin(), keys.end()) == 0);
+
+    RBMap<std::string, int> map;
+    for (int i = 0; i < 100; ++i) map.try_emplace(std::to_string(i), i);
+    std::vector<std::string> names { "7", "77", "x", "7" };
+    assert(map.erase_batch(names.begin(), names.end()) == 2);
+    assert(map.size() == 98 && map.validate());
+}
+
+void test_batch_comparisons()
+{
+    // a small batch costs about as many comparisons as searching its keys
+    const int n = 1 << 14;
+    const int k = 16;
+    std::vector<CountedKey> keys;
+    for (int i = 0; i < n; ++i) keys.push_back(CountedKey(2 * i));
+    std::vector<CountedKey> batch;
+    for (int i = 0; i < k; ++i) batch.push_back(CountedKey(2 * (i * n / k) + 1));
+
+    RBTree<CountedKey> tree(keys.begin(), keys.end());
+    std::size_t sorting = comparisons_bound(k, k);
+    CountedKey::comparisons = 0;
+    assert(tree.insert_batch(batch.begin(), batch.end()) == std::size_t(k));
+    assert(CountedKey::comparisons <= sorting + k * comparisons_bound(n, 2));
+    CountedKey::comparisons = 0;
+    assert(tree.erase_batch(batch.begin(), batch.end()) == std::size_t(k));
+    assert(CountedKey::comparisons <= sorting + k * comparisons_bound(n, 2));
+    assert(tree.size() == std::size_t(n) && is_valid_rbtree(tree));
+}
+
+namespace {
+
+long parallel_sum(RBTreeScheduler& scheduler, const int* first, std::size_t count)
+{
+    if (count <= 16) return std::accumulate(first, first + count, 0L);
+
+    long left = 0, right = 0;
+    std::size_t half = count / 2;
+    scheduler.fork_join(
+        [&]() { left = parallel_sum(scheduler, first, half); },
+        [&]() { right = parallel_sum(scheduler, first + half, count - half); });
+    return left + right;
+}
+
+}
+
+void test_scheduler_fork_join()
+{
+    std::vector<int> values = every_nth(100000, 1);
+    long expected = std::accumulate(values.begin(), values.end(), 0L);
+    for (std::size_t concurrency: { 0, 1, 2, 4 })
+    {
+        RBTreeScheduler scheduler(concurrency);
+        assert(scheduler.concurrency() == std::max<std::size_t>(concurrency, 1));
+        for (int round = 0; round < 10; ++round)
+        {
+            assert(parallel_sum(scheduler, values.data(), values.size()) == expected);
+        }
+    }
+}
+
+void test_scheduler_exceptions()
+{
+    RBTreeScheduler scheduler(4);
+    std::atomic<int> finished { 0 };
+    bool thrown = false;
+    try
+    {
+        scheduler.fork_join(
+            [&]() { ++finished; throw std::runtime_error("left"); },
+            [&]() { ++finished; throw std::logic_error("right"); });
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    assert(thrown && finished == 2);
+
+    // still in working order
+    std::vector<int> values = every_nth(1000, 1);
+    assert(parallel_sum(scheduler, values.data(), values.size()) == 499500);
+}
+
+void test_parallel_set_operations()
+{
+    RBTreeScheduler scheduler(4);
+    std::vector<int> evens = every_nth(20000, 2);
+    std::vector<int> thirds = every_nth(30000, 3);
+    std::vector<int> united, common, remaining;
+    std::set_union(evens.begin(), evens.end(), thirds.begin(), thirds.end(), std::back_inserter(united));
+    std::set_intersection(evens.begin(), evens.end(), thirds.begin(), thirds.end(), std::back_inserter(common));
+    std::set_difference(evens.begin(), evens.end(), thirds.begin(), thirds.end(), std::back_inserter(remaining));
+
+    for (std::size_t grain: { std::size_t(1), std::size_t(64), RBTree<int>::default_grain })
+    {
+        RBOrderStatTree<int> tree(evens.begin(), evens.end());
+        tree.parallel_union_with(RBOrderStatTree<int>(thirds.begin(), thirds.end()), scheduler, grain);
+        assert(is_valid_rbtree(tree) && tree.size() == united.size() && contents(tree) == united);
+        assert(tree.select(united.size() / 3)->data == united[united.size() / 3]);
+
+        tree.parallel_difference_with(RBOrderStatTree<int>(thirds.begin(), thirds.end()), scheduler, grain);
+        assert(is_valid_rbtree(tree) && tree.size() == remaining.size() && contents(tree) == remaining);
+
+        RBTree<int> plain(evens.begin(), evens.end());
+        plain.parallel_intersect_with(RBTree<int>(thirds.begin(), thirds.end()), scheduler, grain);
+        assert(is_valid_rbtree(plain) && plain.size() == common.size() && contents(plain) == common);
+        plain.insert(-1);
+        plain.remove(0);
+        assert(plain.size() == common.size() && is_valid_rbtree(plain));
+    }
+
+    // every node is still given back through the pools adopted on the way
+    live_allocations = 0;
+    {
+        std::vector<int> keys = shuffled_keys(20000);
+        RBTree<int, std::less<int>, CountingAllocator<int>> tree(keys.begin(), keys.begin() + 12000);
+        RBTree<int, std::less<int>, CountingAllocator<int>> other(keys.begin() + 8000, keys.end());
+        tree.parallel_union_with(other, scheduler, 64);
+        assert(tree.size() == 20000 && is_valid_rbtree(tree));
+    }
+    assert(live_allocations == 0);
+}
+
+void test_parallel_build_from_sorted()
+{
+    RBTreeScheduler scheduler(4);
+    for (int n: { 0, 1, 2, 63, 64, 65, 1000, 50000 })
+    {
+        std::vector<int> keys = every_nth(n, 1);
+        RBOrderStatTree<int> tree;
+        tree.parallel_build_from_sorted(keys.begin(), keys.end(), scheduler, 64);
+        assert(is_valid_rbtree(tree) && tree.size() == std::size_t(n) && contents(tree) == keys);
+        if (n > 0) assert(tree.select(n / 2)->data == n / 2);
+
+        // unsorted input with duplicates gets ordered first
+        std::vector<int> shuffled = shuffled_keys(n);
+        shuffled.insert(shuffled.end(), keys.begin(), keys.begin() + n / 2);
+        RBTree<int> plain;
+        plain.parallel_build_from_sorted(shuffled.begin(), shuffled.end(), scheduler, 64);
+        assert(is_valid_rbtree(plain) && plain.size() == std::size_t(n) && contents(plain) == keys);
+        plain.insert(n);
+        plain.remove(0);
+        assert(is_valid_rbtree(plain));
+    }
+
+    std::vector<std::string> words;
+    for (int i = 0; i < 5000; ++i) words.push_back(std::to_string(100000 + i));
+    RBTree<std::string> strings;
+    strings.parallel_build_from_sorted(words.begin(), words.end(), scheduler, 100);
+    assert(strings.size() == words.size() && std::equal(strings.begin(), strings.end(), words.begin()));
+}
+
+namespace {
+
+template<typename Tree>
+int persistent_black_height(const Tree& tree, typename Tree::NodePtr node)
+{
+    if (node == nullptr) return 1;
+
+    for (auto child: { node->left, node->right })
+    {
+        if (tree.is_red(node) && tree.is_red(child)) return -1;
+    }
+
+    int left = persistent_black_height(tree, node->left);
+    int right = persistent_black_height(tree, node->right);
+    if (left < 0 || left != right) return -1;
+
+    return left + (tree.is_black(node) ? 1 : 0);
+}
+
+template<typename Tree>
+std::vector<int> persistent_contents(const Tree& tree)
+{
+    std::vector<int> values;
+    tree.for_each([&](int value) { values.push_back(value); });
+    return values;
+}
+
+template<typename Tree>
+bool is_valid_persistent(const Tree& tree)
+{
+    std::vector<int> values = persistent_contents(tree);
+    return !tree.is_red(tree.get_root())
+        && persistent_black_height(tree, tree.get_root()) > 0
+        && values.size() == tree.size()
+        && std::adjacent_find(values.begin(), values.end(), std::greater_equal<int>()) == values.end();
+}
+
+template<typename Tree>
+void collect_nodes(typename Tree::NodePtr node, std::vector<typename Tree::NodePtr>& nodes)
+{
+    if (node == nullptr) return;
+    nodes.push_back(node);
+    collect_nodes<Tree>(node->left, nodes);
+    collect_nodes<Tree>(node->right, nodes);
+}
+
+}
+
+void test_persistent_insert_remove()
+{
+    RBPersistentTree<int> tree;
+    std::set<int> expected;
+    std::mt19937 rng(7);
+    for (int step = 0; step < 20000; ++step)
+    {
+        int key = rng() % 2000;
+        if (rng() % 3 == 0) assert(tree.remove(key) == (expected.erase(key) == 1));
+        else assert(tree.insert(key) == expected.insert(key).second);
+
+        if (step % 1000 == 0) assert(is_valid_persistent(tree));
+    }
+    assert(is_valid_persistent(tree));
+    assert(persistent_contents(tree) == std::vector<int>(expected.begin(), expected.end()));
+
+    for (int key: std::vector<int>(expected.begin(), expected.end())) assert(tree.remove(key));
+    assert(tree.empty() && tree.size() == 0 && !tree.remove(0));
+}
+
+void test_persistent_versions_share_nodes()
+{
+    std::vector<int> keys = shuffled_keys(4096);
+    RBPersistentTree<int> tree;
+    for (int key: keys) tree.insert(2 * key);
+
+    RBPersistentTree<int> before(tree);
+    assert(before.get_root() == tree.get_root());
+
+    assert(tree.insert(4001) && tree.remove(2000) && !tree.insert(4000));
+    assert(is_valid_persistent(tree) && is_valid_persistent(before));
+    assert(before.size() == 4096 && before.contains(2000) && !before.contains(4001));
+    assert(tree.size() == 4096 && !tree.contains(2000) && tree.contains(4001));
+
+    // only paths were copied, the rest is shared
+    typedef RBPersistentTree<int> Tree;
+    std::vector<Tree::NodePtr> old_nodes, new_nodes;
+    collect_nodes<Tree>(before.get_root(), old_nodes);
+    collect_nodes<Tree>(tree.get_root(), new_nodes);
+    std::sort(old_nodes.begin(), old_nodes.end());
+    std::sort(new_nodes.begin(), new_nodes.end());
+    std::vector<Tree::NodePtr> copied;
+    std::set_difference(new_nodes.begin(), new_nodes.end(), old_nodes.begin(), old_nodes.end(), std::back_inserter(copied));
+    assert(copied.size() <= 4 * comparisons_bound(4096, 1));
+
+    RBPersistentTree<int> moved(std::move(before));
+    before = tree;
+    assert(moved.contains(2000) && before.contains(4001) && before.get_root() == tree.get_root());
+}
+
+void test_persistent_frees_nodes()
+{
+    live_allocations = 0;
+    {
+        RBPersistentTree<int, std::less<int>, CountingAllocator<int>> tree;
+        std::vector<RBPersistentTree<int, std::less<int>, CountingAllocator<int>>> versions;
+        for (int key: shuffled_keys(2000))
+        {
+            tree.insert(key);
+            if (key % 100 == 0) versions.push_back(tree);
+        }
+        for (int key = 0; key < 2000; key += 2) tree.remove(key);
+        assert(is_valid_persistent(tree) && tree.size() == 1000);
+
+        versions.clear();
+        assert(live_allocations == tree.size());
+
+        // a lone version is modified without copying
+        tree.insert(-1);
+        tree.remove(1);
+        assert(live_allocations == tree.size());
+    }
+    assert(live_allocations == 0);
+}
+
+void test_concurrent_readers_and_writers()
+{
+    const int n = 4000;
+    RBConcurrentTree<int> tree;
+    for (int key = 0; key < n; key += 2) tree.insert(key);
+
+    // even keys stay put while the writers churn through the odd ones
+    std::atomic<bool> done { false };
+    std::atomic<int> misses { 0 };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t)
+    {
+        readers.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            while (!done)
+            {
+                int key = 2 * int(rng() % (n / 2));
+                if (!tree.contains(key)) ++misses;
+                tree.find(key, [&](int value) { if (value != key) ++misses; });
+                std::size_t count = 0;
+                if (rng() % 64 == 0) tree.for_each([&](int) { ++count; });
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; ++t)
+    {
+        writers.emplace_back([&, t]() {
+            for (int round = 0; round < 3; ++round)
+            {
+                for (int key = 1 + 2 * t; key < n; key += 4) tree.insert(key);
+                for (int key = 1 + 2 * t; key < n; key += 4) assert(tree.remove(key));
+            }
+            for (int key = 1 + 2 * t; key < n; key += 4) tree.insert(key);
+        });
+    }
+    for (std::thread& writer: writers) writer.join();
+    done = true;
+    for (std::thread& reader: readers) reader.join();
+
+    assert(misses == 0 && tree.size() == std::size_t(n));
+    std::vector<int> values;
+    tree.for_each([&](int value) { values.push_back(value); });
+    assert(values == every_nth(n, 1));
+}
+
+void test_concurrent_reclamation()
+{
+    live_allocations = 0;
+    {
+        RBConcurrentTree<int, std::less<int>, CountingAllocator<int>> tree;
+        for (int key: shuffled_keys(3000)) tree.insert(key);
+        for (int key = 0; key < 3000; key += 3) tree.remove(key);
+        assert(!tree.remove(0) && !tree.insert(1));
+
+        tree.synchronize();
+        assert(live_allocations == tree.size() && tree.size() == 2000);
+    }
+    assert(live_allocations == 0);
+}
+
+void test_persistent_snapshot_restore()
+{
+    live_allocations = 0;
+    {
+        typedef RBPersistentTree<int, std::less<int>, CountingAllocator<int>> Tree;
+        Tree tree;
+        for (int key: shuffled_keys(1000)) tree.insert(key);
+
+        Tree snapshot = tree.snapshot();
+        assert(snapshot.get_root() == tree.get_root() && live_allocations == 1000);
+
+        for (int key = 0; key < 1000; key += 2) tree.remove(key);
+        for (int key = 1000; key < 1500; ++key) tree.insert(key);
+        assert(is_valid_persistent(tree) && tree.size() == 1000);
+        assert(is_valid_persistent(snapshot) && persistent_contents(snapshot) == every_nth(1000, 1));
+
+        // the nodes written since the snapshot go away with the rollback
+        tree.restore(snapshot);
+        assert(tree.get_root() == snapshot.get_root() && tree.size() == 1000);
+        assert(live_allocations == 1000);
+        tree.insert(-1);
+        assert(!snapshot.contains(-1) && tree.contains(-1));
+    }
+    assert(live_allocations == 0);
+}
+
+void test_concurrent_snapshots()
+{
+    RBConcurrentTree<int> tree;
+    for (int key = 0; key < 1000; ++key) tree.insert(key);
+
+    // snapshots stay intact in other threads while writes go on
+    std::vector<std::thread> readers;
+    std::atomic<int> mismatches { 0 };
+    for (int t = 0; t < 3; ++t)
+    {
+        readers.emplace_back([&]() {
+            for (int round = 0; round < 20; ++round)
+            {
+                RBConcurrentTree<int>::Version snapshot = tree.snapshot();
+                std::vector<int> first = persistent_contents(snapshot);
+                std::this_thread::yield();
+                if (persistent_contents(snapshot) != first || first.size() != snapshot.size()) ++mismatches;
+            }
+        });
+    }
+    for (int round = 0; round < 5; ++round)
+    {
+        for (int key = 0; key < 1000; key += 3) tree.remove(key);
+        for (int key = 0; key < 1000; key += 3) tree.insert(key);
+    }
+    for (std::thread& reader: readers) reader.join();
+    assert(mismatches == 0);
+
+    RBConcurrentTree<int>::Version before = tree.snapshot();
+    for (int key = 0; key < 500; ++key) tree.remove(key);
+    assert(tree.size() == 500 && before.size() == 1000);
+
+    tree.restore(before);
+    assert(tree.size() == 1000 && tree.contains(0));
+    tree.synchronize();
+    assert(persistent_contents(before) == every_nth(1000, 1));
+}
+
+namespace {
+
+// 64 bytes, so that nodes hold the fewest keys allowed
+typedef std::array<int, 16> WideKey;
+
+template<typename Key>
+Key make_key(int key)
+{
+    if constexpr (std::is_same<Key, WideKey>::value) return WideKey{ { key } };
+    else return key;
+}
+
+template<typename Key>
+void check_bplus_tree_against_set(int keys, int steps)
+{
+    BPlusTree<Key> tree;
+    std::set<Key> expected;
+    std::mt19937 rng(11);
+
+    // inserts build up several levels, removals drain it down to the root
+    for (int step = 0; step < steps; ++step)
+    {
+        Key key = make_key<Key>(rng() % keys);
+        if (step >= steps * 3 / 4 || rng() % 3 == 0) assert(tree.remove(key) == (expected.erase(key) == 1));
+        else assert(tree.insert(key).second == expected.insert(key).second);
+
+        if (step % 10000 == 0)
+        {
+            assert(tree.size() == expected.size());
+            assert(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+            assert(std::equal(tree.rbegin(), tree.rend(), expected.rbegin(), expected.rend()));
+        }
+    }
+    assert(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+
+    for (int i = 0; i < keys; ++i)
+    {
+        Key key = make_key<Key>(i);
+        assert(tree.contains(key) == (expected.count(key) == 1));
+        assert(tree.remove(key) == (expected.erase(key) == 1));
+    }
+    assert(tree.empty() && tree.size() == 0 && tree.begin() == tree.end());
+    assert(!tree.remove(make_key<Key>(0)) && tree.find(make_key<Key>(0)) == tree.end());
+
+    assert(tree.insert(make_key<Key>(5)).second && *tree.find(make_key<Key>(5)) == make_key<Key>(5));
+}
+
+}
+
+void test_bplus_tree_against_set()
+{
+    check_bplus_tree_against_set<int>(20000, 200000);
+    check_bplus_tree_against_set<WideKey>(2000, 40000);
+}
+
+void test_bplus_tree_bounds()
+{
+    BPlusTree<int> tree;
+    for (int key: shuffled_keys(10000)) tree.insert(3 * key);
+
+    const BPlusTree<int>& view = tree;
+    for (int key = -1; key < 30001; ++key)
+    {
+        int lower = (key + 2) / 3 * 3;
+        int upper = key / 3 * 3 + 3;
+        if (key < 0) lower = upper = 0;
+
+        auto lower_it = view.lower_bound(key);
+        auto upper_it = view.upper_bound(key);
+        assert(lower < 30000 ? *lower_it == lower : lower_it == view.end());
+        assert(upper < 30000 ? *upper_it == upper : upper_it == view.end());
+        assert(view.contains(key) == (key >= 0 && key < 30000 && key % 3 == 0));
+    }
+
+    // walking back from end() crosses every leaf boundary
+    int expected = 29997;
+    for (auto it = tree.end(); it != tree.begin(); expected -= 3) assert(*--it == expected);
+    assert(expected == -3);
+
+    assert(tree.insert(1).second && !tree.insert(1).second);
+    BPlusTree<int>::iterator it = tree.insert(2).first;
+    assert(*it == 2 && *--it == 1 && *--it == 0 && it == tree.begin());
+}
+
+void test_bplus_tree_copy_and_move()
+{
+    typedef std::pair<const int, std::string> Entry;
+    typedef BPlusTree<Entry, std::less<int>, CountingAllocator<Entry>, RBTreeSelectFirst<Entry>> Map;
+    {
+        Map map;
+        for (int key: shuffled_keys(5000)) map.emplace(key, std::to_string(key));
+        assert(map.size() == 5000 && map.find(4321)->second == "4321");
+
+        Map copy(map);
+        for (int key = 0; key < 5000; key += 2) assert(copy.remove(key));
+        assert(copy.size() == 2500 && map.size() == 5000);
+        assert(map.contains(10) && !copy.contains(10) && copy.find(11)->second == "11");
+
+        int previous = -1;
+        for (const Entry& entry: copy)
+        {
+            assert(entry.first > previous && entry.first % 2 == 1);
+            assert(entry.second == std::to_string(entry.first));
+            previous = entry.first;
+        }
+
+        Map moved(std::move(map));
+        assert(moved.size() == 5000 && map.empty() && map.begin() == map.end());
+
+        map = copy;
+        assert(map.size() == 2500 && std::equal(map.begin(), map.end(), copy.begin(), copy.end()));
+
+        moved.clear();
+        assert(moved.empty() && moved.insert(Entry(1, "one")).second);
+    }
+
+    assert(live_allocations == 0);
+}
+
+namespace {
+
+template<SearchTreeEngine Engine>
+std::vector<int> run_engine()
+{
+    SearchTree<int, Engine> tree;
+    for (int key: shuffled_keys(3000)) assert(tree.insert(key).second);
+    for (int key = 0; key < 3000; key += 3) assert(tree.remove(key));
+    assert(tree.size() == 2000 && tree.contains(1) && !tree.contains(3));
+    assert(*tree.lower_bound(3) == 4 && *tree.upper_bound(4) == 5);
+
+    // the same signatures on both engines
+    std::pair<typename SearchTree<int, Engine>::iterator, bool> duplicate = tree.insert(4);
+    assert(!duplicate.second && *duplicate.first == 4 && duplicate.first == tree.find(4));
+    assert(tree.emplace(3).second && tree.find(3) != tree.end() && !tree.remove(6));
+    assert(tree.remove(3) && tree.find(3) == tree.end());
+
+    const SearchTree<int, Engine>& read = tree;
+    assert(*read.find(4) == 4 && read.contains(4) && read.lower_bound(6000) == read.end());
+
+    return std::vector<int>(tree.begin(), tree.end());
+}
+
+}
+
+void test_search_tree_engines()
+{
+    static_assert(std::is_base_of<RBTree<int>, SearchTree<int, SearchTreeEngine::RED_BLACK>>::value, "");
+    static_assert(std::is_same<SearchTree<int, SearchTreeEngine::B_PLUS>, BPlusTree<int>>::value, "");
+
+    std::vector<int> red_black = run_engine<SearchTreeEngine::RED_BLACK>();
+    assert(red_black == run_engine<SearchTreeEngine::B_PLUS>());
+    assert(red_black.size() == 2000 && std::is_sorted(red_black.begin(), red_black.end()));
+}
+
+namespace {
+
+template<typename Key>
+void check_search_kernels(Key low, Key high)
+{
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> pick(0, 99);
+    // k steps of a range cut into parts, without computing high - low, which
+    // overflows for signed keys near the limits of their type
+    auto step = [low, high](int k, int parts) {
+        return Key(low / parts * (parts - k) + high / parts * k);
+    };
+    for (std::size_t n = 0; n < 300; n += 7)
+    {
+        // about a hundred distinct keys, spread over the whole range
+        std::vector<Key> keys(n);
+        for (Key& key: keys) key = step(pick(rng), 100);
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<Key> probes(keys);
+        probes.push_back(low);
+        probes.push_back(high);
+        probes.push_back(step(1, 200));
+
+        for (int kernel = 0; kernel <= int(BPlusSearch<Key>::kernel()); ++kernel)
+        {
+            for (Key probe: probes)
+            {
+                std::size_t lower = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+                std::size_t upper = std::upper_bound(keys.begin(), keys.end(), probe) - keys.begin();
+                assert(BPlusSearch<Key>::template rank<false>(keys.data(), n, probe, BPlusSearchKernel(kernel)) == lower);
+                assert(BPlusSearch<Key>::template rank<true>(keys.data(), n, probe, BPlusSearchKernel(kernel)) == upper);
+            }
+        }
+    }
+}
+
+}
+
+void test_bplus_search_kernels()
+{
+    static_assert(BPlusSearchVectorizable<int, std::less<int>>::value, "");
+    static_assert(BPlusSearchVectorizable<double, std::less<>>::value, "");
+    static_assert(!BPlusSearchVectorizable<int, std::greater<int>>::value, "");
+    static_assert(!BPlusSearchVectorizable<bool, std::less<bool>>::value, "");
+    static_assert(!BPlusSearchVectorizable<std::string, std::less<std::string>>::value, "");
+
+    check_search_kernels<char>(-100, 100);
+    check_search_kernels<unsigned char>(0, 255);
+    check_search_kernels<short>(-30000, 30000);
+    check_search_kernels<int>(-2000000000, 2000000000);
+    check_search_kernels<unsigned>(0, 4000000000u);
+    check_search_kernels<std::int64_t>(-(std::int64_t(1) << 62), std::int64_t(1) << 62);
+    check_search_kernels<std::uint64_t>(0, ~std::uint64_t(0));
+    check_search_kernels<float>(-1000.0f, 1000.0f);
+    check_search_kernels<double>(-1e300, 1e300);
+}
+
+void test_bplus_tree_numeric_keys()
+{
+    // unsigned keys above the signed range would rank wrongly if compared
+    // as signed lanes
+    BPlusTree<unsigned> tree;
+    std::set<unsigned> expected;
+    std::mt19937 rng(3);
+    for (int step = 0; step < 50000; ++step)
+    {
+        unsigned key = rng();
+        auto stored = tree.lower_bound(key / 2);
+        if (rng() % 4 == 0 && stored != tree.end()) key = *stored;
+        if (step % 3 == 0) assert(tree.remove(key) == (expected.erase(key) == 1));
+        else assert(tree.insert(key).second == expected.insert(key).second);
+    }
+    assert(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+
+    BPlusTree<char> chars;
+    for (int c = -128; c < 128; ++c) chars.insert(char(c));
+    assert(chars.size() == 256 && *chars.lower_bound(-1) == -1 && *chars.upper_bound(126) == 127);
+    for (int c = -128; c < 128; c += 2) assert(chars.remove(char(c)));
+    assert(chars.size() == 128 && chars.contains(1) && !chars.contains(0) && *chars.begin() == -127);
+}
+
+void test_freeze_lookups()
+{
+    // every shape of the last level, then a deep one
+    std::vector<int> sizes(300);
+    std::iota(sizes.begin(), sizes.end(), 0);
+    sizes.push_back(100000);
+
+    for (int n: sizes)
+    {
+        RBTree<int> tree;
+        for (int key: shuffled_keys(n)) tree.insert(2 * key);
+
+        FrozenIndex<int> index = tree.freeze();
+        assert(index.size() == std::size_t(n) && index.empty() == (n == 0));
+
+        for (int key = -1; key <= 2 * n; ++key)
+        {
+            bool stored = key >= 0 && key < 2 * n && key % 2 == 0;
+            int lower = key < 0 ? 0 : (key + 1) / 2 * 2;
+            int upper = key < 0 ? 0 : key / 2 * 2 + 2;
+
+            assert(index.contains(key) == stored);
+            assert(stored ? *index.find(key) == key : index.find(key) == nullptr);
+            assert(lower < 2 * n ? *index.lower_bound(key) == lower : index.lower_bound(key) == nullptr);
+            assert(upper < 2 * n ? *index.upper_bound(key) == upper : index.upper_bound(key) == nullptr);
+        }
+    }
+}
+
+void test_freeze_outlives_tree()
+{
+    typedef RBMap<int, std::string> Map;
+    typedef FrozenIndex<Map::value_type, std::less<int>, std::allocator<Map::value_type>,
+        RBTreeSelectFirst<Map::value_type>> Index;
+
+    Index copy;
+    {
+        Map map;
+        for (int key = 0; key < 1000; ++key) map[key] = std::to_string(key);
+
+        Index index = map.freeze();
+        map.remove(10);
+        map[20] = "changed";
+        map.clear();
+
+        assert(index.size() == 1000 && index.find(10)->second == "10" && index.find(20)->second == "20");
+        copy = index;
+    }
+    assert(copy.size() == 1000 && copy.find(999)->second == "999" && !copy.contains(1000));
+
+    Index moved(std::move(copy));
+    assert(moved.size() == 1000 && copy.empty() && copy.find(0) == nullptr);
+    assert(moved.lower_bound(-5)->first == 0 && moved.upper_bound(998)->first == 999);
+}
+
+namespace {
+
+struct ThrowingCopy
+{
+    static int live;
+    static int copies_left;
+
+    int key;
+
+    explicit ThrowingCopy(int k) : key(k) { ++live; }
+    ThrowingCopy(const ThrowingCopy& other) : key(other.key)
+    {
+        if (copies_left-- == 0) throw std::runtime_error("copy");
+        ++live;
+    }
+    ~ThrowingCopy() { --live; }
+
+    bool operator<(const ThrowingCopy& other) const { return key < other.key; }
+};
+
+int ThrowingCopy::live = 0;
+int ThrowingCopy::copies_left = -1;
+
+}
+
+void test_freeze_failed_copy()
+{
+    {
+        RBTree<ThrowingCopy, std::less<ThrowingCopy>, CountingAllocator<ThrowingCopy>> tree;
+        for (int key = 0; key < 500; ++key) tree.emplace(key);
+        std::size_t tree_allocations = live_allocations;
+
+        // values built before the failing copy are destroyed again
+        ThrowingCopy::copies_left = 321;
+        bool thrown = false;
+        try
+        {
+            tree.freeze();
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        assert(thrown && ThrowingCopy::live == 500 && live_allocations == tree_allocations);
+
+        ThrowingCopy::copies_left = -1;
+        auto index = tree.freeze();
+        assert(ThrowingCopy::live == 1000 && index.contains(ThrowingCopy(321)));
+    }
+
+    assert(ThrowingCopy::live == 0 && live_allocations == 0);
+}
+
+namespace {
+
+// in the working directory, removed by the tests that create it
+const char* const saved_tree = "rbtree_test_saved.bin";
+
+template<typename Tree>
+std::string load_error(Tree& tree, const std::string& path)
+{
+    try
+    {
+        tree.load(path);
+    }
+    catch (const std::runtime_error& error)
+    {
+        return error.what();
+    }
+    return "";
+}
+
+}
+
+void test_save_load()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(100000)) tree.insert(3 * key);
+    tree.save(saved_tree);
+
+    RBTree<int> loaded;
+    loaded.insert(-1);
+    loaded.load(saved_tree);
+    assert(loaded.size() == 100000 && !loaded.contains(-1));
+    assert(std::equal(loaded.begin(), loaded.end(), tree.begin(), tree.end()));
+    assert(is_valid_rbtree(loaded));
+
+    // saving again replaces the file
+    RBTree<int> empty;
+    empty.save(saved_tree);
+    loaded.load(saved_tree);
+    assert(loaded.empty() && loaded.begin() == loaded.end());
+
+    // concurrent saves each write a temporary file of their own, the
+    // last rename wins with a complete file
+    std::vector<RBTree<int>> trees(4);
+    for (std::size_t i = 0; i < trees.size(); ++i)
+    {
+        for (int key = 0; key < 20000 * int(i + 1); ++key) trees[i].insert(key);
+    }
+    std::vector<std::thread> savers;
+    for (const RBTree<int>& saved: trees)
+    {
+        savers.emplace_back([&saved]() {
+            for (int round = 0; round < 5; ++round) saved.save(saved_tree);
+        });
+    }
+    for (std::thread& saver: savers) saver.join();
+    loaded.load(saved_tree);
+    assert(loaded.size() % 20000 == 0 && loaded.size() > 0 && is_valid_rbtree(loaded));
+
+    std::remove(saved_tree);
+}
+
+void test_load_rejects_bad_files()
+{
+    RBTree<int> tree;
+    for (int key = 0; key < 100; ++key) tree.insert(key);
+    tree.save(saved_tree);
+
+    RBTree<int> kept;
+    kept.insert(7);
+    assert(load_error(kept, "rbtree_test_missing.bin").find("cannot open") != std::string::npos);
+
+    RBTree<std::int64_t> wider;
+    assert(load_error(wider, saved_tree).find("another value type") != std::string::npos);
+
+    // drop the last value
+    std::string bytes;
+    {
+        std::ifstream in(saved_tree, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::ofstream(saved_tree, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size() - sizeof(int));
+    assert(load_error(kept, saved_tree).find("truncated") != std::string::npos);
+
+    bytes[0] = 'X';
+    std::ofstream(saved_tree, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size());
+    assert(load_error(kept, saved_tree).find("not a tree file") != std::string::npos);
+
+    // failed loads leave the tree alone
+    assert(kept.size() == 1 && kept.contains(7));
+
+    std::remove(saved_tree);
+}
+
+void test_mapped_tree()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(10000)) tree.insert(2 * key);
+    tree.save(saved_tree);
+
+    {
+        RBMappedTree<int> mapped(saved_tree);
+        assert(mapped.size() == 10000 && std::equal(mapped.begin(), mapped.end(), tree.begin(), tree.end()));
+        for (int key = -1; key <= 20000; ++key)
+        {
+            assert(mapped.contains(key) == tree.contains(key));
+            assert(mapped.lower_bound(key) == mapped.end() ? key > 19998 : *mapped.lower_bound(key) == (key + 1) / 2 * 2);
+        }
+        assert(*mapped.upper_bound(10) == 12 && mapped.upper_bound(19998) == mapped.end());
+        assert(mapped.find(11) == mapped.end() && *mapped.find(12) == 12);
+
+        std::vector<int> range;
+        mapped.for_each_in_range(100, 110, [&range](int key) { range.push_back(key); });
+        assert(range == std::vector<int>({ 100, 102, 104, 106, 108 }));
+        assert(mapped.count_range(100, 110) == 5 && mapped.count_range(110, 100) == 0);
+
+        // the mapping moves along
+        RBMappedTree<int> moved(std::move(mapped));
+        assert(moved.size() == 10000 && mapped.empty() && moved.contains(0));
+
+        bool thrown = false;
+        try
+        {
+            RBMappedTree<short> narrower(saved_tree);
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    std::remove(saved_tree);
+}
+
+namespace {
+
+template<typename Tree>
+std::string dumped(const Tree& tree, RBTreeDumpFormat format,
+    std::size_t max_depth = std::numeric_limits<std::size_t>::max(),
+    std::size_t max_nodes = std::numeric_limits<std::size_t>::max())
+{
+    RBTreeDumpOptions options;
+    options.format = format;
+    options.max_depth = max_depth;
+    options.max_nodes = max_nodes;
+    std::ostringstream out;
+    tree.dump(out, options);
+    return out.str();
+}
+
+}
+
+void test_dump_formats()
+{
+    RBTree<int> tree;
+    for (int key = 1; key <= 5; ++key) tree.insert(key);
+
+    assert(dumped(tree, RBTreeDumpFormat::TEXT) ==
+        "R----2(BLACK)\n"
+        "   L----1(BLACK)\n"
+        "   R----4(BLACK)\n"
+        "      L----3(RED)\n"
+        "      R----5(RED)\n");
+
+    assert(dumped(tree, RBTreeDumpFormat::JSON) ==
+        "{\"key\":2,\"color\":\"black\","
+        "\"left\":{\"key\":1,\"color\":\"black\"},"
+        "\"right\":{\"key\":4,\"color\":\"black\","
+        "\"left\":{\"key\":3,\"color\":\"red\"},"
+        "\"right\":{\"key\":5,\"color\":\"red\"}}}\n");
+
+    // a node and an edge to it from its parent per key
+    std::string dot = dumped(tree, RBTreeDumpFormat::DOT);
+    assert(dot.rfind("digraph rbtree {\n", 0) == 0 && dot.substr(dot.size() - 2) == "}\n");
+    assert(std::count(dot.begin(), dot.end(), '\n') == 2 + 5 + 4);
+    assert(dot.find("[label=\"4\", color=black]") != std::string::npos);
+    assert(dot.find("[label=\"5\", color=red]") != std::string::npos);
+
+    // quotes and backslashes of the keys are escaped
+    RBTree<std::string> strings;
+    strings.insert("say \"hi\"");
+    assert(dumped(strings, RBTreeDumpFormat::JSON) == "{\"key\":\"say \\\"hi\\\"\",\"color\":\"black\"}\n");
+    strings.insert("C:\\");
+    assert(dumped(strings, RBTreeDumpFormat::DOT).find("[label=\"C:\\\\\", color=red]") != std::string::npos);
+
+    RBTree<int> empty;
+    assert(dumped(empty, RBTreeDumpFormat::TEXT).empty());
+    assert(dumped(empty, RBTreeDumpFormat::JSON) == "null\n");
+    assert(dumped(empty, RBTreeDumpFormat::DOT) == "digraph rbtree {\n}\n");
+}
+
+void test_dump_limits()
+{
+    RBTree<int> tree;
+    for (int key = 1; key <= 5; ++key) tree.insert(key);
+
+    assert(dumped(tree, RBTreeDumpFormat::TEXT, 1) ==
+        "R----2(BLACK)\n"
+        "   L----1(BLACK)\n"
+        "   R----4(BLACK)\n"
+        "      ...\n");
+
+    // the right subtree of the root is past the first three nodes
+    assert(dumped(tree, RBTreeDumpFormat::TEXT, 10, 2) ==
+        "R----2(BLACK)\n"
+        "   L----1(BLACK)\n"
+        "   ...\n");
+
+    assert(dumped(tree, RBTreeDumpFormat::JSON, 0) == "{\"key\":2,\"color\":\"black\",\"cut\":true}\n");
+    assert(dumped(tree, RBTreeDumpFormat::JSON, 0, 0) == "null\n");
+
+    std::string dot = dumped(tree, RBTreeDumpFormat::DOT, 1);
+    assert(std::count(dot.begin(), dot.end(), '\n') == 2 + 3 + 2 + 2);
+    assert(dot.find("_cut [label=\"...\", shape=plaintext]") != std::string::npos);
+
+    // limits on a deep tree only cost the nodes written
+    RBTree<int> large;
+    for (int key: shuffled_keys(100000)) large.insert(key);
+    std::string top = dumped(large, RBTreeDumpFormat::TEXT, 3);
+    assert(std::count(top.begin(), top.end(), '(') == 15);
+    std::string first = dumped(large, RBTreeDumpFormat::JSON, 1000, 100);
+    assert(std::count(first.begin(), first.end(), '{') == 100);
+    assert(std::count(first.begin(), first.end(), '{') == std::count(first.begin(), first.end(), '}'));
+}
+
+void test_dump_callback()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(100000)) tree.insert(key);
+
+    // the same text, in blocks instead of lines
+    std::string text;
+    std::size_t calls = 0;
+    tree.dump([&text, &calls](const char* block, std::size_t length) {
+        text.append(block, length);
+        ++calls;
+    });
+    std::string expected = dumped(tree, RBTreeDumpFormat::TEXT);
+    assert(text == expected);
+    assert(std::count(text.begin(), text.end(), '\n') == 100000);
+    assert(calls < 100000 / 10);
+
+    RBTreeDumpOptions options;
+    options.format = RBTreeDumpFormat::JSON;
+    text.clear();
+    tree.dump([&text](const char* block, std::size_t length) { text.append(block, length); }, options);
+    assert(text == dumped(tree, RBTreeDumpFormat::JSON));
+}
+
+void test_stats_counts()
+{
+    RBTree<int> tree;
+    for (int key = 1; key <= 3; ++key) tree.insert(key);
+
+#ifdef RBTREE_ENABLE_STATS
+    // 3 goes right of 1 and 2 then rotates left around 1
+    assert(tree.stats().comparisons == 0 + 2 + 3);
+    assert(tree.stats().rotations == 1);
+    assert(tree.stats().recolors == 1 + 2);
+    assert(tree.stats().insert_fix_state01 == 1 && tree.stats().insert_fix_state10 == 1);
+    assert(tree.stats().insert_fix_state00 == 0 && tree.stats().insert_fix_state11 == 0);
+    assert(tree.stats().allocations == 3);
+    assert(tree.stats().max_depth == 3);
+
+    tree.find(2);
+    assert(tree.stats().comparisons == 5 + 3 && tree.stats().max_depth == 3);
+
+    // 1 is a red leaf now
+    tree.remove(1);
+    assert(tree.stats().remove_fix_state000 == 1 && tree.stats().remove_fix_state001 == 0);
+
+    // copies count from 0
+    RBTree<int> copy(tree);
+    assert(copy.stats().allocations == 2 && copy.stats().comparisons == 0);
+#endif
+
+    tree.reset_stats();
+    const RBTreeStats& stats = tree.stats();
+    assert(stats.comparisons == 0 && stats.rotations == 0 && stats.recolors == 0);
+    assert(stats.allocations == 0 && stats.max_depth == 0);
+
+#ifndef RBTREE_ENABLE_STATS
+    // compiled out, nothing is counted
+    tree.insert(4);
+    assert(tree.stats().comparisons == 0 && tree.stats().allocations == 0);
+#endif
+}
+
+void test_stats_fix_states()
+{
+    RBTree<int> tree;
+    for (int key: shuffled_keys(10000)) tree.insert(key);
+
+#ifdef RBTREE_ENABLE_STATS
+    // a black uncle leads to one rotation or to two
+    RBTreeStats stats = tree.stats();
+    assert(stats.insert_fix_state01 == stats.insert_fix_state10);
+    assert(stats.rotations == stats.insert_fix_state10 + stats.insert_fix_state11);
+    assert(stats.insert_fix_state00 > 0 && stats.insert_fix_state11 > 0);
+    assert(stats.allocations == 10000);
+    assert(stats.max_depth <= 2 * 14 + 1);
+
+    tree.reset_stats();
+    for (int key: shuffled_keys(10000)) tree.remove(key);
+    stats = tree.stats();
+    assert(stats.remove_fix_state000 + stats.remove_fix_state001 > 0);
+    assert(stats.remove_fix_state010 + stats.remove_fix_state111 >= stats.remove_fix_state001);
+    assert(stats.remove_fix_state101 >= stats.remove_fix_state110);
+    assert(stats.insert_fix_state00 == 0 && stats.allocations == 0);
+    assert(tree.empty());
+#else
+    assert(tree.stats().rotations == 0 && tree.stats().insert_fix_state00 == 0);
+#endif
+}
+
+namespace {
+
+template<typename Tree>
+std::string violation(const Tree& tree)
+{
+    std::string error;
+    return tree.validate(&error) ? "" : error;
+}
+
+}
+
+void test_validate_detects_corruption()
+{
+    RBTree<int> tree;
+    for (int key = 0; key < 100; ++key) tree.insert(key);
+    assert(violation(tree).empty());
+
+    auto root = tree.get_root();
+    root->set_color(RBTree<int>::NodeColor::RED);
+    assert(violation(tree) == "root is red");
+    root->set_color(RBTree<int>::NodeColor::BLACK);
+
+    std::swap(root->left->data, root->right->data);
+    assert(violation(tree) == "keys out of order");
+    std::swap(root->left->data, root->right->data);
+
+    // a black node turned red drops a black from its paths, or sits
+    // under a red parent
+    auto node = tree.find(50);
+    auto color = node->color();
+    node->set_color(color == RBTree<int>::NodeColor::RED ? RBTree<int>::NodeColor::BLACK : RBTree<int>::NodeColor::RED);
+    std::string error = violation(tree);
+    assert(error == "black height differs between paths" || error == "red node with a red child");
+    node->set_color(color);
+
+    auto child = root->right;
+    child->set_parent(root->left);
+    assert(violation(tree) == "child not linked back to its parent");
+    child->set_parent(root);
+
+    auto least = tree.find(0);
+    auto terminal = least->left;
+    least->left = tree.find(99);
+    assert(violation(tree) == "child not linked back to its parent");
+    least->left = terminal;
+
+    assert(violation(tree).empty());
+
+    RBOrderStatTree<int> counted(tree.begin(), tree.end());
+    ++counted.get_root()->left->size;
+    assert(violation(counted) == "subtree size out of date");
+    --counted.get_root()->left->size;
+    assert(violation(counted).empty());
+}
+
+void test_profile_shapes()
+{
+    RBTree<int> empty;
+    RBTreeProfile none = empty.profile();
+    assert(none.size == 0 && none.height == 0 && none.average_depth == 0 && none.depth_histogram.empty());
+
+    // a perfect tree of 4 levels, all black
+    std::vector<int> keys(15);
+    for (int i = 0; i < 15; ++i) keys[i] = i;
+    RBTree<int> perfect(keys.begin(), keys.end());
+    RBTreeProfile shape = perfect.profile();
+    assert(shape.size == 15 && shape.height == 4);
+    assert(shape.depth_histogram == std::vector<std::size_t>({ 1, 2, 4, 8 }));
+    assert(shape.average_depth == (1 * 1 + 2 * 2 + 3 * 4 + 4 * 8) / 15.0);
+
+    RBTree<int> tree;
+    for (int key: shuffled_keys(100000)) tree.insert(key);
+    shape = tree.profile();
+    assert(shape.size == 100000);
+    assert(shape.height <= 2 * 17 && shape.black_height * 2 >= shape.height);
+    assert(shape.average_depth >= 15 && shape.average_depth <= shape.height);
+    std::size_t levels = 0;
+    for (std::size_t count: shape.depth_histogram) levels += count;
+    assert(levels == shape.size && shape.depth_histogram.front() == 1);
+    assert(shape.red_nodes > 0 && shape.red_nodes < shape.size / 2);
+}
+
+void test_random_workload_invariants()
+{
+    std::mt19937 rng(2024);
+    RBTree<int> tree;
+    std::set<int> expected;
+
+    for (int step = 0; step < 20000; ++step)
+    {
+        int key = rng() % 2000;
+        switch (rng() % 6)
+        {
+        case 0:
+        case 1:
+            tree.insert(key);
+            expected.insert(key);
+            break;
+        case 2:
+            tree.emplace(key);
+            expected.insert(key);
+            break;
+        case 3:
+        case 4:
+            tree.remove(key);
+            expected.erase(key);
+            break;
+        default:
+        {
+            std::vector<int> batch;
+            for (int i = 0; i < 20; ++i) batch.push_back(key + 3 * i);
+            tree.erase_batch(batch.begin(), batch.end());
+            for (int removed: batch) expected.erase(removed);
+        }
+        }
+
+        if (step % 97 == 0)
+        {
+            assert(violation(tree).empty());
+            assert(tree.size() == expected.size());
+            assert(std::equal(tree.begin(), tree.end(), expected.begin(), expected.end()));
+        }
+    }
+    assert(violation(tree).empty());
+}
+
+void test_erase_by_iterator()
+{
+    RBOrderStatTree<int> tree;
+    for (int key: shuffled_keys(1000)) tree.insert(key);
+
+    // odd keys stay where they are while their neighbours go
+    std::vector<RBOrderStatTree<int>::NodePtr> kept;
+    for (int key = 1; key < 1000; key += 2) kept.push_back(tree.find(key));
+
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+    {
+        int key = *it;
+        it = tree.erase(it);
+        assert(it == tree.end() || *it == key + 1);
+    }
+    assert(tree.size() == 500 && violation(tree).empty());
+    for (int key = 1; key < 1000; key += 2)
+    {
+        assert(tree.find(key) == kept[key / 2]);
+        assert(tree.select(key / 2)->data == key);
+    }
+
+    // ends and ranges
+    assert(*tree.erase(tree.cbegin()) == 3);
+    assert(tree.erase(std::prev(tree.end())) == tree.end());
+    assert(*tree.begin() == 3 && *tree.rbegin() == 997);
+
+    auto last = tree.erase(tree.lower_bound(101), tree.lower_bound(201));
+    assert(*last == 201 && *std::prev(last) == 99);
+    assert(tree.size() == 448 && violation(tree).empty());
+
+    assert(tree.erase(tree.begin(), tree.end()) == tree.end());
+    assert(tree.empty() && violation(tree).empty());
+}
+
+void test_extract_insert_between_trees()
+{
+    {
+        typedef RBTree<int, std::less<int>, CountingAllocator<int>> Tree;
+        Tree to;
+        for (int key = 0; key < 2000; ++key) to.insert(key);
+        std::vector<Tree::NodePtr> nodes;
+        for (int key = 0; key < 2000; ++key) nodes.push_back(to.find(key));
+
+        {
+            // split() trees share the pool, nodes move over as they are
+            Tree from = to.split(1000);
+            std::size_t before = live_allocations;
+            while (!from.empty())
+            {
+                Tree::node_type node = from.extract(from.begin());
+                assert(node && !from.contains(node.value()));
+
+                Tree::insert_return_type result = to.insert(std::move(node));
+                assert(result.inserted && node.empty() && result.node.empty());
+                assert(result.position.node() == nodes[*result.position]);
+            }
+            assert(live_allocations == before);
+            assert(violation(from).empty() && violation(to).empty());
+        }
+        assert(to.size() == 2000 && violation(to).empty());
+        for (int key = 0; key < 2000; ++key) assert(to.find(key) == nodes[key]);
+
+        // a duplicate comes back in the result
+        to.insert(3000);
+        Tree::node_type node = to.extract(3000);
+        node.value() = 7;
+        Tree::insert_return_type result = to.insert(std::move(node));
+        assert(!result.inserted && *result.position == 7 && result.node.value() == 7);
+
+        // the key may change before the node goes back in
+        result.node.value() = 5000;
+        result = to.insert(std::move(result.node));
+        assert(result.inserted && *result.position == 5000 && *to.rbegin() == 5000);
+
+        assert(to.extract(4000).empty());
+        result = to.insert(Tree::node_type());
+        assert(!result.inserted && result.position == to.end());
+        assert(to.size() == 2001 && violation(to).empty());
+    }
+
+    assert(live_allocations == 0);
+}
+
+void test_extract_insert_separate_pools()
+{
+    typedef RBTree<int, std::less<int>, CountingAllocator<int>> Tree;
+    {
+        Tree a;
+        Tree b;
+        for (int key = 0; key < 1000; ++key)
+        {
+            a.insert(2 * key);
+            b.insert(2 * key + 1);
+        }
+
+        // the nodes cross over as they are, none is allocated
+        std::size_t before = live_allocations;
+        for (int key = 0; key < 500; ++key)
+        {
+            Tree::NodePtr node = b.find(4 * key + 1);
+            assert(a.insert(b.extract(4 * key + 1)).position.node() == node);
+            node = a.find(4 * key);
+            assert(b.insert(a.extract(4 * key)).position.node() == node);
+        }
+        assert(live_allocations == before);
+        assert(a.size() == 1000 && b.size() == 1000);
+        assert(violation(a).empty() && violation(b).empty());
+
+        // the pools stay apart, both trees can be mutated on their own
+        auto churn = [](Tree& tree, int step) {
+            for (int key = 0; key < 4000; key += step)
+            {
+                tree.remove(key);
+                tree.insert(key + 4000);
+            }
+        };
+        std::thread ta(churn, std::ref(a), 3);
+        std::thread tb(churn, std::ref(b), 5);
+        ta.join();
+        tb.join();
+        assert(violation(a).empty() && violation(b).empty());
+
+        // and a tree keeps the slabs of nodes whose own tree is gone
+        std::size_t size = a.size();
+        {
+            Tree c;
+            for (int key = 0; key < 100; ++key) c.insert(key + 10000);
+            while (!c.empty()) a.insert(c.extract(c.begin()));
+        }
+        for (int key = 0; key < 100; key += 2) a.remove(key + 10000);
+        for (int key = 0; key < 100; key += 2) a.insert(key + 20000);
+        assert(a.size() == size + 100 && violation(a).empty());
+        a.clear();
+        assert(violation(b).empty());
+    }
+    assert(live_allocations == 0);
+}
+
+void test_node_handle_outlives_tree()
+{
+    {
+        RBTree<std::string, std::less<std::string>, CountingAllocator<std::string>>::node_type node;
+        {
+            RBTree<std::string, std::less<std::string>, CountingAllocator<std::string>> tree;
+            for (int i = 0; i < 100; ++i) tree.insert(std::string(40, 'a' + i % 26) + std::to_string(i));
+            node = tree.extract(tree.iterator_to(tree.find(std::string(40, 'a') + "0")));
+            tree.extract(std::prev(tree.end()));
+            assert(tree.size() == 98 && violation(tree).empty());
+        }
+
+        // dropped unused, the node goes back to the pool it came from
+        assert(node.value() == std::string(40, 'a') + "0");
+    }
+
+    assert(live_allocations == 0);
+
+    RBMap<int, std::string> map;
+    map[1] = "one";
+    map[2] = "two";
+    RBMap<int, std::string> other;
+    auto result = other.insert(map.extract(2));
+    assert(result.inserted && result.position->second == "two");
+    assert(map.size() == 1 && other.size() == 1 && !map.contains(2));
+}
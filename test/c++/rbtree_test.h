@@ -3,10 +3,31 @@
 
 #ifndef SWIG
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <assert.h>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include "bplus_tree.hpp"
 #include "rbtree.hpp"
+#include "rbmap.hpp"
+#include "rbtree_concurrent.hpp"
+#include "rbtree_frozen.hpp"
+#include "rbtree_io.hpp"
 
 #endif
 
@@ -18,16 +39,119 @@ void test_insert_root();
 void test_insert_three_balanced_nodes();
 void test_insert_three_unbalanced_nodes_single_rotation();
 void test_insert_three_unbalanced_nodes_double_rotation();
+void test_insert_duplicate();
+void test_insert_rvalue();
+void test_emplace();
+void test_try_emplace();
 
 void test_find_empty_tree();
 void test_find_root();
 void test_find_existing_node();
 void test_find_non_existing_node();
+void test_find_custom_compare();
+void test_find_heterogeneous();
 
 void test_remove_when_internal_node();
 void test_remove_when_black_sibling_red_children_rl_rr();
 void test_remove_when_black_sibling_red_children_lr_ll();
 void test_remove_when_black_sibling_black_children_black_parent();
 void test_remove_when_red_sibling();
+void test_remove_root();
+
+void test_insert_comparisons_logarithmic();
+void test_remove_comparisons_logarithmic();
+
+void test_clear_tree();
+void test_copy_tree();
+void test_move_tree();
+void test_assign_stateful_compare();
+void test_custom_allocator();
+void test_compact_node_layout();
+
+void test_iterate_empty_tree();
+void test_iterate_in_order();
+void test_iterate_reverse();
+void test_iterate_after_remove();
+void test_iterate_map();
+
+void test_size();
+void test_select();
+void test_rank();
+void test_order_statistics_after_removals();
+
+void test_lower_upper_bound();
+void test_equal_range();
+void test_for_each_in_range();
+void test_count_range();
+
+void test_build_from_sorted();
+void test_build_from_unsorted();
+void test_build_from_input_iterator();
+void test_build_single_slab();
+void test_build_then_modify();
+
+void test_map_subscript();
+void test_map_insert_or_assign();
+void test_map_try_emplace();
+void test_map_values_stay_in_place();
+
+void test_split();
+void test_split_comparisons_logarithmic();
+void test_join();
+void test_union_independent_comparisons();
+void test_union_with();
+void test_intersect_with();
+void test_difference_with();
+void test_set_operations_reuse_nodes();
+void test_split_outlives_source();
+void test_set_operations_leave_other_independent();
+void test_split_keeps_size();
+void test_insert_batch();
+void test_erase_batch();
+void test_batch_comparisons();
+
+void test_scheduler_fork_join();
+void test_scheduler_exceptions();
+void test_parallel_set_operations();
+void test_parallel_build_from_sorted();
+
+void test_persistent_insert_remove();
+void test_persistent_versions_share_nodes();
+void test_persistent_frees_nodes();
+void test_concurrent_readers_and_writers();
+void test_concurrent_reclamation();
+void test_persistent_snapshot_restore();
+void test_concurrent_snapshots();
+
+void test_bplus_tree_against_set();
+void test_bplus_tree_bounds();
+void test_bplus_tree_copy_and_move();
+void test_search_tree_engines();
+void test_bplus_search_kernels();
+void test_bplus_tree_numeric_keys();
+
+void test_freeze_lookups();
+void test_freeze_outlives_tree();
+void test_freeze_failed_copy();
+
+void test_save_load();
+void test_load_rejects_bad_files();
+void test_mapped_tree();
+
+void test_dump_formats();
+void test_dump_limits();
+void test_dump_callback();
+
+void test_stats_counts();
+void test_stats_fix_states();
+
+void test_validate_detects_corruption();
+void test_profile_shapes();
+void test_random_workload_invariants();
+
+void test_erase_by_iterator();
+void test_extract_insert_between_trees();
+void test_extract_insert_separate_pools();
+void test_node_handle_outlives_tree();
 
 #endif // RB_TREE_TEST_H
\ No newline at end of file
@@ -10,4 +10,7 @@ T.print_tree()
 
 T.remove(5)
 
-T.print_tree()
\ No newline at end of file
+T.print_tree()
+
+stats = T.stats()
+print("comparisons:", stats.comparisons, "rotations:", stats.rotations)
@@ -3,19 +3,91 @@
 // required to correctly wrap smart shared pointers
 %include <std_shared_ptr.i>
 
+// file paths of save() and load()
+%include <std_string.i>
+
 // inform swig about what classes/structs are being
-// wrapped in a smart shared pointer
-%shared_ptr(RBTreeNode<int>);
-%shared_ptr(RBTreeNode<char>);
+// wrapped in a smart shared pointer. Nodes are owned by
+// the tree pool and are exposed as plain pointers.
 %shared_ptr(RBTree<int>);
 %shared_ptr(RBTree<char>);
 
 // required headers for the rbtree.hpp to compile
 %{
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "rbtree_pool.hpp"
+#include "rbtree_scheduler.hpp"
+#include "rbtree_io.hpp"
 %}
 
+// move-only overloads are of no use to the target languages
+%ignore RBTree<int>::insert(int&&);
+%ignore RBTree<char>::insert(char&&);
+%ignore RBTree<int>::union_with(RBTree<int>&&);
+%ignore RBTree<char>::union_with(RBTree<char>&&);
+%ignore RBTree<int>::intersect_with(RBTree<int>&&);
+%ignore RBTree<char>::intersect_with(RBTree<char>&&);
+%ignore RBTree<int>::difference_with(RBTree<int>&&);
+%ignore RBTree<char>::difference_with(RBTree<char>&&);
+
+// the wrapped trees are built without order statistics
+%ignore select;
+%ignore rank;
+%ignore count_range;
+
+// the scheduler is not wrapped, neither are its users
+%ignore parallel_union_with;
+%ignore parallel_intersect_with;
+%ignore parallel_difference_with;
+%ignore parallel_build_from_sorted;
+
+// frozen indexes are C++ only
+%ignore freeze;
+
+// streams and callbacks are C++ only, print_tree() is wrapped
+%ignore dump;
+
+// validate() is wrapped, the shape profile is read from C++
+%ignore profile;
+%ignore RBTreeProfile;
+
+// iterators are C++ only, scripting languages walk the nodes
+%ignore begin;
+%ignore end;
+%ignore cbegin;
+%ignore cend;
+%ignore rbegin;
+%ignore rend;
+%ignore crbegin;
+%ignore crend;
+%ignore iterator_to;
+%ignore lower_bound;
+%ignore upper_bound;
+%ignore equal_range;
+%ignore RBTreeIterator;
+
+// node handles are move-only, erase() takes iterators
+%ignore erase;
+%ignore extract;
+%ignore RBTree<int>::insert(RBTree<int>::node_type&&);
+%ignore RBTree<char>::insert(RBTree<char>::node_type&&);
+%ignore RBTreeNodeHandle;
+%ignore RBTreeInsertReturn;
+
 // wrap and declare the rbtree.hpp
 // equivalent to %{ #include "rbtree.hpp" %}
 // followed by %include "rbtree.hpp"
@@ -24,6 +96,7 @@
 %}
 
 // instantiating the needed types
+%template() RBTreeNodeSize<false>;
 %template(int_rbtree_node) RBTreeNode<int>;
 %template(char_rbtree_node) RBTreeNode<char>;
 %template(int_rbtree) RBTree<int>;